@@ -0,0 +1,54 @@
+#ifndef _BOARDCONFIG_H_
+#define _BOARDCONFIG_H_
+
+#include "mbed.h"
+#include "PinNames.h"
+#include "config.h"
+
+// Compile time configurations of the boards. The board drivers are templates on one of these,
+// so the loops in onTick have constant bounds and the branches on the settings are resolved
+// by the compiler instead of being tested at each tick.
+// A variant with a different outputs count or pins is a new struct here, plus an explicit
+// instantiation at the end of the board .cpp file.
+
+struct TriacBoardDefaultConfig
+{
+  static constexpr int OutputsCount = ANALOGOUT_COUNT;
+  static constexpr int TicksPerSecond = TICKS_PER_SECOND;
+  // zero-crossings per second (signal ~ 50 Hz)
+  static constexpr int RisePerSecond = RISE_PER_SECOND;
+  // Generate the zero-crossings from the tick instead of reading the crossover input
+  static constexpr bool SimulateVac = SIMULATE_VAC;
+  static constexpr PinName HeartbeatPin = LED2;
+  static constexpr PinName CrossoverPin = D10;
+  static const PinName OutputPins[OutputsCount];
+};
+
+struct RelayBoardDefaultConfig
+{
+  // Each chip select latches 8 relays from the shared data pins
+  static constexpr int ChipSelectsCount = 4;
+  static constexpr int OutputsCount = 8 * ChipSelectsCount;
+  // Switches waiting in the queue, 8 bytes each: a storyboard of thousands of on/off entries
+  // can be scheduled ahead, or at least the part of it not yet played
+  static constexpr int MaxScheduledEvents = 2048;
+  static const PinName DataPins[8];
+  static const PinName ChipSelectPins[ChipSelectsCount];
+};
+
+// IndexList<0, 1, ..., N-1>, used to construct the arrays of pins with the size from the config
+template <int... I>
+struct IndexList
+{
+};
+template <int N, int... I>
+struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...>
+{
+};
+template <int... I>
+struct MakeIndexList<0, I...>
+{
+  typedef IndexList<I...> Type;
+};
+
+#endif
@@ -1,21 +1,42 @@
 #include "relay_board.h"
-#include "bitLabCore\src\utils.h"
+#include "bitLabCore/src/utils.h"
+#include "../modules/Profiler.h"
 
-#define N_STATES 4
+const PinName RelayBoardDefaultConfig::DataPins[] = {(PC_0), (PC_1), (PB_0), (PA_4), (PA_1), (PA_0), (PC_3), (PC_2)};
+const PinName RelayBoardDefaultConfig::ChipSelectPins[] = {(D11), (D12), (D14), (PC_14)};
 
-RelayBoard::RelayBoard(): outputs({(PC_0), (PC_1), (PB_0), (PA_4), (PA_1), (PA_0), (PC_3), (PC_2)}),
-                          chipSelect({(D11),(D12),(D14),(PC_14)}) {
+template <class Config>
+RelayBoardT<Config>::RelayBoardT(): RelayBoardT(typename MakeIndexList<Config::ChipSelectsCount>::Type()) {
+}
+
+template <class Config>
+template <int... I>
+RelayBoardT<Config>::RelayBoardT(IndexList<I...>): outputs({Config::DataPins[0], Config::DataPins[1], Config::DataPins[2], Config::DataPins[3],
+                                                            Config::DataPins[4], Config::DataPins[5], Config::DataPins[6], Config::DataPins[7]}),
+                                                   chipSelect({Config::ChipSelectPins[I]...}),
+                                                   eventsCount(0),
+                                                   nextEventSeq(0),
+                                                   scheduleOverflowsCount(0) {
   //Initialize as all dirty and with all outputs at 0
   //They will be all updated on the next call to updateOutputs
-  for(int i=0; i<N_STATES; i++) {
+  for(int i=0; i<Config::ChipSelectsCount; i++) {
     states[i] = 0;
     statesDirty[i] = true;
     chipSelect[i] = 0; //Reset chip select
   }
 }
 
-void RelayBoard::setOutput(int outputIdx, int value) {
-  if (outputIdx < 0 || outputIdx >= 8*N_STATES) {
+template <class Config>
+void RelayBoardT<Config>::setOutput(int outputIdx, int value) {
+  //Critical section
+  __disable_irq();
+  applyOutput(outputIdx, value);
+  __enable_irq();
+}
+
+template <class Config>
+void RelayBoardT<Config>::applyOutput(int outputIdx, int value) {
+  if (outputIdx < 0 || outputIdx >= Config::OutputsCount) {
     //Undefined output!
     return;
   }
@@ -23,19 +44,112 @@ void RelayBoard::setOutput(int outputIdx, int value) {
   int stateBit = outputIdx % 8;
   uint8_t bitMask = 1 << stateBit;
 
-  //Critical section
-  __disable_irq();
   if (value > 0) {
     states[stateIdx] = states[stateIdx] | bitMask;
   } else {
     states[stateIdx] = states[stateIdx] & (~bitMask);
   }
   statesDirty[stateIdx] = true;
+}
+
+template <class Config>
+bool RelayBoardT<Config>::scheduleOutput(int outputIdx, int value, millisec time) {
+  if (outputIdx < 0 || outputIdx >= Config::OutputsCount) {
+    //Undefined output!
+    return false;
+  }
+
+  SwitchEvent event;
+  event.time = time;
+  event.outputIdx = outputIdx;
+  event.value = value > 0;
+
+  bool isScheduled = false;
+  //Critical section
+  __disable_irq();
+  if (eventsCount < Config::MaxScheduledEvents) {
+    event.seq = nextEventSeq;
+    nextEventSeq += 1;
+    heapPush(event);
+    isScheduled = true;
+  } else {
+    scheduleOverflowsCount += 1;
+  }
+  __enable_irq();
+  return isScheduled;
+}
+
+template <class Config>
+void RelayBoardT<Config>::clearScheduledOutputs() {
+  __disable_irq();
+  eventsCount = 0;
   __enable_irq();
 }
 
-void RelayBoard::onTick() {
-  for(int i=0; i<N_STATES; i++) {
+template <class Config>
+void RelayBoardT<Config>::onTick(millisec time) {
+  PROFILE_SCOPE(Profile_RelayTick);
+
+  //Only the due events are touched, so the cost doesn't depend on how many are queued
+  while (eventsCount > 0 && events[0].time <= time) {
+    applyOutput(events[0].outputIdx, events[0].value);
+    heapPopMin();
+  }
+  updateOutputs();
+}
+
+template <class Config>
+void RelayBoardT<Config>::heapPush(const SwitchEvent& event) {
+  //Sift up from the new leaf
+  int idx = eventsCount;
+  eventsCount += 1;
+  while (idx > 0) {
+    int parentIdx = (idx - 1) / 2;
+    if (!event.isBefore(events[parentIdx])) {
+      break;
+    }
+    events[idx] = events[parentIdx];
+    idx = parentIdx;
+  }
+  events[idx] = event;
+}
+
+template <class Config>
+void RelayBoardT<Config>::heapPopMin() {
+  //Move the last leaf to the root and sift it down
+  eventsCount -= 1;
+  if (eventsCount == 0) {
+    return;
+  }
+  SwitchEvent last = events[eventsCount];
+  int idx = 0;
+  while (true) {
+    int childIdx = idx * 2 + 1;
+    if (childIdx >= eventsCount) {
+      break;
+    }
+    if (childIdx + 1 < eventsCount && events[childIdx + 1].isBefore(events[childIdx])) {
+      childIdx += 1;
+    }
+    if (!events[childIdx].isBefore(last)) {
+      break;
+    }
+    events[idx] = events[childIdx];
+    idx = childIdx;
+  }
+  events[idx] = last;
+}
+
+template <class Config>
+void RelayBoardT<Config>::onTick() {
+  PROFILE_SCOPE(Profile_RelayTick);
+
+  updateOutputs();
+}
+
+template <class Config>
+void RelayBoardT<Config>::updateOutputs() {
+  for(int i=0; i<Config::ChipSelectsCount; i++) {
     //For each dirty state
     if (statesDirty[i]) {
       statesDirty[i] = false;
@@ -55,4 +169,6 @@ void RelayBoard::onTick() {
       chipSelect[i] = 0;
     }
   }
-}
\ No newline at end of file
+}
+
+template class RelayBoardT<RelayBoardDefaultConfig>;
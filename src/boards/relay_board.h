@@ -3,22 +3,70 @@
 
 #include "mbed.h"
 #include "PinNames.h"
+#include "board_config.h"
+#include "bitLabCore/src/os/types.h"
 
-class RelayBoard {
+//Config is one of the structs in board_config.h
+template <class Config>
+class RelayBoardT {
 public:
-  RelayBoard();
+  RelayBoardT();
 
   void setOutput(int outputIdx, int value);
+  //State of the output, 0 or 1, as last applied by setOutput or onTick
+  int getOutput(int outputIdx) { return (states[outputIdx / 8] >> (outputIdx % 8)) & 1; }
+  //Schedule the output to switch at the given time, it's applied by onTick(time).
+  //Returns false if the queue is full, the switch is lost and counted in getScheduleOverflowsCount.
+  bool scheduleOutput(int outputIdx, int value, millisec time);
+  void clearScheduledOutputs();
+  int getScheduledOutputsCount() { return eventsCount; }
+  int getMaxScheduledOutputsCount() { return Config::MaxScheduledEvents; }
+  //Switches rejected because the queue was full, to be reported to the master in TellStats
+  uint32_t getScheduleOverflowsCount() { return scheduleOverflowsCount; }
   void onTick();
+  //Apply the switches scheduled up to time, then update the outputs
+  void onTick(millisec time);
 
 private:
+  template <int... I>
+  RelayBoardT(IndexList<I...>);
+
   DigitalOut outputs[8];
-  DigitalOut chipSelect[4];
+  DigitalOut chipSelect[Config::ChipSelectsCount];
 
   //Each bit represent the output state of the corresponding relay
-  uint8_t states[4];
+  uint8_t states[Config::ChipSelectsCount];
   //Set if the corresponding state was updated since the last output update
-  bool statesDirty[4];
+  bool statesDirty[Config::ChipSelectsCount];
+
+  void applyOutput(int outputIdx, int value);
+  void updateOutputs();
+
+  //Scheduled switches, kept as a binary min-heap on (time, seq)
+  //so the next one to apply is always at index 0
+  //Packed in 8 bytes, the queue is the biggest buffer of the board
+  struct SwitchEvent {
+    millisec time;
+    //Keeps the scheduling order for the events with the same time, compared modulo 2^24
+    uint32_t seq : 24;
+    uint32_t outputIdx : 7;
+    uint32_t value : 1;
+
+    inline bool isBefore(const SwitchEvent& other) const {
+      return time < other.time || (time == other.time && (int32_t)((uint32_t)(seq - other.seq) << 8) < 0);
+    }
+  };
+  static_assert(sizeof(SwitchEvent) == 8, "SwitchEvent must stay packed");
+  static_assert(Config::OutputsCount <= 128, "outputIdx has 7 bits");
+  SwitchEvent events[Config::MaxScheduledEvents];
+  int eventsCount;
+  uint32_t nextEventSeq;
+  uint32_t scheduleOverflowsCount;
+
+  void heapPush(const SwitchEvent& event);
+  void heapPopMin();
 };
 
-#endif
\ No newline at end of file
+typedef RelayBoardT<RelayBoardDefaultConfig> RelayBoard;
+
+#endif
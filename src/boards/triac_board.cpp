@@ -1,45 +1,66 @@
 #include "triac_board.h"
 
-#include "..\bitLabCore\src\os\os.h"
+#include "bitLabCore/src/os/os.h"
+#include "../modules/Profiler.h"
 
-TriacBoard::TriacBoard() : led_heartbeat(LED2),
-                           outputs({(D2), (D3), (D4), (D5), (D6), (D7), (D8), (D9)}),
-                           main_crossover(D10)
+const PinName TriacBoardDefaultConfig::OutputPins[] = {(D2), (D3), (D4), (D5), (D6), (D7), (D8), (D9)};
+
+template <class Config>
+constexpr int TriacBoardT<Config>::NominalTicksPerRise;
+template <class Config>
+constexpr int TriacBoardT<Config>::NominalTicksMaxDelta;
+template <class Config>
+constexpr int TriacBoardT<Config>::GateTicks;
+
+template <class Config>
+TriacBoardT<Config>::TriacBoardT() : TriacBoardT(typename MakeIndexList<Config::OutputsCount>::Type())
+{
+}
+
+template <class Config>
+template <int... I>
+TriacBoardT<Config>::TriacBoardT(IndexList<I...>) : led_heartbeat(Config::HeartbeatPin),
+                                                     outputs({Config::OutputPins[I]...}),
+                                                     main_crossover(Config::CrossoverPin)
 {
   input50HzIsStable = 0;
   ticksSinceZeroCross = 0;
   lastZeroCrossDurationInTicks = 0;
   zeroCrossesCount = 0;
 
-  for (int i = 0; i < ANALOGOUT_COUNT; i++) {
+  for (int i = 0; i < Config::OutputsCount; i++) {
     states[i].reset(); 
   }
 
-  if (!SIMULATE_VAC)
-    main_crossover.rise(callback(this, &TriacBoard::main_crossover_rise));
+  if (!Config::SimulateVac)
+    main_crossover.rise(callback(this, &TriacBoardT::main_crossover_rise));
 }
 
-void TriacBoard::setOutput(int idx, int value, millisec startTime, millisec duration)
+template <class Config>
+void TriacBoardT<Config>::setOutput(int idx, int value, millisec startTime, millisec duration)
 {
   __disable_irq();
   states[idx].set(value, startTime, duration);
   __enable_irq();
 }
 
-void TriacBoard::onTick(millisec time)
+template <class Config>
+void TriacBoardT<Config>::onTick(millisec time)
 {
+  PROFILE_SCOPE(Profile_TriacTick);
+
   ticksSinceZeroCross += 1;
 
   //Somehow using a ticker for simulation gives wrong timings...
-  if (SIMULATE_VAC) {
-    if (ticksSinceZeroCross == NOMINAL_100HZ_TICKS_PER_RISE) {
+  if (Config::SimulateVac) {
+    if (ticksSinceZeroCross == NominalTicksPerRise) {
       main_crossover_rise();
     }
   }
 
   if (!input50HzIsStable) {
     //No stable input, all outputs to zero
-    for (int out = 0; out < ANALOGOUT_COUNT; out++)
+    for (int out = 0; out < Config::OutputsCount; out++)
     {
       outputs[out] = 0;
     }
@@ -47,14 +68,14 @@ void TriacBoard::onTick(millisec time)
   }
 
   // set/reset each out based on percent
-  for (int out = 0; out < ANALOGOUT_COUNT; out++)
+  for (int out = 0; out < Config::OutputsCount; out++)
   {
     states[out].update(time);
 
     int valueToSet;
     int low_ticks = lastZeroCrossDurationInTicks * ((100.0 - (states[out].value)) / 100.0);
 
-    if (SIMULATE_VAC)
+    if (Config::SimulateVac)
     {
       if (ticksSinceZeroCross > low_ticks)
         valueToSet = 1;
@@ -64,7 +85,7 @@ void TriacBoard::onTick(millisec time)
     else
     {
       // pulse for TRIAC activation
-      if ((ticksSinceZeroCross < low_ticks) || (ticksSinceZeroCross > (low_ticks + GATE_TICKS)))
+      if ((ticksSinceZeroCross < low_ticks) || (ticksSinceZeroCross > (low_ticks + GateTicks)))
         valueToSet = 0;
       else
         valueToSet = 1;
@@ -74,29 +95,33 @@ void TriacBoard::onTick(millisec time)
   }
 }
 
-void TriacBoard::debugPrintOutputs() {
-  for (int out = 0; out < ANALOGOUT_COUNT; out++)
+template <class Config>
+void TriacBoardT<Config>::debugPrintOutputs() {
+  for (int out = 0; out < Config::OutputsCount; out++)
   {
     Os::debug("#%i=%3i[%3i-%3i], ", out+1, states[out].value, states[out].from, states[out].to);
   }
   Os::debug("\n");
 }
 
-void TriacBoard::main_crossover_rise()
+template <class Config>
+void TriacBoardT<Config>::main_crossover_rise()
 {
   lastZeroCrossDurationInTicks = ticksSinceZeroCross;
   ticksSinceZeroCross = 0;
 
-  //NOMINAL_100HZ_TICKS_PER_RISE is twice the nominal 50Hz duration in ticks 
+  //NominalTicksPerRise is twice the nominal 50Hz duration in ticks 
   //twice because we have 100 zero crossing for a 50Hz sinusoidal wave
   //Force all outputs to zero if the last measured duration is more than 20% off than the nominal one
   //This detects the condition where we don't have a stable 50Hz sinusoidal wave
-  input50HzIsStable = true || Utils::absDiff(lastZeroCrossDurationInTicks, NOMINAL_100HZ_TICKS_PER_RISE) < NOMINAL_100HZ_TICKS_MAX_DELTA;
+  input50HzIsStable = true || Utils::absDiff(lastZeroCrossDurationInTicks, NominalTicksPerRise) < NominalTicksMaxDelta;
 
   zeroCrossesCount += 1;
-  if (zeroCrossesCount == RISE_PER_SECOND)
+  if (zeroCrossesCount == Config::RisePerSecond)
   {
     zeroCrossesCount = 0;
     led_heartbeat = !led_heartbeat;
   }
-}
\ No newline at end of file
+}
+
+template class TriacBoardT<TriacBoardDefaultConfig>;
\ No newline at end of file
@@ -3,27 +3,38 @@
 
 #include "mbed.h"
 #include "PinNames.h"
-#include "config.h"
-#include "..\bitLabCore\src\utils.h"
+#include "board_config.h"
+#include "bitLabCore/src/utils.h"
 
-class TriacBoard
+// Config is one of the structs in board_config.h
+template <class Config>
+class TriacBoardT
 {
 public:
-  TriacBoard();
+  TriacBoardT();
 
   void setOutput(int outputIdx, int value, millisec startTime, millisec duration);
   void onTick(millisec time);
   bool getInput50HzIsStable() { return input50HzIsStable; }
   float getMeasured50HzFrequency()
   {
-    return ((float)TICKS_PER_SECOND) / (lastZeroCrossDurationInTicks * 2.0f);
+    return ((float)Config::TicksPerSecond) / (lastZeroCrossDurationInTicks * 2.0f);
   }
   void debugPrintOutputs();
 
 private:
+  // ticks between two zero-crossings
+  static constexpr int NominalTicksPerRise = Config::TicksPerSecond / Config::RisePerSecond;
+  static constexpr int NominalTicksMaxDelta = (int)(NominalTicksPerRise * 0.2);
+  // ticks needed to activate TRIAC till the next crossover
+  static constexpr int GateTicks = NominalTicksPerRise * 1 / 100;
+
+  template <int... I>
+  TriacBoardT(IndexList<I...>);
+
   // show connection to 50Hz external signal (230Vac)
   DigitalOut led_heartbeat;
-  DigitalOut outputs[ANALOGOUT_COUNT];
+  DigitalOut outputs[Config::OutputsCount];
 
   InterruptIn main_crossover;
 
@@ -66,7 +77,7 @@ private:
     }
   };
   // percent set for each output
-  OutputState states[ANALOGOUT_COUNT];
+  OutputState states[Config::OutputsCount];
 
   bool input50HzIsStable;
   int zeroCrossesCount;
@@ -76,4 +87,6 @@ private:
   void main_crossover_rise();
 };
 
+typedef TriacBoardT<TriacBoardDefaultConfig> TriacBoard;
+
 #endif
\ No newline at end of file
@@ -1,9 +1,10 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-#include "bitLabCore\src\os\types.h"
+#include "bitLabCore/src/os/types.h"
 
 // this file contains tickers, clocks and timeline settings
+// the boards read them through their config struct, see boards\board_config.h
 
 // internal clock ticks per second
 #define TICKS_PER_SECOND (100 * 100)
@@ -14,12 +15,6 @@
 // zero-crossings per second (signal ~ 50 Hz)
 #define RISE_PER_SECOND 100
 
-// ticks between two zero-crossings
-#define NOMINAL_100HZ_TICKS_PER_RISE (TICKS_PER_SECOND / RISE_PER_SECOND)
-#define NOMINAL_100HZ_TICKS_MAX_DELTA ((int)(NOMINAL_100HZ_TICKS_PER_RISE * 0.2))
-// ticks needed to activate TRIAC till the next crossover
-#define GATE_TICKS (NOMINAL_100HZ_TICKS_PER_RISE * 1 / 100)
-
 // 1/10sec
 #define TIMELINE_DURATION 40
 #define ANALOGOUT_COUNT 8
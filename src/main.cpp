@@ -1,17 +1,26 @@
-#include "bitLabCore\src\os\bitLabCore.h"
-#include "bitLabCore\src\net\RingNetwork.h"
-#include "bitLabCore\src\storyboard\StoryboardPlayer.h"
-#include "boards\triac_board.h"
-#include "boards\relay_board.h"
-#include "modules\MasterBoard.h"
+#include "bitLabCore/src/os/bitLabCore.h"
+#include "bitLabCore/src/net/RingNetwork.h"
+#include "bitLabCore/src/storyboard/StoryboardPlayer.h"
+#include "boards/triac_board.h"
+#include "boards/relay_board.h"
+#include "modules/MasterBoard.h"
 
 bitLabCore core;
 RingNetwork rn(PA_11, PA_12, true);
+#ifdef UseSecondRing
+// Second ring, on USART1
+RingNetwork rn2(PA_9, PA_10, true);
+#endif
 MasterBoard mb;
 
 int main() {
   core.init();
   core.addModule(&rn);
+  mb.addRing(&rn);
+#ifdef UseSecondRing
+  core.addModule(&rn2);
+  mb.addRing(&rn2);
+#endif
   core.addModule(&mb);
   core.run();
 }
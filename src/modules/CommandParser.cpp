@@ -2,64 +2,106 @@
 
 #include <cstring>
 
-#include "..\bitLabCore\src\Utils.h"
+#include "bitLabCore/src/utils.h"
 
-CommandParser::CommandParser() : tokensCount(0)
+CommandParser::CommandParser() : lineLength(0), lineOverflow(false), tokensCount(0)
 {
+  line[0] = '\0';
 }
 
-char *strFindSeparatorOrEnd(const char *str, char c1)
+bool CommandParser::feed(char c)
 {
-  while (true)
+  if (c == '\r')
   {
-    char strChar = *str;
-    if (strChar == '\0' || strChar == '\n' || strChar == c1)
-    {
-      return (char *)str;
-    }
-    str += 1;
+    return false;
+  }
+
+  if (c == '\n')
+  {
+    line[lineLength] = '\0';
+    return true;
+  }
+
+  // Keep a char for the terminator
+  if (lineLength == lineSize - 1)
+  {
+    lineOverflow = true;
+    return false;
   }
+
+  line[lineLength] = c;
+  lineLength += 1;
+  return false;
 }
 
-bool CommandParser::tryParse()
+void CommandParser::reset()
 {
-  // Make sure there's a null character at end
-  line[lineSize - 1] = '\0';
+  lineLength = 0;
+  lineOverflow = false;
+  tokensCount = 0;
+  line[0] = '\0';
+}
 
-  char *ptrCurr = line;
+bool CommandParser::tryParse()
+{
   tokensCount = 0;
+  if (lineOverflow)
+  {
+    return false;
+  }
+  line[lineLength] = '\0';
+
+  uint32_t idx = 0;
   while (true)
   {
-    char *ptrSeparator = strFindSeparatorOrEnd(ptrCurr, ' ');
-    if (ptrSeparator > ptrCurr)
+    // Skip the separators
+    while (line[idx] == ' ')
+    {
+      idx += 1;
+    }
+    if (line[idx] == '\0')
+    {
+      // End of input, stop parsing
+      break;
+    }
+
+    char terminator = ' ';
+    if (line[idx] == '"')
     {
-      // We found a token, terminated by either the separator ' ', '\n' or '\0'
-      if (tokensCount == tokensSize)
-      {
-        // We matched a token but no more space is left, error
-        return false;
-      }
-
-      tokens[tokensCount].idxStart = ptrCurr - line;
-      tokens[tokensCount].length = ptrSeparator - ptrCurr;
-      tokensCount += 1;
+      // Quoted token, it ends at the closing quote and can contain spaces
+      terminator = '"';
+      idx += 1;
     }
 
-    ptrCurr = ptrSeparator;
-    bool isSpace = (*ptrSeparator == ' ');
-    // Replace the space, the \n or the \0 with a \0, so the token content can be used like a c string
-    *ptrSeparator = '\0';
-    if (isSpace)
+    uint32_t idxStart = idx;
+    while (line[idx] != '\0' && line[idx] != terminator)
     {
-      // The separator was found, skip it and search another token
-      ptrCurr += 1;
-      continue;
+      idx += 1;
     }
-    else
+
+    if (terminator == '"' && line[idx] != '"')
+    {
+      // Missing closing quote
+      return false;
+    }
+
+    if (tokensCount == tokensSize)
+    {
+      // We matched a token but no more space is left, error
+      return false;
+    }
+
+    tokens[tokensCount].idxStart = idxStart;
+    tokens[tokensCount].length = idx - idxStart;
+    tokensCount += 1;
+
+    if (line[idx] == '\0')
     {
-      // End of input, stop parsing
       break;
     }
+    // Replace the separator with a \0, so the token content can be used like a c string
+    line[idx] = '\0';
+    idx += 1;
   }
 
   return tokensCount > 0;
@@ -67,9 +109,15 @@ bool CommandParser::tryParse()
 
 bool CommandParser::isCommand(const char *cmd)
 {
-  if (tokensCount < 1)
+  return tokenIs(0, cmd);
+}
+
+bool CommandParser::tokenIs(uint32_t tokenIdx, const char *str)
+{
+  if (tokenIdx >= tokensCount)
     return false;
-  return strncmp(cmd, getTokenString(0), getTokenLength(0)) == 0;
+  return strlen(str) == getTokenLength(tokenIdx) &&
+         strncmp(str, getTokenString(tokenIdx), getTokenLength(tokenIdx)) == 0;
 }
 
 bool CommandParser::tryParseUInt32(uint32_t tokenIdx, uint32_t &value, uint32_t base)
@@ -80,6 +128,14 @@ bool CommandParser::tryParseUInt32(uint32_t tokenIdx, uint32_t &value, uint32_t
   return Utils::strTryParse(getTokenString(tokenIdx), getTokenLength(tokenIdx), value, base);
 }
 
+bool CommandParser::tryParseBase64(uint32_t tokenIdx, uint8_t *buff, uint32_t buffSize, uint32_t *length)
+{
+  if (tokenIdx >= tokensCount)
+    return false;
+
+  return Utils::tryBase64Decode(getTokenString(tokenIdx), getTokenLength(tokenIdx), buff, buffSize, length);
+}
+
 const char* CommandParser::getTokenString(uint32_t tokenIdx)
 {
   if (tokenIdx >= tokensCount)
@@ -94,4 +150,4 @@ uint32_t CommandParser::getTokenLength(uint32_t tokenIdx)
     return 0;
 
   return tokens[tokenIdx].length;
-}
\ No newline at end of file
+}
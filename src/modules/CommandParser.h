@@ -4,33 +4,48 @@
 #include <cstdint>
 
 struct Token {
-  uint32_t idxStart;
-  uint32_t length;
+  uint8_t idxStart;
+  uint8_t length;
 };
 
+// Line parser fed one char at a time from the chars the RX interrupt queued in SerialRxBuffer,
+// each one is copied once, into the line of the parser. It's a member, so nothing of it is on the
+// stack of mainLoop. Tokens are separated by spaces and can be quoted with ".
+// Tokens are null terminated in place in the line, so they can be used like c strings.
 class CommandParser
 {
 public:
   CommandParser();
 
   const static uint32_t lineSize = 256;
-  char line[lineSize];
+
+  // Appends a received char, returns true when a whole line is available to tryParse
+  bool feed(char c);
+  // Discards the current line, call it when done with the parsed tokens
+  void reset();
 
   bool tryParse();
   inline uint32_t getTokensCount() { return tokensCount; }
   inline void getToken(uint32_t i, Token& token) { token = tokens[i]; }
 
   bool isCommand(const char* cmd);
+  bool tokenIs(uint32_t tokenIdx, const char* str);
   // + 1 because the first token is always the command name
   bool argsCountIs(uint32_t argCount) { return tokensCount == argCount + 1; }
   bool tryParseUInt32(uint32_t tokenIdx, uint32_t &value, uint32_t base = 10);
+  bool tryParseBase64(uint32_t tokenIdx, uint8_t* buff, uint32_t buffSize, uint32_t* length);
   const char* getTokenString(uint32_t tokenIdx);
   uint32_t getTokenLength(uint32_t tokenIdx);
 
 private:
-  const static uint32_t tokensSize = 128;
+  char line[lineSize];
+  uint32_t lineLength;
+  bool lineOverflow;
+
+  // Commands have few arguments, long data like file chunks is a single token
+  const static uint32_t tokensSize = 8;
   Token tokens[tokensSize];
   uint32_t tokensCount;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,38 @@
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include <cstdint>
+
+// The STM32F4 has a CRC peripheral that takes a whole word per write
+#if defined(TARGET_STM32F4)
+#define UseHardwareCrc
+#endif
+
+// Standard CRC-32 (the zlib one, reflected polynomial 0xEDB88320), computed incrementally.
+// Whole words go to the CRC peripheral when available, the remaining bytes and the other
+// targets use a table; the result is the same either way.
+// The peripheral is a single resource: use one Crc32 at a time, from mainLoop only.
+class Crc32
+{
+public:
+  Crc32();
+
+  void begin();
+  void update(const void *data, uint32_t length);
+  // Little endian, like the values in the ring packets
+  void updateInt32(int32_t value);
+  uint32_t end();
+
+  static uint32_t calc(const void *data, uint32_t length);
+
+private:
+  uint32_t state;
+  // Bytes waiting for a whole word
+  uint8_t pending[4];
+  uint32_t pendingCount;
+
+  void updateWord(const uint8_t *bytes);
+  void updateByte(uint8_t byte);
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "DeferredQueue.h"
+
+DeferredQueue::DeferredQueue() : head(0),
+                                 tail(0),
+                                 postedCount(0),
+                                 droppedCount(0),
+                                 maxUsedBytes(0)
+{
+}
+
+bool DeferredQueue::post(uint8_t type, const void *payload, uint8_t size)
+{
+  uint32_t currHead = head;
+  uint32_t used = currHead - tail;
+  uint32_t recordSize = 2 + size;
+  if (used + recordSize > Capacity)
+  {
+    droppedCount += 1;
+    return false;
+  }
+
+  buffer[currHead & Mask] = type;
+  buffer[(currHead + 1) & Mask] = size;
+  const uint8_t *src = (const uint8_t *)payload;
+  for (uint32_t i = 0; i < size; i++)
+  {
+    buffer[(currHead + 2 + i) & Mask] = src[i];
+  }
+
+  // The record must be complete before the consumer can see it
+  __DMB();
+  head = currHead + recordSize;
+
+  postedCount += 1;
+  if (used + recordSize > maxUsedBytes)
+    maxUsedBytes = used + recordSize;
+  return true;
+}
+
+bool DeferredQueue::post(uint8_t type, uint32_t arg1, uint32_t arg2)
+{
+  uint32_t args[2] = {arg1, arg2};
+  return post(type, args, sizeof(args));
+}
+
+bool DeferredQueue::tryPop(uint8_t &type, uint8_t *payload, uint8_t &size)
+{
+  uint32_t currTail = tail;
+  if (currTail == head)
+    return false;
+
+  // Read the record only after seeing the head that published it
+  __DMB();
+  type = buffer[currTail & Mask];
+  size = buffer[(currTail + 1) & Mask];
+  for (uint32_t i = 0; i < size; i++)
+  {
+    payload[i] = buffer[(currTail + 2 + i) & Mask];
+  }
+
+  // The space can be reused only after it was read
+  __DMB();
+  tail = currTail + 2 + size;
+  return true;
+}
@@ -0,0 +1,46 @@
+#ifndef _DEFERREDQUEUE_H_
+#define _DEFERREDQUEUE_H_
+
+#include "mbed.h"
+
+// Work posted by the ring packet callback and done later by mainLoop, like printing a message.
+// Single producer (the callback) and single consumer (mainLoop), so no lock is needed:
+// only the producer writes head and only the consumer writes tail.
+// Records are [type][size][payload] in a byte ring; posting is bounded by the payload size
+// and never waits, when the ring is full the record is dropped and counted.
+class DeferredQueue
+{
+public:
+  DeferredQueue();
+
+  const static uint32_t Capacity = 1024; // Must be a power of 2
+  const static uint32_t MaxPayloadSize = 255;
+
+  // --- Producer ---
+  bool post(uint8_t type, const void *payload, uint8_t size);
+  bool post(uint8_t type, uint32_t arg1, uint32_t arg2);
+  // ----------------
+
+  // --- Consumer ---
+  // payload must have room for MaxPayloadSize bytes
+  bool tryPop(uint8_t &type, uint8_t *payload, uint8_t &size);
+  // ----------------
+
+  inline uint32_t getPostedCount() { return postedCount; }
+  inline uint32_t getDroppedCount() { return droppedCount; }
+  inline uint32_t getMaxUsedBytes() { return maxUsedBytes; }
+
+private:
+  const static uint32_t Mask = Capacity - 1;
+
+  uint8_t buffer[Capacity];
+  // Free running counters, the position in buffer is the counter & Mask
+  volatile uint32_t head;
+  volatile uint32_t tail;
+
+  uint32_t postedCount;
+  uint32_t droppedCount;
+  uint32_t maxUsedBytes;
+};
+
+#endif
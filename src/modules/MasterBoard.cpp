@@ -1,407 +1,1911 @@
 #include "MasterBoard.h"
-#include "CommandParser.h"
 
-#include "..\bitLabCore\src\utils.h"
-#include "..\bitLabCore\src\storyboard\StoryboardLoader.h"
+#include "bitLabCore/src/utils.h"
+#include "bitLabCore/src/storyboard/StoryboardLoader.h"
 
-Serial serial(USBTX, USBRX);
+// RawSerial, because getc is called from the RX interrupt and Serial would lock a mutex
+RawSerial serial(USBTX, USBRX);
+
+const char *StoryboardFileName = "/sd/storyboard.json";
+const char *ShowCatalogFileName = "/sd/shows.txt";
+const char *AutostartFileName = "/sd/autostart";
+const char *UploadCacheFileName = "/sd/uploadcache.txt";
+const char *StreamFileName = "/sd/storyboard.bin";
 
 MasterBoard::MasterBoard() : led(LED2),
-                             lastIsConnected(false),
                              connectionLostCount(0),
+                             isEnumerationDone(false),
                              inPlay(PB_13),
                              inStop(PB_14),
-                             inputDebounceTimeout(0),
+                             inputDebounceTimer(),
                              pressedKey(EInputKey::Key_None),
-                             pressedKeyTime(0),
+                             pressedKeyStartTime(0),
                              isDisplayDirty(false),
                              displayState(EDisplayState::Home),
                              selectedCommand(ECommand::Load),
+                             selectedShowIdx(0),
                              i2c(D5, D7),
                              oled(i2c, NC),
+                             textDisplay(i2c),
+                             timers(),
                              upTime(0),
-                             eachSecondTimeout(1000),
+                             eachSecondTimer(),
                              secondElapsed(false),
                              storyboardTime(0),
                              isPlaying(false),
+                             playLoopsCount(0),
                              openFile(NULL),
                              state(EState::WaitAddressAssigned),
-                             protocolState(EProtocolState::PS_Idle),
-                             state_currDeviceIdx(0),
-                             state_nextTimelineIdxMaybeToSend(0),
+                             rings(),
+                             ringsCount(0),
                              stateArg_OutputId(0),
                              stateArg_Value(0),
-                             freePacketsCount(0),
                              enumeratedAddressesCount(0),
-                             storyboard(),
-                             waitStateTimeout(0),
-                             waitStateTimeoutEnabled(false)
+                             storyboards(),
+                             storyboard(&storyboards[0]),
+                             uploadStoryboard(&storyboards[0]),
+                             optimizers(),
+                             uploadImage(),
+                             uploadImageStoryboard(NULL),
+                             uploadImagePacketsSaved(0),
+                             retriesCount(0),
+                             timeoutsCount(0),
+                             telemetry(),
+                             statsPollTimer(),
+                             statsPollDue(false),
+                             statsPollDeviceIdx(0),
+                             commandParser(),
+                             streamStep(EStreamStep::SS_None),
+                             streamReader(),
+                             streamPacketSize(0),
+                             streamPacketRingIdx(0),
+                             streamPacketAddress(0),
+                             streamPacketReady(false),
+                             streamStartTimeUs(0),
+                             streamPacketsCount(0),
+                             streamEntriesCount(0),
+                             streamLateCount(0),
+                             streamSkippedCount(0),
+                             recoveryStep(ERecoveryStep::RC_None),
+                             recoveryStartTimeUs(0),
+                             previousDevicesCount(0),
+                             recoveryNewCount(0),
+                             recoveryLostCount(0),
+                             recoveryUploadCount(0),
+                             showCatalog(),
+                             showStep(EShowStep::SW_None),
+                             showSwitchIdx(0),
+                             currentShowName(),
+                             showCrc(0),
+                             showWasPlaying(false),
+                             showStartTimeUs(0),
+                             showUploadCount(0),
+                             scriptFile(NULL),
+                             scriptParser(),
+                             scriptLineReady(false),
+                             scriptLineNumber(0),
+                             scriptStartTimeUs(0),
+                             scriptTimingsCount(0),
+                             scriptRingCommandLineNumber(0),
+                             scriptRingCommandTimingIdx(-1),
+                             lastProcedureFailed(false),
+                             autostartStep(EAutostartStep::AS_None),
+                             autostartStartTimeUs(0),
+                             reloadStep(EReloadStep::RS_None),
+                             commitAtLoopEnd(false),
+                             commitPending(false)
+{
+}
+
+void MasterBoard::init(const bitLabCore *core)
+{
+  serial.baud(115200);
+  serial.puts("Hello!\n");
+  serial.attach(callback(this, &MasterBoard::onSerialRx), RawSerial::RxIrq);
+
+#ifdef UseProfiling
+  Profiler::init();
+#endif
+
+  oled.clearDisplay();
+  oled.printf("Initializing...");
+  oled.display();
+
+  //serial.baud(1200);
+  if (ringsCount == 0)
+  {
+    addRing((RingNetwork *)core->findModule("RingNetwork"));
+  }
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    rings[i].ringNetwork->attachOnPacketReceived(callback(&rings[i], &RingContext::onPacketReceived));
+  }
+
+  hardwareId = core->getHardwareId();
+  clockSourceDescr = core->getClockSourceDescr();
+
+  oled.printf("[ok]\r\n");
+  oled.printf("hwId=%08X\r\n", hardwareId);
+  oled.display();
+
+  textDisplay.init();
+
+  timers.startPeriodic(eachSecondTimer, 1000, callback(this, &MasterBoard::onEachSecondTimer));
+  timers.startPeriodic(statsPollTimer, StatsPollInterval, callback(this, &MasterBoard::onStatsPollTimer));
+}
+
+void MasterBoard::addRing(RingNetwork *ringNetwork)
+{
+  if (ringsCount == MaxRings)
+    return;
+
+  auto &ring = rings[ringsCount];
+  ring.owner = this;
+  ring.idx = ringsCount;
+  ring.ringNetwork = ringNetwork;
+  ring.lastIsConnected = false;
+  ring.protocolState = EProtocolState::PS_Idle;
+  ring.currDeviceIdx = 0;
+  ring.uploadPacketOffset = 0;
+  ring.uploadedAddressMask = 0;
+  ring.retriesCount = 0;
+  ring.devicesCount = 0;
+  ring.freePacketsCount = 0;
+  ring.waitStateTimedOut = false;
+  ring.lastPacketTimeUs = 0;
+  ring.lastPacketTimeValid = false;
+  ring.requestSentTimeUs = 0;
+  ringsCount += 1;
+}
+
+void MasterBoard::mainLoop()
+{
+  PROFILE_SCOPE(Profile_MasterMainLoop);
+
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    auto &ring = rings[i];
+    bool newIsConnected = ring.ringNetwork->getIsConnected();
+    if (ring.lastIsConnected != newIsConnected)
+    {
+      if (!newIsConnected)
+      {
+        connectionLostCount += 1;
+        if (recoveryStep != ERecoveryStep::RC_None)
+        {
+          endRecovery(false);
+        }
+      }
+      else if (isEnumerationDone)
+      {
+        // The devices of the other rings are enumerated again too, it's quick and keeps a single registry
+        startRecovery();
+      }
+      ring.lastIsConnected = newIsConnected;
+      isDisplayDirty = true;
+    }
+  }
+
+  switch (state)
+  {
+  case EState::WaitAddressAssigned:
+  {
+    // The rings without an address yet are enumerated by the recovery, when they connect
+    bool isAnyAddressAssigned = false;
+    for (uint32_t i = 0; i < ringsCount; i++)
+    {
+      isAnyAddressAssigned = isAnyAddressAssigned || rings[i].ringNetwork->isAddressAssigned();
+    }
+    if (isAnyAddressAssigned)
+    {
+      for (uint32_t i = 0; i < ringsCount; i++)
+      {
+        if (rings[i].ringNetwork->isAddressAssigned())
+        {
+          serial.printf("Address assigned: ring %u, %i\n", i, rings[i].ringNetwork->getAddress());
+        }
+      }
+      serial.printf("Starting enumeration...\n");
+      startEnumeration();
+    }
+    break;
+  }
+
+  case EState::Enumerating:
+    if (areAllRingsIdle())
+    {
+      serial.printf("Enumeration completed, %i found\n", enumeratedAddressesCount);
+      // Enumeration is complete
+      isDisplayDirty = true;
+      state = EState::Idle;
+
+      // Only at startup, after a reconnection mainLoop_recovery takes it from here
+      if (!isEnumerationDone && showCatalog.load(ShowCatalogFileName))
+      {
+        serial.printf("Show catalog: %u shows\n", showCatalog.getCount());
+      }
+      FILE *autostartFile = !isEnumerationDone ? fopen(AutostartFileName, "r") : NULL;
+      isEnumerationDone = true;
+      if (autostartFile != NULL)
+      {
+        fclose(autostartFile);
+        command_Autostart();
+      }
+    }
+    break;
+
+  case EState::Idle:
+    break;
+
+  case EState::BusyWithProtocol:
+    break;
+  }
+
+  if (secondElapsed)
+  {
+    secondElapsed = false;
+    telemetry.onSecondElapsed();
+    // Update the display with live stats once a second (packet count)
+    if (displayState == EDisplayState::Stats)
+    {
+      isDisplayDirty = true;
+    }
+  }
+
+  mainLoop_deferred();
+
+  mainLoop_checkForWaitStateTimeout();
+
+  if (telemetry.tryTakeUploadEnded())
+  {
+    printUploadReport();
+  }
+
+  mainLoop_serialProtocol();
+
+  mainLoop_script();
+
+  mainLoop_autostart();
+
+  mainLoop_reload();
+
+  mainLoop_show();
+
+  mainLoop_stream();
+
+  mainLoop_recovery();
+
+  mainLoop_statsPoll();
+
+  mainLoop_keyboard();
+
+  printDisplay();
+  textDisplay.service();
+}
+
+void MasterBoard::mainLoop_checkForWaitStateTimeout()
+{
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    auto &ring = rings[i];
+    if (!ring.waitStateTimedOut)
+      continue;
+
+    ring.waitStateTimedOut = false;
+    timeoutsCount += 1;
+    if (isPollingStats(ring))
+    {
+      // Background work, no retries: the device is polled again in the next round
+      enumeratedAddresses[ring.currDeviceIdx].stats.timeoutsCount += 1;
+      goToStateIdle(ring);
+    }
+    else if (!tryRetryProtocolState(ring))
+    {
+      // The other rings complete their part, the procedure fails when all of them are done
+      telemetry.endUpload(us_ticker_read(), false);
+      lastProcedureFailed = true;
+      if (state == EState::Enumerating)
+      {
+        // Keep the devices found so far, the Enumerating state completes as usual
+        goToStateIdle2(ring);
+      }
+      else
+      {
+        goToStateIdle(ring);
+      }
+      serial.printf("Timeout on ring %u\n", i);
+    }
+  }
+}
+
+void MasterBoard::mainLoop_deferred()
+{
+  // A few records per loop, so a burst of messages doesn't stall the rest of mainLoop
+  uint8_t type;
+  uint8_t payload[DeferredQueue::MaxPayloadSize + 1];
+  uint8_t size;
+  for (int i = 0; i < 8; i++)
+  {
+    // Round robin across the rings, so a busy one doesn't hold the messages of the others
+    int32_t ringIdx = -1;
+    for (uint32_t j = 0; j < ringsCount && ringIdx < 0; j++)
+    {
+      if (rings[(i + j) % ringsCount].deferredQueue.tryPop(type, payload, size))
+        ringIdx = (i + j) % ringsCount;
+    }
+    if (ringIdx < 0)
+      break;
+
+    switch (type)
+    {
+    case EDeferredWork::Deferred_DebugPrint:
+      payload[size] = '\0';
+      serial.puts((char *)payload);
+      break;
+
+    case EDeferredWork::Deferred_DeviceFound:
+    {
+      uint32_t args[2];
+      memcpy(args, payload, sizeof(args));
+      serial.printf("Found device ring=%i addr=%u hwId=%08X\n", ringIdx, args[0], args[1]);
+      break;
+    }
+    }
+  }
+}
+
+void MasterBoard::onEachSecondTimer()
+{
+  secondElapsed = true;
+}
+void MasterBoard::onStatsPollTimer()
+{
+  statsPollDue = true;
+}
+
+void MasterBoard::mainLoop_statsPoll()
+{
+  if (!statsPollDue)
+    return;
+  // Only when nothing else is going on, otherwise wait for the next loop
+  if (!isIdleAndHasDevices() ||
+      autostartStep != EAutostartStep::AS_None ||
+      reloadStep != EReloadStep::RS_None ||
+      showStep != EShowStep::SW_None ||
+      streamStep != EStreamStep::SS_None ||
+      recoveryStep != ERecoveryStep::RC_None ||
+      scriptFile != NULL)
+    return;
+
+  statsPollDue = false;
+  statsPollDeviceIdx = (statsPollDeviceIdx + 1) % enumeratedAddressesCount;
+  enumeratedAddresses[statsPollDeviceIdx].stats.pollsCount += 1;
+  tryGoToStateIfIdleAndHasDevices(EProtocolState::Stats_Start, statsPollDeviceIdx);
+}
+
+void MasterBoard::printNodes()
+{
+  // One record per line, made of space separated key=value pairs, like the stats command
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    auto &device = enumeratedAddresses[i];
+    auto &stats = device.stats;
+    serial.printf("node ring=%u addr=%u hwId=%08X board=%s valid=%u age=%u overruns=%u mainsHz=%u.%03u stable=%u "
+                  "heap=%u rx=%u drop=%u schedDrop=%u polls=%u timeouts=%u\n",
+                  device.ringIdx,
+                  device.address,
+                  device.hardwareId,
+                  getBoardTypeDescr(device.boardType),
+                  stats.isValid ? 1 : 0,
+                  stats.isValid ? (upTime - stats.lastUpdateTime) / 1000 : 0,
+                  stats.tickOverrunsCount,
+                  stats.mainsFrequencyMilliHz / 1000,
+                  stats.mainsFrequencyMilliHz % 1000,
+                  stats.isMainsStable ? 1 : 0,
+                  stats.freeHeapBytes,
+                  stats.packetsReceivedCount,
+                  stats.packetsDroppedCount,
+                  stats.scheduleOverflowsCount,
+                  stats.pollsCount,
+                  stats.timeoutsCount);
+  }
+}
+
+bool MasterBoard::tryRetryProtocolState(RingContext &ring)
+{
+  if (ring.retriesCount >= MaxRetries)
+    return false;
+
+  // Go back to the step that sends the request, the waiting states can't recover by themselves
+  EProtocolState retryState;
+  switch (ring.protocolState)
+  {
+  case EProtocolState::Enumerate_WaitHello:
+    retryState = EProtocolState::Enumerate_Start;
+    break;
+  case EProtocolState::ReadState_WaitCrc:
+    retryState = EProtocolState::ReadState_Start;
+    break;
+  case EProtocolState::SelectShow_WaitReply:
+    retryState = EProtocolState::SelectShow_Start;
+    break;
+  case EProtocolState::SendStoryboard_SendTimelines:
+    // The device may have missed some entries, start over with its storyboard
+    retryState = EProtocolState::SendStoryboard_Start;
+    break;
+  case EProtocolState::PS_Idle:
+    return false;
+  default:
+    // Still waiting for a free packet to send the request, just wait a bit more
+    retryState = ring.protocolState;
+    break;
+  }
+
+  ring.retriesCount += 1;
+  retriesCount += 1;
+  serial.printf("Timeout on ring %u, retry %u/%u\n", ring.idx, ring.retriesCount, MaxRetries);
+  goToProtocolState(ring, retryState);
+  return true;
+}
+
+void MasterBoard::onSerialRx()
+{
+  while (serial.readable())
+  {
+    serialRxBuffer.put(serial.getc());
+  }
+}
+
+void MasterBoard::mainLoop_serialProtocol()
+{
+  // Take what the interrupt received, the line is completed across mainLoop calls
+  char c;
+  while (serialRxBuffer.tryGet(c))
+  {
+    if (!commandParser.feed(c))
+      continue;
+
+    if (!commandParser.tryParse())
+    {
+      serial.printf("Invalid command format\n\n");
+    }
+    else if (executeCommand(commandParser))
+    {
+      serial.printf("Ok\n");
+    }
+    else
+    {
+      serial.printf("Error\n");
+    }
+    commandParser.reset();
+    // One command per mainLoop, so the other activities are not delayed
+    break;
+  }
+}
+
+bool MasterBoard::executeCommand(CommandParser &cp)
 {
+  bool commandIsOk = true;
+  // The first token is the command name
+  if (cp.isCommand("state"))
+  {
+    serial.printf("Up time: %u sec\n", upTime / 1000);
+    serial.printf("Timeouts: %u, retries: %u\n", timeoutsCount, retriesCount);
+    for (uint32_t i = 0; i < ringsCount; i++)
+    {
+      auto &ring = rings[i];
+      auto &rtt = ring.rtt;
+      serial.printf("Ring %u: %s, addr: %i, devices: %u, free packets: %u\n",
+                    i,
+                    ring.ringNetwork->getIsConnected() ? "connected" : "disconnected",
+                    ring.ringNetwork->getAddress(),
+                    ring.devicesCount,
+                    ring.freePacketsCount);
+      serial.printf("  Rtt: %u us, var: %u us, samples: %u\n",
+                    rtt.getSmoothedRttUs(), rtt.getRttVarianceUs(), rtt.getRttSamplesCount());
+      serial.printf("  Rotation: %u us [%u-%u], hop: %u us\n",
+                    rtt.getRotationUs(),
+                    rtt.getRotationSamplesCount() > 0 ? rtt.getMinRotationUs() : 0,
+                    rtt.getMaxRotationUs(),
+                    rtt.getHopLatencyUs(ring.devicesCount + 1));
+      serial.printf("  Timeout: %i ms\n", rtt.getTimeout());
+    }
+    serial.printf("Enumerated devices: [");
+    // The master first, once for each ring since it has an address on each
+    for (uint32_t i = 0; i < ringsCount; i++)
+    {
+      if (i > 0)
+        serial.puts(", ");
+      serial.printf("ring:%i; addr:%i; hwId:%08X; crc:%08X; time:%i",
+                    i,
+                    rings[i].ringNetwork->getAddress(),
+                    hardwareId,
+                    getOptimizer(storyboard)->getStoryboardCrc(),
+                    storyboardTimeAtLastGetState);
+    }
+    for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+    {
+      auto &device = enumeratedAddresses[i];
+      serial.printf(", ring:%i; addr:%i; hwId:%08X; crc:%08X; time:%i; board:%s; outputs:%i; caps:%02X; fw:%i",
+                    device.ringIdx,
+                    device.address,
+                    device.hardwareId,
+                    device.crcReceived,
+                    device.storyboardTime,
+                    getBoardTypeDescr(device.boardType),
+                    device.outputsCount,
+                    device.capabilities,
+                    device.firmwareVersion);
+    }
+    serial.printf("]\n");
+  }
+  else if (cp.isCommand("nodes"))
+  {
+    printNodes();
+  }
+  else if (cp.isCommand("stats"))
+  {
+    printStats();
+  }
+  else if (cp.isCommand("profile"))
+  {
+    // Format:
+    // profile [reset]
+    commandIsOk = printProfile(cp.tokenIs(1, "reset"));
+  }
+  else if (cp.isCommand("reload"))
+  {
+    commandIsOk = command_Reload();
+  }
+  else if (cp.isCommand("autostart"))
+  {
+    commandIsOk = command_Autostart();
+  }
+  else if (cp.isCommand("run"))
+  {
+    // Format:
+    // run <fileName>
+    commandIsOk = false;
+    if (cp.argsCountIs(1))
+    {
+      commandIsOk = command_Run(cp.getTokenString(1));
+    }
+  }
+  else if (cp.isCommand("stream"))
+  {
+    // Format:
+    // stream [fileName]
+    commandIsOk = command_Stream(cp.argsCountIs(1) ? cp.getTokenString(1) : StreamFileName);
+  }
+  else if (cp.isCommand("export"))
+  {
+    // Format:
+    // export [fileName]
+    commandIsOk = command_Export(cp.argsCountIs(1) ? cp.getTokenString(1) : StreamFileName);
+  }
+  else if (cp.isCommand("clock"))
+  {
+    serial.printf("Clock type: %s\n", clockSourceDescr);
+  }
+  else if (cp.isCommand("toggleLed"))
+  {
+    commandIsOk = tryGoToStateIfIdleAndHasDevices(EProtocolState::ToggleLed_Start, 0);
+  }
+  else if (cp.isCommand("load"))
+  {
+    // Format:
+    // load [fileName]
+    commandIsOk = command_Load(storyboard, cp.argsCountIs(1) ? cp.getTokenString(1) : StoryboardFileName);
+  }
+  else if (cp.isCommand("show"))
+  {
+    // Format:
+    // show <name>
+    commandIsOk = false;
+    if (cp.argsCountIs(1))
+    {
+      commandIsOk = command_Show(cp.getTokenString(1));
+    }
+  }
+  else if (cp.isCommand("catalog"))
+  {
+    // Reads the index again, then lists it. Not while switching, the switch uses the entries
+    commandIsOk = showStep == EShowStep::SW_None && showCatalog.load(ShowCatalogFileName);
+    if (!commandIsOk)
+    {
+      serial.printf("Catalog not available\n");
+    }
+    for (uint32_t i = 0; i < showCatalog.getCount(); i++)
+    {
+      auto &entry = showCatalog.getEntry(i);
+      serial.printf("show name=%s file=%s crc=%08X size=%u current=%u\n",
+                    entry.name, entry.path, entry.crc, entry.size, strcmp(entry.name, currentShowName) == 0 ? 1 : 0);
+    }
+    if (showCatalog.getSkippedLinesCount() > 0)
+    {
+      serial.printf("Skipped %u lines\n", showCatalog.getSkippedLinesCount());
+    }
+    selectedShowIdx = 0;
+    isDisplayDirty = true;
+  }
+  else if (cp.isCommand("upload"))
+  {
+    commandIsOk = command_Upload();
+  }
+  else if (cp.isCommand("check"))
+  {
+    commandIsOk = tryGoToStateIfIdleAndHasDevices(EProtocolState::ReadState_Start);
+    if (commandIsOk)
+    {
+      storyboardTimeAtLastGetState = storyboardTime;
+    }
+  }
+  else if (cp.isCommand("play"))
+  {
+    commandIsOk = command_Play();
+  }
+  else if (cp.isCommand("stop"))
+  {
+    commandIsOk = command_Stop();
+  }
+  else if (cp.isCommand("setOutput"))
+  {
+    // Format:
+    // setOutput <hardwareId: ui32> <outputId: ui8> <value: [0-4095]>
+    commandIsOk = false;
+    if (cp.argsCountIs(3))
+    {
+      uint32_t hardwareId, outputId, value;
+      if (cp.tryParseUInt32(1, hardwareId, 16) &&
+          cp.tryParseUInt32(2, outputId) &&
+          cp.tryParseUInt32(3, value))
+      {
+        auto deviceIdx = findDeviceByHardwareId(hardwareId);
+        if (deviceIdx >= 0)
+        {
+          stateArg_OutputId = outputId;
+          stateArg_Value = value;
+          commandIsOk = tryGoToStateIfIdleAndHasDevices(EProtocolState::SetOutput_Start, deviceIdx);
+        }
+        else
+        {
+          serial.printf("Could not find device\n");
+        }
+      }
+    }
+  }
+  else if (cp.isCommand("openFile"))
+  {
+    // Format:
+    // openFile <fileName>
+    commandIsOk = false;
+    if (cp.argsCountIs(2))
+    {
+      if (openFile != NULL)
+      {
+        serial.printf("A file is already open\n");
+      }
+      else
+      {
+        auto path = cp.getTokenString(1);
+        auto mode = cp.getTokenString(2);
+        openFile = fopen(path, mode);
+        if (openFile == NULL)
+        {
+          serial.printf("Can't open file\n");
+        }
+        else
+        {
+          commandIsOk = true;
+        }
+      }
+    }
+  }
+  else if (cp.isCommand("closeFile"))
+  {
+    commandIsOk = false;
+    if (openFile == NULL)
+    {
+      // Allow closing a file with success when none is open.
+      commandIsOk = true;
+    }
+    else
+    {
+      fclose(openFile);
+      openFile = NULL;
+      commandIsOk = true;
+    }
+  }
+  else if (cp.isCommand("writeFile"))
+  {
+    commandIsOk = false;
+    if (openFile == NULL)
+    {
+      serial.printf("No open file\n");
+    }
+    else
+    {
+      const uint8_t buffSize = 183;
+      uint8_t buff[buffSize];
+      uint32_t buffLength = 0;
+
+      if (!cp.tryParseBase64(1, buff, buffSize, &buffLength))
+      {
+        serial.printf("Base64 decode failed\n");
+      }
+      else
+      {
+        if (fwrite(buff, 1, buffLength, openFile) != buffLength)
+        {
+          serial.printf("Write failed\n");
+        }
+        else
+        {
+          commandIsOk = true;
+        }
+      }
+    }
+  }
+  else if (cp.isCommand("crc32File"))
+  {
+    commandIsOk = false;
+    if (openFile == NULL)
+    {
+      serial.printf("No open file\n");
+    }
+    else
+    {
+      // Save the current position then seek to beginning to crc the whole file
+      auto prevSeekPos = ftell(openFile);
+      fseek(openFile, 0, SEEK_SET);
+
+      uint32_t crc32 = 0;
+      uint8_t fileByte;
+      while (fread(&fileByte, 1, 1, openFile) == 1)
+      {
+        crc32 = Utils::crc32(fileByte, crc32);
+      }
+
+      // Restore previous seek position
+      fseek(openFile, prevSeekPos, SEEK_SET);
+
+      serial.printf("crc32: %08X\n", crc32);
+      commandIsOk = true;
+    }
+  }
+
+
+  return commandIsOk;
+}
+
+void MasterBoard::printStats()
+{
+  // One record per line, made of space separated key=value pairs, so it's easy to parse from a PC
+  serial.printf("ring up=%u free=%u data=%u proto=%u free_s=%u data_s=%u util=%u\n",
+                upTime / 1000,
+                telemetry.getFreePacketsCount(),
+                telemetry.getDataPacketsCount(),
+                telemetry.getProtocolPacketsCount(),
+                telemetry.getFreePacketsPerSecond(),
+                telemetry.getDataPacketsPerSecond(),
+                telemetry.getUtilisation());
+
+  serial.printf("msg");
+  for (uint32_t i = 0; i < RingTelemetry::MsgTypeSlots; i++)
+  {
+    auto count = telemetry.getMsgTypeCount(i);
+    if (count > 0)
+      serial.printf(" %u=%u", i, count);
+  }
+  serial.printf("\n");
+
+  serial.printf("rot");
+  for (uint32_t i = 0; i < RingTelemetry::RotationBuckets; i++)
+  {
+    auto limitUs = telemetry.getRotationBucketLimitUs(i);
+    if (limitUs > 0)
+      serial.printf(" lt%u=%u", limitUs, telemetry.getRotationBucketCount(i));
+    else
+      serial.printf(" inf=%u", telemetry.getRotationBucketCount(i));
+  }
+  serial.printf("\n");
+
+  // The callbacks of all the rings together, the queues one for each ring
+  serial.printf("cb n=%u maxUs=%u maxUs_s=%u\n",
+                telemetry.getCallbacksCount(),
+                telemetry.getMaxCallbackUs(),
+                telemetry.getMaxCallbackUsPerSecond());
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    auto &ring = rings[i];
+    serial.printf("ringq idx=%u free=%u deferred=%u dropped=%u maxUsed=%u rot=%u\n",
+                  i,
+                  ring.freePacketsCount,
+                  ring.deferredQueue.getPostedCount(),
+                  ring.deferredQueue.getDroppedCount(),
+                  ring.deferredQueue.getMaxUsedBytes(),
+                  ring.rtt.getRotationUs());
+  }
+
+  serial.printf("serialrx dropped=%u maxUsed=%u\n",
+                serialRxBuffer.getDroppedCount(),
+                serialRxBuffer.getMaxUsedBytes());
+
+  serial.printf("disp flushes=%u bytes=%u maxChunk=%u\n",
+                textDisplay.getFlushesCount(),
+                textDisplay.getBytesSentCount(),
+                textDisplay.getMaxBytesPerService());
+
+  for (uint32_t i = 0; i < enumeratedAddressesCount && i < RingTelemetry::MaxDevices; i++)
+  {
+    auto dl = telemetry.getDeviceLatency(i);
+    serial.printf("dev ring=%u addr=%u hwId=%08X n=%u last=%u min=%u avg=%u max=%u\n",
+                  enumeratedAddresses[i].ringIdx,
+                  enumeratedAddresses[i].address,
+                  enumeratedAddresses[i].hardwareId,
+                  dl.samplesCount,
+                  dl.lastUs,
+                  dl.samplesCount > 0 ? dl.minUs : 0,
+                  dl.getAvgUs(),
+                  dl.maxUs);
+  }
+}
+
+void MasterBoard::printUploadReport()
+{
+  // Single line JSON, so runs can be collected and compared across versions
+  auto ur = telemetry.getUploadReport();
+  serial.printf("{\"upload\":{\"ok\":%s,\"devices\":%u,\"timelines\":%u,\"entries\":%u,"
+                "\"packets\":%u,\"bytes\":%u,\"rotations\":%u,\"timeUs\":%u",
+                ur.isCompleted ? "true" : "false",
+                ur.devicesCount,
+                ur.timelinesCount,
+                ur.entriesCount,
+                ur.packetsCount,
+                ur.bytesCount,
+                ur.rotationsCount,
+                ur.durationUs);
+#ifdef UseProfiling
+  auto ps = Profiler::getScopeStats(Profile_MasterTick);
+  serial.printf(",\"tickAvgUs\":%u,\"tickMaxUs\":%u",
+                ps.count > 0 ? Profiler::toUs(ps.total / ps.count) : 0,
+                Profiler::toUs(ps.max));
+#endif
+  serial.printf("}}\n");
+}
+
+bool MasterBoard::printProfile(bool reset)
+{
+#ifdef UseProfiling
+  for (int i = 0; i < ProfileScopeCount; i++)
+  {
+    auto scope = (EProfileScope)i;
+    auto ps = Profiler::getScopeStats(scope);
+    serial.printf("prof name=%s n=%u min=%u avg=%u max=%u over=%u budget=%u\n",
+                  Profiler::getScopeName(scope),
+                  ps.count,
+                  ps.count > 0 ? Profiler::toUs(ps.min) : 0,
+                  ps.count > 0 ? Profiler::toUs(ps.total / ps.count) : 0,
+                  Profiler::toUs(ps.max),
+                  ps.overruns,
+                  Profiler::getScopeBudgetUs(scope));
+  }
+  if (reset)
+  {
+    Profiler::reset();
+  }
+  return true;
+#else
+  serial.printf("Profiling disabled, build with -D UseProfiling\n");
+  return false;
+#endif
+}
+
+bool MasterBoard::command_Load(Storyboard *target, const char *path)
+{
+  preemptStatsPoll();
+  if (!isStateBusy() && reloadStep == EReloadStep::RS_None)
+  {
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+      serial.printf("File not available\n");
+      return false;
+    }
+    else
+    {
+      fseek(file, 0, SEEK_END);
+      long fileSize = ftell(file);
+      fseek(file, 0, SEEK_SET);
+      serial.printf("Reading %i bytes\n", fileSize);
+
+      char *buff = new char[fileSize];
+      fread(buff, fileSize, 1, file);
+      fclose(file);
+
+      // The current storyboard is loaded in the other slot and replaced only if the new one is valid,
+      // so a bad file leaves it playable and its crc, entry counts and upload image in place
+      Storyboard *slot = target == storyboard ? getShadowStoryboard() : target;
+      if (uploadImageStoryboard == slot)
+      {
+        uploadImageStoryboard = NULL;
+      }
+
+      serial.printf("Parsing storyboard\n");
+      StoryboardLoader loader(slot, buff);
+      loader.load();
+      delete[] buff;
+
+      auto optimizer = getOptimizer(slot);
+      if (!optimizer->process(slot))
+      {
+        serial.printf("Invalid storyboard, timeline %u: %s\n",
+                      optimizer->getReport().errorTimelineIdx,
+                      StoryboardOptimizer::getErrorDescr(optimizer->getReport().error));
+        return false;
+      }
+      auto report = optimizer->getReport();
+      serial.printf("Optimized entries: %u -> %u, upload bytes: %u -> %u\n",
+                    report.entriesBefore, report.entriesAfter,
+                    report.uploadBytesBefore, report.uploadBytesAfter);
+
+      if (!buildUploadImage(slot))
+      {
+        return false;
+      }
+      serial.printf("Upload image: %u packets, %u bytes for %u devices, multicast saves %u packets\n",
+                    uploadImage.getPacketsCount(), uploadImage.getBytesCount(), enumeratedAddressesCount,
+                    uploadImagePacketsSaved);
+
+      if (target == storyboard)
+      {
+        __disable_irq();
+        uploadStoryboard = slot;
+        switchToUploadStoryboard();
+        __enable_irq();
+      }
+
+      serial.printf("Loaded %i timelines, duration: %i ms, crc: %08X\n",
+                    slot->getTimelinesCount(),
+                    slot->getDuration(),
+                    optimizer->getStoryboardCrc());
+      // See mainLoop_show, it sets it for the catalog shows
+      currentShowName[0] = '\0';
+      return true;
+    }
+  }
+  else
+  {
+    return false;
+  }
+}
+bool MasterBoard::command_Upload()
+{
+  preemptStatsPoll();
+  if (reloadStep != EReloadStep::RS_None)
+  {
+    return false;
+  }
+  if (isStateBusy() || !prepareUpload(storyboard))
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    enumeratedAddresses[i].uploadPending = true;
+  }
+  if (tryGoToStateIfIdleAndHasDevices(EProtocolState::SendStoryboard_Start))
+  {
+    telemetry.beginUpload(us_ticker_read());
+    return true;
+  }
+  return false;
+}
+bool MasterBoard::command_Play()
+{
+  if (tryGoToStateIfIdleAndHasDevices(EProtocolState::Play_Start))
+  {
+    isPlaying = true;
+    return true;
+  }
+  return false;
+}
+bool MasterBoard::command_Stop()
+{
+  if (tryGoToStateIfIdleAndHasDevices(EProtocolState::Stop_Start))
+  {
+    isPlaying = false;
+    if (streamStep != EStreamStep::SS_None)
+    {
+      endStream(true);
+    }
+    return true;
+  }
+  return false;
+}
+
+bool MasterBoard::command_Run(const char *path)
+{
+  if (scriptFile != NULL)
+  {
+    serial.printf("A script is already running\n");
+    return false;
+  }
+
+  scriptFile = fopen(path, "r");
+  if (scriptFile == NULL)
+  {
+    serial.printf("Can't open file\n");
+    return false;
+  }
+
+  scriptParser.reset();
+  scriptLineReady = false;
+  scriptLineNumber = 0;
+  scriptStartTimeUs = us_ticker_read();
+  scriptTimingsCount = 0;
+  scriptRingCommandLineNumber = 0;
+  scriptRingCommandTimingIdx = -1;
+  return true;
+}
+
+bool MasterBoard::command_Autostart()
+{
+  preemptStatsPoll();
+  if (autostartStep != EAutostartStep::AS_None || showStep != EShowStep::SW_None || !isIdleAndHasDevices())
+  {
+    return false;
+  }
+  serial.printf("Autostart\n");
+  autostartStartTimeUs = us_ticker_read();
+  // Left over by an earlier procedure, like an enumeration timeout: mainLoop_autostart must see
+  // only the failures of the procedures it starts
+  lastProcedureFailed = false;
+  autostartStep = EAutostartStep::AS_Load;
+  return true;
+}
+
+void MasterBoard::mainLoop_autostart()
+{
+  // Each step starts a procedure, the next step runs when it's completed
+  if (autostartStep == EAutostartStep::AS_None || isStateBusy())
+    return;
+
+  if (lastProcedureFailed)
+  {
+    endAutostart(false);
+    return;
+  }
+
+  switch (autostartStep)
+  {
+  case EAutostartStep::AS_None:
+    break;
+
+  case EAutostartStep::AS_Load:
+    if (!command_Load(storyboard, StoryboardFileName))
+    {
+      endAutostart(false);
+      return;
+    }
+    autostartStep = EAutostartStep::AS_Check;
+    tryGoToStateIfIdleAndHasDevices(EProtocolState::ReadState_Start);
+    break;
+
+  case EAutostartStep::AS_Check:
+  {
+    // Upload to the devices whose crc differs from the one they reported after the last upload
+    bool hasCache = tryReadUploadCache(getOptimizer(storyboard)->getStoryboardCrc());
+    uint32_t toUploadCount = 0;
+    for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+    {
+      if (enumeratedAddresses[i].uploadPending)
+        toUploadCount += 1;
+    }
+    serial.printf("Devices to upload: %u of %u%s\n",
+                  toUploadCount, enumeratedAddressesCount, hasCache ? "" : " (no cache)");
+
+    if (toUploadCount == 0)
+    {
+      autostartStep = EAutostartStep::AS_Play;
+    }
+    else if (!prepareUpload(storyboard))
+    {
+      endAutostart(false);
+    }
+    else
+    {
+      autostartStep = EAutostartStep::AS_Upload;
+      tryGoToStateIfIdleAndHasDevices(EProtocolState::SendStoryboard_Start);
+      telemetry.beginUpload(us_ticker_read());
+    }
+    break;
+  }
+
+  case EAutostartStep::AS_Upload:
+    // Read back the crc of the new storyboards for the cache
+    autostartStep = EAutostartStep::AS_Verify;
+    tryGoToStateIfIdleAndHasDevices(EProtocolState::ReadState_Start);
+    break;
+
+  case EAutostartStep::AS_Verify:
+    writeUploadCache(getOptimizer(storyboard)->getStoryboardCrc());
+    autostartStep = EAutostartStep::AS_Play;
+    break;
+
+  case EAutostartStep::AS_Play:
+    if (!command_Play())
+    {
+      endAutostart(false);
+      return;
+    }
+    endAutostart(true);
+    break;
+  }
+}
+
+void MasterBoard::endAutostart(bool isOk)
+{
+  autostartStep = EAutostartStep::AS_None;
+  serial.printf("Autostart %s in %u ms\n",
+                isOk ? "completed" : "failed",
+                (us_ticker_read() - autostartStartTimeUs) / 1000);
+}
+
+void MasterBoard::startRecovery()
+{
+  serial.printf("Ring reconnected, recovering\n");
+  recoveryStartTimeUs = us_ticker_read();
+
+  // Whatever was in progress can't have completed with the ring down
+  if (autostartStep != EAutostartStep::AS_None)
+  {
+    endAutostart(false);
+  }
+  if (streamStep != EStreamStep::SS_None)
+  {
+    endStream(false);
+  }
+  if (showStep != EShowStep::SW_None)
+  {
+    endShow(false);
+  }
+  if (reloadStep != EReloadStep::RS_None)
+  {
+    serial.printf("Reload abandoned\n");
+    commitAtLoopEnd = false;
+    reloadStep = EReloadStep::RS_None;
+  }
+  if (telemetry.getIsUploadRunning())
+  {
+    telemetry.endUpload(us_ticker_read(), false);
+  }
+
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    previousDevices[i] = enumeratedAddresses[i];
+  }
+  previousDevicesCount = enumeratedAddressesCount;
+
+  goToStateIdle();
+  lastProcedureFailed = false;
+  recoveryStep = ERecoveryStep::RC_Enumerate;
+  startEnumeration();
+}
+
+void MasterBoard::mainLoop_recovery()
+{
+  // Like the autostart, each step starts a procedure and the next step runs when it's completed
+  if (recoveryStep == ERecoveryStep::RC_None || isStateBusy())
+    return;
+
+  if (lastProcedureFailed)
+  {
+    endRecovery(false);
+    return;
+  }
+
+  switch (recoveryStep)
+  {
+  case ERecoveryStep::RC_None:
+    break;
+
+  case ERecoveryStep::RC_Enumerate:
+  {
+    recoveryNewCount = 0;
+    recoveryUploadCount = 0;
+    for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+    {
+      recoveryExpectedCrcs[i] = 0;
+      bool isFound = false;
+      for (uint32_t j = 0; j < previousDevicesCount && !isFound; j++)
+      {
+        if (previousDevices[j].hardwareId == enumeratedAddresses[i].hardwareId)
+        {
+          isFound = true;
+          recoveryExpectedCrcs[i] = previousDevices[j].crcReceived;
+          enumeratedAddresses[i].stats = previousDevices[j].stats;
+        }
+      }
+      if (!isFound)
+        recoveryNewCount += 1;
+    }
+    recoveryLostCount = previousDevicesCount + recoveryNewCount - enumeratedAddressesCount;
+    serial.printf("Recovery: %u devices, %u new, %u lost\n",
+                  enumeratedAddressesCount, recoveryNewCount, recoveryLostCount);
+
+    recoveryStep = ERecoveryStep::RC_Check;
+    if (!tryGoToStateIfIdleAndHasDevices(EProtocolState::ReadState_Start))
+    {
+      endRecovery(false);
+    }
+    break;
+  }
+
+  case ERecoveryStep::RC_Check:
+    // Nothing to upload if no storyboard was loaded. An expected crc of 0 is unknown (the device
+    // was uploaded and not read back, or streamed to), so the device is uploaded
+    for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+    {
+      auto &device = enumeratedAddresses[i];
+      device.uploadPending = storyboard->getTimelinesCount() > 0 &&
+                             (recoveryExpectedCrcs[i] == 0 || device.crcReceived != recoveryExpectedCrcs[i]);
+      if (device.uploadPending)
+        recoveryUploadCount += 1;
+    }
+    serial.printf("Devices to upload: %u of %u\n", recoveryUploadCount, enumeratedAddressesCount);
+
+    if (recoveryUploadCount == 0)
+    {
+      recoveryStep = ERecoveryStep::RC_Sync;
+    }
+    else if (!prepareUpload(storyboard))
+    {
+      endRecovery(false);
+    }
+    else
+    {
+      recoveryStep = ERecoveryStep::RC_Upload;
+      tryGoToStateIfIdleAndHasDevices(EProtocolState::SendStoryboard_Start);
+      telemetry.beginUpload(us_ticker_read());
+    }
+    break;
+
+  case ERecoveryStep::RC_Upload:
+    // Read back the crcs, they are the reference for the next recovery
+    recoveryStep = ERecoveryStep::RC_Verify;
+    tryGoToStateIfIdleAndHasDevices(EProtocolState::ReadState_Start);
+    break;
+
+  case ERecoveryStep::RC_Verify:
+    recoveryStep = ERecoveryStep::RC_Sync;
+    break;
+
+  case ERecoveryStep::RC_Sync:
+    if (!isPlaying)
+    {
+      endRecovery(true);
+      break;
+    }
+    recoveryStep = ERecoveryStep::RC_Play;
+    tryGoToStateIfIdleAndHasDevices(EProtocolState::Sync_Start);
+    break;
+
+  case ERecoveryStep::RC_Play:
+    endRecovery(command_Play());
+    break;
+  }
+}
+
+void MasterBoard::endRecovery(bool isOk)
+{
+  recoveryStep = ERecoveryStep::RC_None;
+  serial.printf("recovery ok=%u devices=%u new=%u lost=%u uploaded=%u ms=%u\n",
+                isOk ? 1 : 0,
+                enumeratedAddressesCount,
+                recoveryNewCount,
+                recoveryLostCount,
+                recoveryUploadCount,
+                (us_ticker_read() - recoveryStartTimeUs) / 1000);
+}
+
+bool MasterBoard::tryReadUploadCache(uint32_t storyboardCrc)
+{
+  // Without a valid cache every device is uploaded
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    enumeratedAddresses[i].uploadPending = true;
+  }
+
+  FILE *file = fopen(UploadCacheFileName, "r");
+  if (file == NULL)
+  {
+    return false;
+  }
+
+  // Format: the storyboard crc on the first line, then a line with "<hardwareId> <crc>" for each device
+  bool isValid = false;
+  unsigned int cachedStoryboardCrc;
+  if (fscanf(file, "%x", &cachedStoryboardCrc) == 1 && cachedStoryboardCrc == storyboardCrc)
+  {
+    isValid = true;
+    unsigned int hardwareId, crc;
+    while (fscanf(file, "%x %x", &hardwareId, &crc) == 2)
+    {
+      auto deviceIdx = findDeviceByHardwareId(hardwareId);
+      // A crc of 0 is unknown, the device may have anything
+      if (deviceIdx >= 0 && crc != 0 && enumeratedAddresses[deviceIdx].crcReceived == crc)
+      {
+        enumeratedAddresses[deviceIdx].uploadPending = false;
+      }
+    }
+  }
+  fclose(file);
+  return isValid;
+}
+
+void MasterBoard::writeUploadCache(uint32_t storyboardCrc)
+{
+  FILE *file = fopen(UploadCacheFileName, "w");
+  if (file == NULL)
+  {
+    serial.printf("Can't write upload cache\n");
+    return;
+  }
+
+  fprintf(file, "%08X\n", storyboardCrc);
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    fprintf(file, "%08X %08X\n", enumeratedAddresses[i].hardwareId, enumeratedAddresses[i].crcReceived);
+  }
+  fclose(file);
+}
+
+void MasterBoard::invalidateUploads()
+{
+  // The crcs are unknown until read again, and the cache would skip devices that have nothing
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    enumeratedAddresses[i].uploadPending = true;
+    enumeratedAddresses[i].crcReceived = 0;
+  }
+  remove(UploadCacheFileName);
+}
+
+bool MasterBoard::command_Reload()
+{
+  preemptStatsPoll();
+  if (!isPlaying)
+  {
+    serial.printf("Not playing, use load and upload\n");
+    return false;
+  }
+  if (reloadStep != EReloadStep::RS_None || autostartStep != EAutostartStep::AS_None ||
+      showStep != EShowStep::SW_None || !isIdleAndHasDevices())
+  {
+    return false;
+  }
+
+  auto shadow = getShadowStoryboard();
+  if (!command_Load(shadow, StoryboardFileName))
+  {
+    return false;
+  }
+
+  if (!prepareUpload(shadow))
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    enumeratedAddresses[i].uploadPending = true;
+  }
+  tryGoToStateIfIdleAndHasDevices(EProtocolState::SendStoryboard_Start);
+  telemetry.beginUpload(us_ticker_read());
+  reloadStep = EReloadStep::RS_Upload;
+  return true;
+}
+
+bool MasterBoard::command_Stream(const char *path)
+{
+  preemptStatsPoll();
+  if (isPlaying || streamStep != EStreamStep::SS_None || reloadStep != EReloadStep::RS_None ||
+      autostartStep != EAutostartStep::AS_None || showStep != EShowStep::SW_None || !isIdleAndHasDevices())
+  {
+    return false;
+  }
+  if (!streamReader.open(path))
+  {
+    serial.printf("Invalid stream file\n");
+    return false;
+  }
+  serial.printf("Streaming %u entries, duration: %i ms\n", streamReader.getEntriesCount(), streamReader.getDuration());
+
+  streamPacketReady = false;
+  streamStartTimeUs = us_ticker_read();
+  streamPacketsCount = 0;
+  streamEntriesCount = 0;
+  streamLateCount = 0;
+  streamSkippedCount = 0;
+  streamStep = EStreamStep::SS_WaitStart;
+  // StreamStart makes the devices drop their storyboard
+  invalidateUploads();
+  currentShowName[0] = '\0';
+  tryGoToStateIfIdleAndHasDevices(EProtocolState::StreamStart_Start);
+  return true;
+}
+
+void MasterBoard::mainLoop_stream()
+{
+  switch (streamStep)
+  {
+  case EStreamStep::SS_None:
+    break;
+
+  case EStreamStep::SS_WaitStart:
+    if (isStateBusy())
+      break;
+    if (lastProcedureFailed)
+    {
+      endStream(false);
+      break;
+    }
+    __disable_irq();
+    storyboardTime = 0;
+    playLoopsCount = 0;
+    __enable_irq();
+    if (!command_Play())
+    {
+      endStream(false);
+      break;
+    }
+    streamStep = EStreamStep::SS_Running;
+    break;
+
+  case EStreamStep::SS_Running:
+    if (!streamReader.refill())
+    {
+      serial.printf("Stream read error\n");
+      endStream(false);
+      break;
+    }
+    if (!streamPacketReady)
+    {
+      prepareStreamPacket();
+    }
+    break;
+  }
+}
+
+void MasterBoard::endStream(bool isOk)
+{
+  streamReader.close();
+  streamStep = EStreamStep::SS_None;
+  streamPacketReady = false;
+  serial.printf("stream ok=%u entries=%u packets=%u late=%u skipped=%u chunks=%u us=%u\n",
+                isOk ? 1 : 0,
+                streamEntriesCount,
+                streamPacketsCount,
+                streamLateCount,
+                streamSkippedCount,
+                streamReader.getChunksReadCount(),
+                us_ticker_read() - streamStartTimeUs);
+}
+
+bool MasterBoard::command_Export(const char *path)
+{
+  // Writes the loaded storyboard as a stream file: the entries of all the timelines merged by time
+  preemptStatsPoll();
+  if (isStateBusy() || streamReader.isOpen())
+  {
+    return false;
+  }
+  auto optimizer = getOptimizer(storyboard);
+  auto timelinesCount = storyboard->getTimelinesCount();
+  uint32_t entriesCount = 0;
+  for (uint32_t i = 0; i < timelinesCount; i++)
+  {
+    entriesCount += optimizer->getEntriesCount(i);
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    serial.printf("File not available\n");
+    return false;
+  }
+  bool isOk = StreamReader::writeHeader(file, storyboard->getDuration(), entriesCount);
+
+  // The entries of each timeline are sorted at load time, take the earliest of the next ones each time
+  uint8_t nextEntryIdx[StoryboardOptimizer::MaxTimelines];
+  for (uint32_t i = 0; i < timelinesCount; i++)
+  {
+    nextEntryIdx[i] = 0;
+  }
+  for (uint32_t n = 0; n < entriesCount && isOk; n++)
+  {
+    int32_t bestIdx = -1;
+    for (uint32_t i = 0; i < timelinesCount; i++)
+    {
+      if (nextEntryIdx[i] == optimizer->getEntriesCount(i))
+        continue;
+      if (bestIdx < 0 ||
+          storyboard->getTimelineByIdx(i)->getEntry(nextEntryIdx[i])->time <
+              storyboard->getTimelineByIdx(bestIdx)->getEntry(nextEntryIdx[bestIdx])->time)
+      {
+        bestIdx = i;
+      }
+    }
+
+    auto t = storyboard->getTimelineByIdx(bestIdx);
+    auto e = t->getEntry(nextEntryIdx[bestIdx]);
+    StreamReader::Entry entry;
+    entry.time = e->time;
+    entry.value = e->value;
+    entry.duration = e->duration;
+    entry.hardwareId = t->getOutputHardwareId();
+    entry.outputId = t->getOutputId();
+    entry.loop = 0;
+    isOk = StreamReader::writeEntry(file, entry);
+    nextEntryIdx[bestIdx] += 1;
+  }
+  fclose(file);
+
+  serial.printf("Exported %u entries\n", entriesCount);
+  return isOk;
+}
+
+void MasterBoard::mainLoop_reload()
+{
+  switch (reloadStep)
+  {
+  case EReloadStep::RS_None:
+    break;
+
+  case EReloadStep::RS_Upload:
+    if (isStateBusy())
+      break;
+
+    if (lastProcedureFailed)
+    {
+      // Keep playing the current one, the devices drop their shadow storyboard at the next create
+      uploadStoryboard = storyboard;
+      reloadStep = EReloadStep::RS_None;
+      serial.printf("Reload failed\n");
+      break;
+    }
+    // The commit is sent ahead of the loop boundary, see Commit_Start
+    reloadStep = EReloadStep::RS_WaitCommit;
+    commitPending = true;
+    break;
+
+  case EReloadStep::RS_WaitCommit:
+    if (commitAtLoopEnd && !isPlaying)
+    {
+      // Stopped while waiting for the loop boundary, switch right away,
+      // and commit again so the devices don't wait for a wrap either
+      __disable_irq();
+      commitAtLoopEnd = false;
+      switchToUploadStoryboard();
+      __enable_irq();
+      commitPending = true;
+    }
+    if (commitPending)
+    {
+      if (!isStateBusy() && tryGoToStateIfIdleAndHasDevices(EProtocolState::Commit_Start))
+      {
+        commitPending = false;
+      }
+    }
+    else if (!isStateBusy() && !commitAtLoopEnd)
+    {
+      // Sent, and the master switched at the boundary (or right away, if stopped)
+      reloadStep = EReloadStep::RS_None;
+      serial.printf("Reloaded storyboard committed\n");
+    }
+    break;
+  }
+}
+
+void MasterBoard::switchToUploadStoryboard()
+{
+  storyboard = uploadStoryboard;
+  if (storyboardTime >= storyboard->getDuration())
+  {
+    storyboardTime = 0;
+  }
+}
+
+bool MasterBoard::command_Show(const char *name)
+{
+  preemptStatsPoll();
+  if (showStep != EShowStep::SW_None || autostartStep != EAutostartStep::AS_None ||
+      reloadStep != EReloadStep::RS_None || streamStep != EStreamStep::SS_None ||
+      recoveryStep != ERecoveryStep::RC_None || !isIdleAndHasDevices())
+  {
+    return false;
+  }
+  // Read the index each time, it may have been changed from the PC
+  if (!showCatalog.load(ShowCatalogFileName))
+  {
+    serial.printf("Show catalog not available\n");
+    return false;
+  }
+  auto idx = showCatalog.findByName(name);
+  if (idx < 0)
+  {
+    serial.printf("Show not in catalog\n");
+    return false;
+  }
+  if (!showCatalog.checkFile(showCatalog.getEntry(idx)))
+  {
+    serial.printf("Show file missing or with a different size than in the catalog\n");
+    return false;
+  }
+
+  serial.printf("Switching to show %s\n", name);
+  showSwitchIdx = idx;
+  showStartTimeUs = us_ticker_read();
+  showUploadCount = 0;
+  showWasPlaying = isPlaying;
+  // Like the autostart, only the failures of the procedures started by the switch count
+  lastProcedureFailed = false;
+  showStep = EShowStep::SW_Load;
+  if (isPlaying)
+  {
+    // The storyboard slot is replaced, stop before
+    command_Stop();
+  }
+  return true;
 }
 
-void MasterBoard::init(const bitLabCore *core)
+void MasterBoard::mainLoop_show()
 {
-  serial.baud(115200);
-  serial.puts("Hello!\n");
-
-  oled.clearDisplay();
-  oled.printf("Initializing...");
-  oled.display();
-
-  //serial.baud(1200);
-  ringNetwork = (RingNetwork *)core->findModule("RingNetwork");
-  ringNetwork->attachOnPacketReceived(callback(this, &MasterBoard::onPacketReceived));
+  // Like the autostart, each step starts a procedure and the next step runs when it's completed
+  if (showStep == EShowStep::SW_None || isStateBusy())
+    return;
 
-  hardwareId = core->getHardwareId();
-  clockSourceDescr = core->getClockSourceDescr();
+  if (lastProcedureFailed)
+  {
+    endShow(false);
+    return;
+  }
 
-  oled.printf("[ok]\r\n");
-  oled.printf("hwId=%08X\r\n", hardwareId);
-  oled.display();
-}
+  switch (showStep)
+  {
+  case EShowStep::SW_None:
+    break;
 
-void MasterBoard::mainLoop()
-{
-  bool newIsConnected = ringNetwork->getIsConnected();
-  if (lastIsConnected != newIsConnected)
+  case EShowStep::SW_Load:
   {
-    if (!newIsConnected)
+    auto &entry = showCatalog.getEntry(showSwitchIdx);
+    if (!command_Load(storyboard, entry.path))
     {
-      connectionLostCount += 1;
+      endShow(false);
+      return;
     }
-    lastIsConnected = newIsConnected;
-    isDisplayDirty = true;
-  }
+    showCrc = getOptimizer(storyboard)->getStoryboardCrc();
+    if (showCrc != entry.crc)
+    {
+      serial.printf("Show crc %08X, the catalog has %08X\n", showCrc, entry.crc);
+      endShow(false);
+      return;
+    }
+    strcpy(currentShowName, entry.name);
 
-  switch (state)
-  {
-  case EState::WaitAddressAssigned:
-    if (ringNetwork->isAddressAssigned())
+    // The devices without a cache get it uploaded anyway, the others tell if they have it
+    for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
     {
-      serial.printf("Address assigned: %i\n", ringNetwork->getAddress());
-      serial.printf("Starting enumeration...\n");
-      enumeratedAddressesCount = 0;
-      goToState(EState::Enumerating, EProtocolState::Enumerate_Start);
+      enumeratedAddresses[i].uploadPending = !enumeratedAddresses[i].hasShowCache();
     }
+    showStep = EShowStep::SW_Select;
+    tryGoToStateIfIdleAndHasDevices(EProtocolState::SelectShow_Start);
     break;
+  }
 
-  case EState::Enumerating:
-    if (protocolState == EProtocolState::PS_Idle)
+  case EShowStep::SW_Select:
+    for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
     {
-      serial.printf("Enumeration completed, %i found\n", enumeratedAddressesCount);
-      // Enumeration is complete
-      isDisplayDirty = true;
-      state = EState::Idle;
+      if (enumeratedAddresses[i].uploadPending)
+        showUploadCount += 1;
+    }
+    serial.printf("Devices to upload: %u of %u\n", showUploadCount, enumeratedAddressesCount);
+
+    showStep = EShowStep::SW_Upload;
+    if (showUploadCount > 0)
+    {
+      if (!prepareUpload(storyboard))
+      {
+        endShow(false);
+        return;
+      }
+      tryGoToStateIfIdleAndHasDevices(EProtocolState::SendStoryboard_Start);
+      telemetry.beginUpload(us_ticker_read());
     }
     break;
 
-  case EState::Idle:
+  case EShowStep::SW_Upload:
+    // Read back the crcs, also from the devices that switched to a cached storyboard
+    showStep = EShowStep::SW_Verify;
+    tryGoToStateIfIdleAndHasDevices(EProtocolState::ReadState_Start);
     break;
 
-  case EState::BusyWithProtocol:
+  case EShowStep::SW_Verify:
+    showStep = EShowStep::SW_Play;
     break;
-  }
 
-  if (secondElapsed)
-  {
-    secondElapsed = false;
-    // Update the display with live stats once a second (packet count)
-    if (displayState == EDisplayState::Stats)
+  case EShowStep::SW_Play:
+    if (!showWasPlaying)
     {
-      isDisplayDirty = true;
+      endShow(true);
+      break;
     }
+    __disable_irq();
+    storyboardTime = 0;
+    __enable_irq();
+    endShow(command_Play());
+    break;
   }
+}
 
-  mainLoop_checkForWaitStateTimeout();
-
-  mainLoop_serialProtocol();
-
-  mainLoop_keyboard();
-
-  printDisplay();
+void MasterBoard::endShow(bool isOk)
+{
+  showStep = EShowStep::SW_None;
+  isDisplayDirty = true;
+  serial.printf("show name=%s ok=%u devices=%u uploaded=%u ms=%u\n",
+                showCatalog.getEntry(showSwitchIdx).name,
+                isOk ? 1 : 0,
+                enumeratedAddressesCount,
+                showUploadCount,
+                (us_ticker_read() - showStartTimeUs) / 1000);
 }
 
-void MasterBoard::mainLoop_checkForWaitStateTimeout()
+bool MasterBoard::isRingCommand(CommandParser &cp)
 {
-  if (waitStateTimeoutEnabled)
-  {
-    if (waitStateTimeout == 0)
-    {
-      goToStateIdle();
-      serial.puts("Timeout\n");
-    }
-  }
+  // Load is included because it replaces the storyboard that ring commands use
+  return cp.isCommand("toggleLed") ||
+         cp.isCommand("load") ||
+         cp.isCommand("reload") ||
+         cp.isCommand("upload") ||
+         cp.isCommand("check") ||
+         cp.isCommand("play") ||
+         cp.isCommand("stop") ||
+         cp.isCommand("setOutput") ||
+         cp.isCommand("stream") ||
+         cp.isCommand("show");
 }
 
-void MasterBoard::mainLoop_serialProtocol()
+void MasterBoard::mainLoop_script()
 {
-  if (serial.readable())
-  {
-    CommandParser cp;
-    serial.gets(cp.line, cp.lineSize);
+  if (scriptFile == NULL)
+    return;
 
-    if (!cp.tryParse())
+  // A ring command is complete when the protocol is back to idle
+  if (scriptRingCommandLineNumber > 0 && !isStateBusy())
+  {
+    if (scriptRingCommandTimingIdx >= 0)
     {
-      serial.printf("Invalid command format\n\n");
+      auto &timing = scriptTimings[scriptRingCommandTimingIdx];
+      timing.durationUs = us_ticker_read() - timing.startTimeUs;
     }
-    else
+    uint32_t lineNumber = scriptRingCommandLineNumber;
+    scriptRingCommandLineNumber = 0;
+    scriptRingCommandTimingIdx = -1;
+
+    // The procedure was abandoned after its retries, the next lines likely depend on it
+    if (lastProcedureFailed)
     {
-      //serial.printf("cmd: <%s>x%u", cp.getTokenString(0), cp.getTokenLength(0));
-      bool commandIsOk = true;
-      // The first token is the command name
-      if (cp.isCommand("state"))
-      {
-        serial.printf("Up time: %u sec\n", upTime / 1000);
-        serial.printf("Free packets: %u\n", freePacketsCount);
-        serial.printf("Net state: %s\n", ringNetwork->getIsConnected() ? "connected" : "disconnected");
-        serial.printf("Enumerated devices: [");
-        for (uint32_t i = 0; i <= enumeratedAddressesCount; i++)
-        {
-          auto me = (i == 0);
-          if (i > 0)
-            serial.puts(", ");
-          serial.printf("addr:%i; hwId:%08X; crc:%08X; time:%i",
-                        me ? ringNetwork->getAddress() : enumeratedAddresses[i - 1].address,
-                        me ? hardwareId : enumeratedAddresses[i - 1].hardwareId,
-                        me ? storyboard.calcCrc32(0) : enumeratedAddresses[i - 1].crcReceived,
-                        me ? storyboardTimeAtLastGetState : enumeratedAddresses[i - 1].storyboardTime);
-        }
-        serial.printf("]\n");
-      }
-      else if (cp.isCommand("clock"))
-      {
-        serial.printf("Clock type: %s\n", clockSourceDescr);
-      }
-      else if (cp.isCommand("toggleLed"))
-      {
-        commandIsOk = tryGoToStateIfIdleAndHasDevices(EProtocolState::ToggleLed_Start);
-      }
-      else if (cp.isCommand("load"))
-      {
-        commandIsOk = command_Load();
-      }
-      else if (cp.isCommand("upload"))
-      {
-        commandIsOk = command_Upload();
-      }
-      else if (cp.isCommand("check"))
-      {
-        commandIsOk = tryGoToStateIfIdleAndHasDevices(EProtocolState::ReadState_Start);
-        if (commandIsOk)
-        {
-          storyboardTimeAtLastGetState = storyboardTime;
-        }
-      }
-      else if (cp.isCommand("play"))
-      {
-        commandIsOk = command_Play();
-      }
-      else if (cp.isCommand("stop"))
-      {
-        commandIsOk = command_Stop();
-      }
-      else if (cp.isCommand("setOutput"))
-      {
-        // Format:
-        // setOutput <hardwareId: ui32> <outputId: ui8> <value: [0-4095]>
-        commandIsOk = false;
-        if (cp.argsCountIs(3))
-        {
-          uint32_t hardwareId, outputId, value;
-          if (cp.tryParseUInt32(1, hardwareId, 16) &&
-              cp.tryParseUInt32(2, outputId) &&
-              cp.tryParseUInt32(3, value))
-          {
-            auto deviceIdx = findDeviceByHardwareId(hardwareId);
-            if (deviceIdx >= 0)
-            {
-              stateArg_OutputId = outputId;
-              stateArg_Value = value;
-              commandIsOk = tryGoToStateIfIdleAndHasDevices(EProtocolState::SetOutput_Start, deviceIdx);
-            }
-            else
-            {
-              serial.printf("Could not find device\n");
-            }
-          }
-        }
-      }
-      else if (cp.isCommand("openFile"))
-      {
-        // Format:
-        // openFile <fileName>
-        commandIsOk = false;
-        if (cp.argsCountIs(2))
-        {
-          if (openFile != NULL)
-          {
-            serial.printf("A file is already open\n");
-          }
-          else
-          {
-            auto path = cp.getTokenString(1);
-            auto mode = cp.getTokenString(2);
-            openFile = fopen(path, mode);
-            if (openFile == NULL)
-            {
-              serial.printf("Can't open file\n");
-            }
-            else
-            {
-              commandIsOk = true;
-            }
-          }
-        }
-      }
-      else if (cp.isCommand("closeFile"))
-      {
-        commandIsOk = false;
-        if (openFile == NULL)
-        {
-          // Allow closing a file with success when none is open.
-          commandIsOk = true;
-        }
-        else
-        {
-          fclose(openFile);
-          openFile = NULL;
-          commandIsOk = true;
-        }
-      }
-      else if (cp.isCommand("writeFile"))
-      {
-        commandIsOk = false;
-        if (openFile == NULL)
-        {
-          serial.printf("No open file\n");
-        }
-        else
-        {
-          const uint8_t buffSize = 183;
-          uint8_t buff[buffSize];
-          uint32_t buffLength = 0;
+      serial.printf("Script error at line %u, ring procedure failed\n", lineNumber);
+      endScript(false);
+      return;
+    }
+  }
 
-          if (!Utils::tryBase64Decode(cp.getTokenString(1), cp.getTokenLength(1),
-                                      buff, buffSize, &buffLength))
-          {
-            serial.printf("Base64 decode failed\n");
-          }
-          else
-          {
-            if (fwrite(buff, 1, buffLength, openFile) != buffLength)
-            {
-              serial.printf("Write failed\n");
-            }
-            else
-            {
-              commandIsOk = true;
-            }
-          }
-        }
-      }
-      else if (cp.isCommand("crc32File"))
+  if (!scriptLineReady)
+  {
+    // Read the next non empty line
+    while (true)
+    {
+      int c = fgetc(scriptFile);
+      if (c == EOF)
       {
-        commandIsOk = false;
-        if (openFile == NULL)
-        {
-          serial.printf("No open file\n");
-        }
-        else
+        // Parse also the last line, if it has no line terminator
+        if (!scriptParser.feed('\n') ||
+            !scriptParser.tryParse() ||
+            scriptParser.getTokenString(0)[0] == '#')
         {
-          // Save the current position then seek to beginning to crc the whole file
-          auto prevSeekPos = ftell(openFile);
-          fseek(openFile, 0, SEEK_SET);
-
-          uint32_t crc32 = 0;
-          uint8_t fileByte;
-          while (fread(&fileByte, 1, 1, openFile) == 1)
+          scriptParser.reset();
+          if (scriptRingCommandLineNumber == 0)
           {
-            crc32 = Utils::crc32(fileByte, crc32);
+            endScript(true);
           }
-
-          // Restore previous seek position
-          fseek(openFile, prevSeekPos, SEEK_SET);
-
-          serial.printf("crc32: %08X\n", crc32);
-          commandIsOk = true;
+          return;
         }
+        scriptLineNumber += 1;
+        break;
       }
-
-      if (commandIsOk)
-      {
-        serial.printf("Ok\n");
-      }
-      else
+      if (scriptParser.feed(c))
       {
-        serial.printf("Error\n");
+        scriptLineNumber += 1;
+        if (scriptParser.tryParse() && scriptParser.getTokenString(0)[0] != '#')
+          break;
+        // Empty line or comment, skip it
+        scriptParser.reset();
       }
     }
+    scriptLineReady = true;
   }
-}
 
-bool MasterBoard::command_Load()
-{
-  if (!isStateBusy())
+  bool isRing = isRingCommand(scriptParser);
+  if (isRing && (scriptRingCommandLineNumber > 0 || isStateBusy()))
   {
-    FILE *file = fopen("/sd/storyboard.json", "r");
-    if (file == NULL)
-    {
-      serial.printf("File not available\n");
-      return false;
-    }
-    else
-    {
-      fseek(file, 0, SEEK_END);
-      long fileSize = ftell(file);
-      fseek(file, 0, SEEK_SET);
-      serial.printf("Reading %i bytes\n", fileSize);
+    // Wait for the ring to be free
+    return;
+  }
 
-      char *buff = new char[fileSize];
-      fread(buff, fileSize, 1, file);
-      fclose(file);
+  int32_t timingIdx = -1;
+  if (scriptTimingsCount < MaxScriptTimings)
+  {
+    timingIdx = scriptTimingsCount;
+    scriptTimingsCount += 1;
+    auto &timing = scriptTimings[timingIdx];
+    strncpy(timing.name, scriptParser.getTokenString(0), sizeof(timing.name) - 1);
+    timing.name[sizeof(timing.name) - 1] = '\0';
+    timing.lineNumber = scriptLineNumber;
+    timing.startTimeUs = us_ticker_read();
+    timing.durationUs = 0;
+  }
 
-      serial.printf("Parsing storyboard\n");
-      StoryboardLoader loader(&storyboard, buff);
-      loader.load();
+  serial.printf("> %s\n", scriptParser.getTokenString(0));
+  bool isOk = executeCommand(scriptParser);
+  scriptParser.reset();
+  scriptLineReady = false;
 
-      serial.printf("Loaded %i timelines, duration: %i ms\n",
-                    storyboard.getTimelinesCount(),
-                    storyboard.getDuration());
-      return true;
-    }
+  if (!isOk)
+  {
+    serial.printf("Script error at line %u\n", scriptLineNumber);
+    endScript(false);
+    return;
   }
-  else
+
+  if (isRing && isStateBusy())
   {
-    return false;
+    // Completes later, in background
+    scriptRingCommandLineNumber = scriptLineNumber;
+    scriptRingCommandTimingIdx = timingIdx;
   }
-}
-bool MasterBoard::command_Upload()
-{
-  return tryGoToStateIfIdleAndHasDevices(EProtocolState::SendStoryboard_Start);
-}
-bool MasterBoard::command_Play()
-{
-  if (tryGoToStateIfIdleAndHasDevices(EProtocolState::Play_Start))
+  else if (timingIdx >= 0)
   {
-    isPlaying = true;
-    return true;
+    scriptTimings[timingIdx].durationUs = us_ticker_read() - scriptTimings[timingIdx].startTimeUs;
   }
-  return false;
 }
-bool MasterBoard::command_Stop()
+
+void MasterBoard::endScript(bool isOk)
 {
-  if (tryGoToStateIfIdleAndHasDevices(EProtocolState::Stop_Start))
+  fclose(scriptFile);
+  scriptFile = NULL;
+  scriptParser.reset();
+  scriptLineReady = false;
+  scriptRingCommandLineNumber = 0;
+  scriptRingCommandTimingIdx = -1;
+
+  for (uint32_t i = 0; i < scriptTimingsCount; i++)
   {
-    isPlaying = false;
-    return true;
+    serial.printf("script line=%u cmd=%s us=%u\n",
+                  scriptTimings[i].lineNumber,
+                  scriptTimings[i].name,
+                  scriptTimings[i].durationUs);
   }
-  return false;
+  serial.printf("script ok=%u lines=%u us=%u\n",
+                isOk ? 1 : 0,
+                scriptLineNumber,
+                us_ticker_read() - scriptStartTimeUs);
 }
 
 void MasterBoard::mainLoop_keyboard()
 {
   // Check for debounce
-  if (inputDebounceTimeout > 0)
+  if (timers.isActive(inputDebounceTimer))
     return;
 
   EInputKey releasedKey = EInputKey::Key_None;
@@ -410,15 +1914,15 @@ void MasterBoard::mainLoop_keyboard()
   {
     if (inPlay.read())
     {
-      pressedKeyTime = 0;
+      pressedKeyStartTime = timers.getNow();
       pressedKey = EInputKey::Key_A;
-      inputDebounceTimeout = InputDebounceTimeoutValue;
+      timers.start(inputDebounceTimer, InputDebounceTimeoutValue);
     }
     else if (inStop.read())
     {
-      pressedKeyTime = 0;
+      pressedKeyStartTime = timers.getNow();
       pressedKey = EInputKey::Key_B;
-      inputDebounceTimeout = InputDebounceTimeoutValue;
+      timers.start(inputDebounceTimer, InputDebounceTimeoutValue);
     }
   }
   else
@@ -461,13 +1965,13 @@ void MasterBoard::mainLoop_keyboard()
       break;
 
     case EDisplayState::Commands:
-      if (pressedKeyTime > 1000)
+      if (timers.getNow() - pressedKeyStartTime > 1000)
       {
         // Apply current command
         switch (selectedCommand)
         {
         case ECommand::Load:
-          command_Load();
+          command_Load(storyboard, StoryboardFileName);
           break;
         case ECommand::Upload:
           command_Upload();
@@ -478,12 +1982,26 @@ void MasterBoard::mainLoop_keyboard()
         case ECommand::Stop:
           command_Stop();
           break;
+        case ECommand::Show:
+          if (selectedShowIdx < showCatalog.getCount())
+          {
+            command_Show(showCatalog.getEntry(selectedShowIdx).name);
+          }
+          break;
         }
       }
       else
       {
-        // Go to next command
-        selectedCommand = (ECommand)((selectedCommand + 1) % ECommand::CommandsCount);
+        // Go to next command, Show has an entry for each show of the catalog
+        if (selectedCommand == ECommand::Show && selectedShowIdx + 1 < showCatalog.getCount())
+        {
+          selectedShowIdx += 1;
+        }
+        else
+        {
+          selectedCommand = (ECommand)((selectedCommand + 1) % ECommand::CommandsCount);
+          selectedShowIdx = 0;
+        }
         isDisplayDirty = true;
       }
       break;
@@ -502,49 +2020,149 @@ void MasterBoard::printDisplay()
 
   isDisplayDirty = false;
 
-  oled.clearDisplay();
-  oled.setTextCursor(0, 0);
+  textDisplay.clear();
   switch (displayState)
   {
   case EDisplayState::Home:
-    //oled.printf("== Il presepe + fico ==\n");
-    oled.printf("== Pimp my presepe ==\n");
-    oled.printf("Net: %s\n", ringNetwork->getIsConnected() ? "connected" : "disconnected");
-    oled.printf("Devices: %i\n", enumeratedAddressesCount);
-    oled.printf("Play status: %s\n", isPlaying ? "playing" : "stopped");
+    //textDisplay.printf("== Il presepe + fico ==\n");
+    textDisplay.printf("== Pimp my presepe ==\n");
+    textDisplay.printf("Net:");
+    for (uint32_t i = 0; i < ringsCount; i++)
+    {
+      textDisplay.printf(" %s", rings[i].ringNetwork->getIsConnected() ? "ok" : "off");
+    }
+    textDisplay.printf("\n");
+    textDisplay.printf("Devices: %i\n", enumeratedAddressesCount);
+    textDisplay.printf("Play status: %s\n", isPlaying ? "playing" : "stopped");
+    if (showStep != EShowStep::SW_None)
+      textDisplay.printf("Show: switching\n");
+    else if (currentShowName[0] != '\0')
+      textDisplay.printf("Show: %s\n", currentShowName);
     break;
 
   case EDisplayState::DeviceList:
-    oled.printf("== Devices ==\n");
+    textDisplay.printf("== Devices ==\n");
+    for (uint32_t i = 0; i < enumeratedAddressesCount && i < TextDisplay::Rows - 1; i++)
+    {
+      textDisplay.printf("%i:%-2i %08X %s\n",
+                         enumeratedAddresses[i].ringIdx,
+                         enumeratedAddresses[i].address,
+                         enumeratedAddresses[i].hardwareId,
+                         getBoardTypeDescr(enumeratedAddresses[i].boardType));
+    }
     break;
 
   case EDisplayState::Commands:
-    oled.printf("== Comandi ==\n> ");
+    textDisplay.printf("== Comandi ==\n> ");
     switch (selectedCommand)
     {
     case ECommand::Load:
-      oled.printf("Load\n");
+      textDisplay.printf("Load\n");
       break;
     case ECommand::Upload:
-      oled.printf("Upload\n");
+      textDisplay.printf("Upload\n");
       break;
     case ECommand::Play:
-      oled.printf("Play\n");
+      textDisplay.printf("Play\n");
       break;
     case ECommand::Stop:
-      oled.printf("Stop\n");
+      textDisplay.printf("Stop\n");
+      break;
+    case ECommand::Show:
+      if (selectedShowIdx < showCatalog.getCount())
+        textDisplay.printf("Show %s\n", showCatalog.getEntry(selectedShowIdx).name);
+      else
+        textDisplay.printf("Show (no catalog)\n");
       break;
     }
     break;
 
-  case EDisplayState::Stats:
-    oled.printf("== Statistiche ==\n");
-    oled.printf("Uptime: %i s\n", upTime / 1000);
-    oled.printf("Conn. lost: %i\n", connectionLostCount);
-    oled.printf("Packets: %i\n", freePacketsCount);
-    break;
+  case EDisplayState::Stats:
+    textDisplay.printf("== Statistiche ==\n");
+    textDisplay.printf("Uptime: %i s\n", upTime / 1000);
+    textDisplay.printf("Conn. lost: %i\n", connectionLostCount);
+    textDisplay.printf("Packets: %i\n", telemetry.getFreePacketsCount());
+    textDisplay.printf("Pkt/s: %u/%u\n", telemetry.getFreePacketsPerSecond(), telemetry.getDataPacketsPerSecond());
+    textDisplay.printf("Util: %u%%\n", telemetry.getUtilisation());
+    textDisplay.printf("Rot:");
+    for (uint32_t i = 0; i < ringsCount; i++)
+    {
+      textDisplay.printf(" %u", rings[i].rtt.getRotationUs());
+    }
+    textDisplay.printf(" us\n");
+    break;
+  }
+  textDisplay.flush();
+}
+
+const char *MasterBoard::getBoardTypeDescr(uint8_t boardType)
+{
+  switch (boardType)
+  {
+  case EBoardType::Board_Triac:
+    return "triac";
+  case EBoardType::Board_Relay:
+    return "relay";
+  default:
+    return "?";
+  }
+}
+
+void MasterBoard::readDeviceCapabilities(EnumeratedDeviceInfo &device, RingPacket *p, uint32_t offset)
+{
+  // Older firmwares don't send the tail: nothing is assumed, entries are sent in full
+  if (p->header.data_size < offset + 4)
+    return;
+
+  if (device.capabilities != p->data[offset + 2])
+  {
+    // The entries encoding depends on the capabilities
+    uploadImageStoryboard = NULL;
+  }
+  device.boardType = p->data[offset + 0];
+  device.outputsCount = p->data[offset + 1];
+  device.capabilities = p->data[offset + 2];
+  device.firmwareVersion = p->data[offset + 3];
+}
+
+int32_t MasterBoard::findNextDeviceOnRing(RingContext &ring, uint32_t fromIdx)
+{
+  for (uint32_t i = fromIdx; i < enumeratedAddressesCount; i++)
+  {
+    if (enumeratedAddresses[i].ringIdx == ring.idx)
+      return i;
+  }
+  return -1;
+}
+
+int32_t MasterBoard::findNextDeviceToUpload(RingContext &ring, uint32_t fromIdx)
+{
+  for (uint32_t i = fromIdx; i < enumeratedAddressesCount; i++)
+  {
+    if (enumeratedAddresses[i].ringIdx == ring.idx && enumeratedAddresses[i].uploadPending)
+      return i;
+  }
+  return -1;
+}
+
+int32_t MasterBoard::findNextDeviceWithShowCache(RingContext &ring, uint32_t fromIdx)
+{
+  for (uint32_t i = fromIdx; i < enumeratedAddressesCount; i++)
+  {
+    if (enumeratedAddresses[i].ringIdx == ring.idx && enumeratedAddresses[i].hasShowCache())
+      return i;
+  }
+  return -1;
+}
+
+int32_t MasterBoard::findDeviceByAddress(RingContext &ring, uint8_t address)
+{
+  for (uint32_t i = 0; i < enumeratedAddressesCount; i++)
+  {
+    if (enumeratedAddresses[i].ringIdx == ring.idx && enumeratedAddresses[i].address == address)
+      return i;
   }
-  oled.display();
+  return -1;
 }
 
 int32_t MasterBoard::findDeviceByHardwareId(uint32_t hardwareId)
@@ -557,79 +2175,171 @@ int32_t MasterBoard::findDeviceByHardwareId(uint32_t hardwareId)
   return -1;
 }
 
-void MasterBoard::goToState(EState newState, EProtocolState newProtocolState)
+bool MasterBoard::areAllRingsIdle()
+{
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    if (rings[i].protocolState != EProtocolState::PS_Idle)
+      return false;
+  }
+  return true;
+}
+bool MasterBoard::isPollingStats()
 {
-  state = newState;
-  goToProtocolState(newProtocolState);
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    if (isPollingStats(rings[i]))
+      return true;
+  }
+  return false;
 }
-void MasterBoard::goToProtocolState(EProtocolState newProtocolState)
+
+void MasterBoard::startEnumeration()
 {
-  protocolState = newProtocolState;
-  waitStateTimeout = 1000;
-  waitStateTimeoutEnabled = true;
+  enumeratedAddressesCount = 0;
+  state = EState::Enumerating;
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    rings[i].devicesCount = 0;
+    if (rings[i].ringNetwork->isAddressAssigned())
+    {
+      startProtocolState(rings[i], EProtocolState::Enumerate_Start, 0);
+    }
+  }
 }
-void MasterBoard::goToStateIdle()
+void MasterBoard::startProtocolState(RingContext &ring, EProtocolState newProtocolState, uint32_t currDeviceIdx)
 {
-  protocolState = EProtocolState::PS_Idle;
-  waitStateTimeoutEnabled = false;
-  waitStateTimeout = 0;
-  state = EState::Idle;
+  ring.currDeviceIdx = currDeviceIdx;
+  ring.retriesCount = 0;
+  goToProtocolState(ring, newProtocolState);
 }
-void MasterBoard::goToStateIdle2()
+void MasterBoard::goToProtocolState(RingContext &ring, EProtocolState newProtocolState, uint32_t sentDataSize)
 {
-  protocolState = EProtocolState::PS_Idle;
-  waitStateTimeoutEnabled = false;
-  waitStateTimeout = 0;
+  ring.protocolState = newProtocolState;
+  timers.start(ring.waitStateTimer, ring.rtt.getTimeout(sentDataSize), callback(&ring, &RingContext::onWaitStateTimer));
+  ring.waitStateTimedOut = false;
 }
-bool MasterBoard::tryGoToStateIfIdleAndHasDevices(EProtocolState newState, uint32_t currDeviceIdx)
+void MasterBoard::onReplyReceived(RingContext &ring, int32_t deviceIdx)
 {
-  if (isIdleAndHasDevices())
+  uint32_t latencyUs = us_ticker_read() - ring.requestSentTimeUs;
+  ring.rtt.addRttSample(latencyUs);
+  if (deviceIdx >= 0)
   {
-    state_currDeviceIdx = currDeviceIdx;
-    goToState(EState::BusyWithProtocol, newState);
-    return true;
+    telemetry.onDeviceReply(deviceIdx, latencyUs);
   }
-  else
+  // The step succeeded, the next one gets its own retries
+  ring.retriesCount = 0;
+}
+void MasterBoard::goToStateIdle(RingContext &ring)
+{
+  goToStateIdle2(ring);
+  if (areAllRingsIdle())
   {
-    return false;
+    state = EState::Idle;
+  }
+}
+void MasterBoard::goToStateIdle2(RingContext &ring)
+{
+  ring.protocolState = EProtocolState::PS_Idle;
+  timers.stop(ring.waitStateTimer);
+  ring.waitStateTimedOut = false;
+}
+void MasterBoard::goToStateIdle()
+{
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    goToStateIdle2(rings[i]);
+  }
+  state = EState::Idle;
+}
+void MasterBoard::preemptStatsPoll()
+{
+  if (state == EState::BusyWithProtocol && isPollingStats())
+  {
+    // The background poll gives way, the late reply is just ignored
+    goToStateIdle();
   }
 }
 
-void MasterBoard::tick(millisec timeDelta)
+bool MasterBoard::tryGoToStateIfIdleAndHasDevices(EProtocolState newState, int32_t deviceIdx)
 {
-  waitStateTimeout -= timeDelta;
-  if (waitStateTimeout < 0)
-    waitStateTimeout = 0;
+  preemptStatsPoll();
+  if (!isIdleAndHasDevices())
+  {
+    return false;
+  }
 
-  inputDebounceTimeout -= timeDelta;
-  if (inputDebounceTimeout < 0)
-    inputDebounceTimeout = 0;
+  // The rings without devices for this procedure stay idle
+  bool isStarting[MaxRings];
+  bool isAnyStarting = false;
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    auto &ring = rings[i];
+    int32_t firstDeviceIdx;
+    if (deviceIdx >= 0)
+      firstDeviceIdx = enumeratedAddresses[deviceIdx].ringIdx == i ? deviceIdx : -1;
+    else if (newState == EProtocolState::SendStoryboard_Start)
+      firstDeviceIdx = findNextDeviceToUpload(ring, 0);
+    else if (newState == EProtocolState::SelectShow_Start)
+      firstDeviceIdx = findNextDeviceWithShowCache(ring, 0);
+    else
+      firstDeviceIdx = findNextDeviceOnRing(ring, 0);
 
-  if (pressedKey != EInputKey::Key_None)
+    isStarting[i] = firstDeviceIdx >= 0;
+    if (isStarting[i])
+    {
+      ring.currDeviceIdx = firstDeviceIdx;
+      ring.retriesCount = 0;
+      timers.start(ring.waitStateTimer, ring.rtt.getTimeout(), callback(&ring, &RingContext::onWaitStateTimer));
+      ring.waitStateTimedOut = false;
+      isAnyStarting = true;
+    }
+  }
+  if (!isAnyStarting)
   {
-    pressedKeyTime += timeDelta;
+    return false;
   }
 
-  upTime += timeDelta;
-
-  eachSecondTimeout -= timeDelta;
-  if (eachSecondTimeout <= 0)
+  lastProcedureFailed = false;
+  state = EState::BusyWithProtocol;
+  // All the rings leave PS_Idle together: one that completes right away must see the others busy,
+  // or it would put state back to Idle
+  __disable_irq();
+  for (uint32_t i = 0; i < ringsCount; i++)
   {
-    secondElapsed = true;
-    eachSecondTimeout = 1000;
+    if (isStarting[i])
+      rings[i].protocolState = newState;
   }
+  __enable_irq();
+  return true;
+}
+
+void MasterBoard::tick(millisec timeDelta)
+{
+  PROFILE_SCOPE(Profile_MasterTick);
+
+  timers.advance(timeDelta);
+
+  upTime += timeDelta;
 
   if (isPlaying)
   {
     storyboardTime += timeDelta;
-    if (storyboardTime >= storyboard.getDuration())
+    millisec duration = getPlayDuration();
+    if (storyboardTime >= duration)
     {
-      storyboardTime -= storyboard.getDuration();
+      storyboardTime -= duration;
+      playLoopsCount += 1;
+      if (commitAtLoopEnd)
+      {
+        // Loop boundary, switch to the reloaded storyboard
+        commitAtLoopEnd = false;
+        switchToUploadStoryboard();
+      }
     }
   }
 }
 
-// TODO State machine timeout for waiting states
 
 /*
 --- Enumerate procedure ---
@@ -651,10 +2361,14 @@ Purpose: upload the storyboard to the enumerated devices, sending to each device
 2. SendStoryboard_SendTimelines cycles through the timelines for the device hardwareId and
    sends the timeline entries using a SetTimelineEntries packet.
    If all entries do not fit in a SetTimelineEntries packet, multiple packets for the same 
-   timeline are sent.
+   timeline are sent: data[2] is the index of the first entry in the packet, data[3] the count.
+   All these packets are serialized in mainLoop before the upload starts (see UploadImage),
+   the packet callback only copies them.
    When all timelines are sent:
-   If this device was the last device, the upload is ended.
+   If this device was the last device, it goes into SendStoryboard_SendMulticast state.
    Otherwise it goes into SendStoryboard_Start state for the next device.
+3. SendStoryboard_SendMulticast broadcasts the entries of the timelines shared by more devices
+   (see Device capabilities), then the upload is ended.
 
 --- ReadState procedure ---
 Purpose: Retrieve the state of enumerated device, to check the uploaded storyboard crc and time sync.
@@ -662,6 +2376,91 @@ Purpose: Retrieve the state of enumerated device, to check the uploaded storyboa
    goes into ReadState_WaitCrc state
 2. ReadState_WaitCrc waits for a TellState packet from the device
    It checks the crc received then goes into ReadState_Start state for the next device
+
+--- Reload procedure ---
+Purpose: replace the storyboard while the current one keeps playing
+1. The storyboard is uploaded like in the upload procedure, but the first packet for each device
+   is a CreateShadowStoryboard instead of CreateStoryboard: the device builds the new storyboard
+   in a second slot and keeps playing the current one.
+2. Commit_Start broadcasts, ahead of the loop boundary, a CommitStoryboard packet with the master
+   storyboardTime (int32) and a flag (uint8): 1 to switch at the next wrap, 0 to switch right away.
+   Each device aligns its time to the one received and switches to its shadow storyboard at the
+   wrap, or at once; the master switches at the same wrap, the first after the time it sent.
+   The devices are late by the latency of the packet, like after a SyncStoryboardTime, and not
+   by the time it takes to send the commit after the wrap.
+
+--- Stream procedure ---
+Purpose: play a show that doesn't fit in memory, see StreamReader for the stream file
+1. StreamStart_Start broadcasts a StreamStart packet with the loop duration (int32):
+   the devices drop their storyboard and wait for streamed entries. Then the master sends Play.
+2. While playing, when no other procedure is running, the master sends to each device a 
+   StreamEntries packet with its next entries, StreamLeadTime before they are due: 
+   entries count (uint8), loop (uint32), then for each entry outputId (uint8), time, value and
+   duration (int32). The times are within the loop, and the loop is the count of wraps of
+   storyboardTime since the Play, so the entries sent ahead for the next loop are not taken for
+   late ones of the current loop. The devices keep them until storyboardTime reaches them in that
+   loop; the ones of a loop already over are late.
+3. The stream ends with Stop.
+
+--- Recovery after a reconnection ---
+Purpose: bring the ring back to the state before a link was lost, without uploading everything
+1. The ring is enumerated again, and the devices are matched to the previous ones by hardwareId
+2. A ReadState procedure reads the crc of each device; the storyboard is uploaded to the new devices 
+   and to those whose crc changed (rebooted, or an interrupted upload), then the crcs are read again
+3. If the master is playing, Sync_Start broadcasts a SyncStoryboardTime packet with the master
+   storyboardTime (int32), each device sets its time to it, then Play is sent for the devices 
+   that restarted
+
+--- Stats poll ---
+Purpose: collect the health of each device while idle, see the nodes command
+1. Every StatsPollInterval, if no other procedure is running, Stats_Start sends a GetStats packet
+   to the next device and goes into Stats_WaitReply state
+2. Stats_WaitReply waits for a TellStats packet with: tick overruns count, measured mains 
+   frequency in mHz (0 if the board has no mains input), all uint32, mains stable (uint8), 
+   free heap bytes, packets received and packets dropped counts (uint32).
+   Boards with scheduled switches (relay boards) add the count of the ones lost because their
+   queue was full (uint32).
+   A timeout is only counted, and any other procedure can interrupt the poll.
+
+--- Device capabilities ---
+Hello (after the hardwareId) and TellState (after the storyboardTime) can end with 4 more bytes:
+board type (EBoardType), outputs count, capabilities (EBoardCapability) and firmware version.
+The devices that have Cap_SwitchEntries but not Cap_Fade get SetTimelineSwitchEntries instead 
+of SetTimelineEntries: same header, then for each entry the switch time (int32) and the state 
+(uint8, 0 off or 1 on), 5 bytes instead of 12.
+The devices with Cap_ShowCache keep more storyboards, see the Show switch procedure.
+The devices with Cap_Multicast get the timelines they share with other such devices (same entries,
+same outputId and same entries encoding) with a SetTimelineEntriesMulticast (or 
+SetTimelineSwitchEntriesMulticast) broadcast, after all the devices got their CreateStoryboard:
+address bitmap (uint32, bit n set for the device with address n), outputId, first entry index,
+entries count, then the entries like in the unicast packets. A device takes the packet only if
+the bit of its address is set.
+
+--- Show switch ---
+Purpose: switch to another show of the catalog (see ShowCatalog) without uploading it again to the
+         devices that already have it
+1. The master stops, then loads the show and checks its crc against the one in the catalog
+2. SelectShow_Start sends a SelectShow packet with the show crc (uint32) to the next device with
+   Cap_ShowCache, and goes into SelectShow_WaitReply state
+3. SelectShow_WaitReply waits for a TellShow packet: show crc (uint32), then 1 if the device had 
+   a storyboard with that crc and switched to it, 0 otherwise (uint8).
+   A device that doesn't have it keeps the crc: the storyboard of the next CreateStoryboard is 
+   kept under that crc, next to the others it has.
+4. The show is uploaded to the devices that didn't have it and to those without Cap_ShowCache, 
+   the crcs are read back, then Play is sent if the previous show was playing
+
+--- More rings ---
+The master can be in more rings, each on its own UART with its own address and devices (see addRing).
+Every procedure runs on all the rings at the same time, each ring on its own devices only: the 
+procedures above go through the devices of the ring, and the broadcasts are sent on each ring.
+The devices of all the rings are in a single list, each with the index of its ring, and the addresses
+of the multicast bitmap are the ones on the ring of the packet.
+
+--- Timeouts ---
+Every state arms the waitStateTimer of its ring with a delay from the measured ring round trip time (see RttEstimator),
+longer after the send of a large packet, like the upload ones, that takes longer around the ring than the free one.
+When it expires the step is retried, going back to the state that sends the request, 
+up to MaxRetries times in a row before the whole procedure is abandoned.
 */
 
 enum EMsgType
@@ -676,20 +2475,317 @@ enum EMsgType
   Pause = 8,
   Stop = 9,
   SetOutput = 10,
+  CreateShadowStoryboard = 11,
+  CommitStoryboard = 12,
+  SetTimelineSwitchEntries = 13,
+  SetTimelineEntriesMulticast = 14,
+  SetTimelineSwitchEntriesMulticast = 15,
+  StreamStart = 16,
+  StreamEntries = 17,
+  GetStats = 18,
+  TellStats = 19,
+  SelectShow = 20,
+  TellShow = 21,
   DebugPrint = 255
 };
 
-void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
+void MasterBoard::prepareStreamPacket()
+{
+  if (streamReader.getAvailable() == 0)
+    return;
+
+  int64_t duration = streamReader.getDuration();
+  __disable_irq();
+  int64_t now = playLoopsCount * duration + storyboardTime;
+  __enable_irq();
+
+  auto &first = streamReader.peek();
+  if (first.loop * duration + first.time - now > StreamLeadTime)
+    return;
+
+  auto deviceIdx = findDeviceByHardwareId(first.hardwareId);
+  if (deviceIdx < 0)
+  {
+    streamSkippedCount += 1;
+    streamReader.pop();
+    return;
+  }
+
+  // The next entries of the same device and loop that are due within the lead time, in a single packet
+  uint32_t hardwareId = first.hardwareId;
+  uint32_t loop = first.loop;
+  uint32_t count = 0;
+  while (count < StreamEntriesPerPacket && streamReader.getAvailable() > 0)
+  {
+    auto &entry = streamReader.peek();
+    int64_t entryTime = entry.loop * duration + entry.time;
+    if (entry.hardwareId != hardwareId || entry.loop != loop || entryTime - now > StreamLeadTime)
+      break;
+    if (entryTime < now)
+      streamLateCount += 1;
+
+    uint8_t *bytes = &streamPacket[StreamPacketHeaderSize + count * 13];
+    bytes[0] = entry.outputId;
+    int32_t values[3] = {entry.time, entry.value, entry.duration};
+    for (uint32_t i = 0; i < 3; i++)
+    {
+      bytes[1 + i * 4 + 0] = (uint8_t)values[i];
+      bytes[1 + i * 4 + 1] = (uint8_t)(values[i] >> 8);
+      bytes[1 + i * 4 + 2] = (uint8_t)(values[i] >> 16);
+      bytes[1 + i * 4 + 3] = (uint8_t)(values[i] >> 24);
+    }
+    count += 1;
+    streamReader.pop();
+  }
+
+  streamPacket[0] = EMsgType::StreamEntries;
+  streamPacket[1] = count;
+  streamPacket[2] = (uint8_t)loop;
+  streamPacket[3] = (uint8_t)(loop >> 8);
+  streamPacket[4] = (uint8_t)(loop >> 16);
+  streamPacket[5] = (uint8_t)(loop >> 24);
+  streamPacketSize = StreamPacketHeaderSize + count * 13;
+  streamPacketRingIdx = enumeratedAddresses[deviceIdx].ringIdx;
+  streamPacketAddress = enumeratedAddresses[deviceIdx].address;
+  streamPacketsCount += 1;
+  streamEntriesCount += count;
+  // Last, the packet callback can send it from now on
+  streamPacketReady = true;
+}
+
+uint32_t MasterBoard::writeEntries(RingPacket &packet, uint32_t offset, Timeline *t,
+                                   uint32_t firstEntryIdx, uint32_t count, bool usesSwitchEntries)
+{
+  for (uint32_t j = 0; j < count; j++)
+  {
+    auto entry = t->getEntry(firstEntryIdx + j);
+    if (usesSwitchEntries)
+    {
+      // On/off outputs: each entry is sent as the time it switches and the new state, 5 bytes
+      // instead of 12, without the fade data. An output is on for any value > 0, so a fade to 0
+      // switches off when it ends.
+      bool isOn = entry->value > 0;
+      packet.setDataInt32(offset + 0, isOn ? entry->time : entry->time + entry->duration);
+      packet.data[offset + 4] = isOn;
+      offset += 5;
+    }
+    else
+    {
+      packet.setDataInt32(offset + 0, entry->time);
+      packet.setDataInt32(offset + 4, entry->value);
+      packet.setDataInt32(offset + 8, entry->duration);
+      offset += 12;
+    }
+  }
+  return offset;
+}
+
+bool MasterBoard::buildUploadImage(Storyboard *sb)
+{
+  uploadImage.clear();
+  uploadImageStoryboard = NULL;
+  uploadImagePacketsSaved = 0;
+
+  auto optimizer = getOptimizer(sb);
+  auto timelinesCount = sb->getTimelinesCount();
+
+  // Find the timelines sent with multicast: same entries and outputId on more devices of the same ring that accept it.
+  // multicastLeader is the index of the first timeline of the group, -1 for the ones sent to a single device
+  int16_t multicastLeader[StoryboardOptimizer::MaxTimelines];
+  int8_t timelineDevice[StoryboardOptimizer::MaxTimelines];
+  for (uint32_t i = 0; i < timelinesCount; i++)
+  {
+    multicastLeader[i] = -1;
+    auto deviceIdx = findDeviceByHardwareId(sb->getTimelineByIdx(i)->getOutputHardwareId());
+    timelineDevice[i] = deviceIdx >= 0 && enumeratedAddresses[deviceIdx].acceptsMulticast() ? deviceIdx : -1;
+  }
+  for (uint32_t i = 0; i < timelinesCount; i++)
+  {
+    if (timelineDevice[i] < 0 || multicastLeader[i] >= 0)
+      continue;
+    auto ti = sb->getTimelineByIdx(i);
+    auto &di = enumeratedAddresses[timelineDevice[i]];
+    for (uint32_t j = i + 1; j < timelinesCount; j++)
+    {
+      if (timelineDevice[j] < 0 || multicastLeader[j] >= 0 || timelineDevice[j] == timelineDevice[i])
+        continue;
+      auto tj = sb->getTimelineByIdx(j);
+      auto &dj = enumeratedAddresses[timelineDevice[j]];
+      if (optimizer->getTimelineCrc(i) == optimizer->getTimelineCrc(j) &&
+          optimizer->getEntriesCount(i) == optimizer->getEntriesCount(j) &&
+          ti->getOutputId() == tj->getOutputId() &&
+          di.ringIdx == dj.ringIdx &&
+          di.usesSwitchEntries() == dj.usesSwitchEntries())
+      {
+        multicastLeader[i] = i;
+        multicastLeader[j] = i;
+      }
+    }
+  }
+
+  RingPacket packet;
+  for (uint32_t deviceIdx = 0; deviceIdx < enumeratedAddressesCount; deviceIdx++)
+  {
+    auto &device = enumeratedAddresses[deviceIdx];
+    uploadImage.beginDevice(deviceIdx);
+
+    // CreateStoryboard, data[0] is set when sending, during a reload it is CreateShadowStoryboard.
+    // It lists the multicast timelines too, the device needs them to build its storyboard.
+    packet.data[0] = EMsgType::CreateStoryboard;
+    packet.setDataInt32(2, sb->getDuration());
+    uint32_t deviceTimelinesCount = 0;
+    for (uint8_t i = 0; i < timelinesCount; i++)
+    {
+      auto t = sb->getTimelineByIdx(i);
+      if (t->getOutputHardwareId() == device.hardwareId)
+      {
+        auto offset = 6 + deviceTimelinesCount * 2;
+        packet.data[offset + 0] = t->getOutputId();
+        packet.data[offset + 1] = optimizer->getEntriesCount(i);
+        deviceTimelinesCount += 1;
+
+        // Never send more than 32 timelines, they won't fit.
+        // The optimizer refuses at load time the storyboards with more timelines for a device
+        if (deviceTimelinesCount == StoryboardOptimizer::MaxTimelinesPerDevice)
+        {
+          break;
+        }
+      }
+    }
+    packet.data[1] = deviceTimelinesCount;
+    uploadImage.addPacket(packet.data, 6 + deviceTimelinesCount * 2);
+
+    // Then the entries of the same timelines, in chunks that fit a packet
+    bool usesSwitchEntries = device.usesSwitchEntries();
+    uint32_t entriesPerPacket = usesSwitchEntries ? StoryboardOptimizer::SwitchEntriesPerPacket
+                                                  : StoryboardOptimizer::EntriesPerPacket;
+    uint32_t timelinesSent = 0;
+    for (uint8_t i = 0; i < timelinesCount && timelinesSent < deviceTimelinesCount; i++)
+    {
+      auto t = sb->getTimelineByIdx(i);
+      if (t->getOutputHardwareId() != device.hardwareId)
+        continue;
+      timelinesSent += 1;
+      if (multicastLeader[i] >= 0)
+        continue;
+
+      uint32_t entriesCount = optimizer->getEntriesCount(i);
+      uint32_t firstEntryIdx = 0;
+      do
+      {
+        uint32_t entryCountToSend = Utils::min(entriesPerPacket, entriesCount - firstEntryIdx);
+        packet.data[0] = usesSwitchEntries ? EMsgType::SetTimelineSwitchEntries : EMsgType::SetTimelineEntries;
+        packet.data[1] = t->getOutputId();
+        packet.data[2] = firstEntryIdx;
+        packet.data[3] = entryCountToSend;
+        auto size = writeEntries(packet, 4, t, firstEntryIdx, entryCountToSend, usesSwitchEntries);
+        uploadImage.addPacket(packet.data, size);
+        firstEntryIdx += entryCountToSend;
+      } while (firstEntryIdx < entriesCount);
+    }
+
+    uploadImage.endDevice();
+  }
+
+  // Multicast sections, one for each ring, sent after all the devices of the ring got their CreateStoryboard
+  for (uint32_t ringIdx = 0; ringIdx < ringsCount; ringIdx++)
+  {
+    uploadImage.beginDevice(UploadImage::getMulticastIdx(ringIdx));
+    for (uint32_t i = 0; i < timelinesCount; i++)
+    {
+      if (multicastLeader[i] != (int16_t)i || enumeratedAddresses[timelineDevice[i]].ringIdx != ringIdx)
+        continue;
+
+      uint32_t addressMask = 0;
+      uint32_t membersCount = 0;
+      for (uint32_t j = i; j < timelinesCount; j++)
+      {
+        if (multicastLeader[j] == (int16_t)i)
+        {
+          addressMask |= 1u << enumeratedAddresses[timelineDevice[j]].address;
+          membersCount += 1;
+        }
+      }
+
+      auto t = sb->getTimelineByIdx(i);
+      bool usesSwitchEntries = enumeratedAddresses[timelineDevice[i]].usesSwitchEntries();
+      uint32_t entriesPerPacket = usesSwitchEntries ? StoryboardOptimizer::SwitchEntriesPerPacket
+                                                    : StoryboardOptimizer::EntriesPerPacket;
+      uint32_t entriesCount = optimizer->getEntriesCount(i);
+      uint32_t firstEntryIdx = 0;
+      do
+      {
+        uint32_t entryCountToSend = Utils::min(entriesPerPacket, entriesCount - firstEntryIdx);
+        packet.data[0] = usesSwitchEntries ? EMsgType::SetTimelineSwitchEntriesMulticast : EMsgType::SetTimelineEntriesMulticast;
+        packet.setDataUInt32(1, addressMask);
+        packet.data[5] = t->getOutputId();
+        packet.data[6] = firstEntryIdx;
+        packet.data[7] = entryCountToSend;
+        auto size = writeEntries(packet, 8, t, firstEntryIdx, entryCountToSend, usesSwitchEntries);
+        uploadImage.addPacket(packet.data, size);
+        uploadImagePacketsSaved += membersCount - 1;
+        firstEntryIdx += entryCountToSend;
+      } while (firstEntryIdx < entriesCount);
+    }
+    uploadImage.endDevice();
+  }
+
+  if (uploadImage.isOverflow())
+  {
+    serial.printf("Storyboard too big to upload, max %u bytes\n", UploadImage::MaxBytes);
+    return false;
+  }
+
+  uploadImageStoryboard = sb;
+  return true;
+}
+
+bool MasterBoard::prepareUpload(Storyboard *sb)
+{
+  if (uploadImageStoryboard != sb && !buildUploadImage(sb))
+  {
+    return false;
+  }
+  uploadStoryboard = sb;
+  for (uint32_t i = 0; i < ringsCount; i++)
+  {
+    rings[i].uploadedAddressMask = 0;
+  }
+  return true;
+}
+
+void MasterBoard::onPacketReceived(RingContext &ring, RingPacket *p, PTxAction *pTxAction)
+{
+  PROFILE_SCOPE(Profile_PacketReceived);
+
+  uint32_t startUs = us_ticker_read();
+  processPacket(ring, p, pTxAction);
+  telemetry.onCallbackDuration(us_ticker_read() - startUs);
+}
+
+void MasterBoard::processPacket(RingContext &ring, RingPacket *p, PTxAction *pTxAction)
 {
   *pTxAction = PTxAction::SendFreePacket;
 
+  // Only one packet at a time travels the ring, so the time between two arrivals is a full rotation
+  uint32_t nowUs = us_ticker_read();
+  if (ring.lastPacketTimeValid)
+  {
+    ring.rtt.addRotationSample(nowUs - ring.lastPacketTimeUs);
+    telemetry.onRotation(nowUs - ring.lastPacketTimeUs);
+  }
+  ring.lastPacketTimeUs = nowUs;
+  ring.lastPacketTimeValid = true;
+
   auto isFree = p->isFreePacket();
   if (isFree)
   {
-    freePacketsCount += 1;
+    ring.freePacketsCount += 1;
+    telemetry.onFreePacket();
   }
   else
   {
+    telemetry.onDataPacket(p->isProtocolPacket(), p->header.data_size > 0 ? p->data[0] : 0);
     /*
     serial.printf("pkt> #%i %c src:%i dst:%i ttl:%i\n",
                   p->header.data_size,
@@ -700,19 +2796,33 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
     */
   }
 
-  if (p->isDataPacket(ringNetwork->getAddress(), 0, EMsgType::DebugPrint))
+  if (p->isDataPacket(ring.ringNetwork->getAddress(), 0, EMsgType::DebugPrint))
   {
-    char *buff = (char *)&p->data[1];
-    buff[p->header.data_size - 2] = '\0';
-    serial.printf(buff);
+    // The text ends with its terminator, printing it would hold the packet for milliseconds
+    if (p->header.data_size >= 2)
+    {
+      ring.deferredQueue.post(EDeferredWork::Deferred_DebugPrint, &p->data[1], p->header.data_size - 2);
+    }
     return;
   }
 
   // 1.Send a WhoAreYou packet with ttl from 1 to 11 and wait for the response Hello packet
   // 1. Send
-  switch (protocolState)
+  switch (ring.protocolState)
   {
   case EProtocolState::PS_Idle:
+    // The ring is free for the streamed entries
+    if (isFree && streamPacketReady && streamPacketRingIdx == ring.idx)
+    {
+      p->header.data_size = streamPacketSize;
+      p->header.control = 1;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = streamPacketAddress;
+      p->header.ttl = RingNetworkProtocol::ttl_max;
+      memcpy(p->data, streamPacket, streamPacketSize);
+      *pTxAction = PTxAction::Send;
+      streamPacketReady = false;
+    }
     break;
 
   case EProtocolState::Enumerate_Start:
@@ -721,42 +2831,67 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
       led = !led;
       p->header.data_size = 1;
       p->header.control = 0;
-      p->header.src_address = ringNetwork->getAddress();
+      p->header.src_address = ring.ringNetwork->getAddress();
       p->header.dst_address = 0;
-      p->header.ttl = enumeratedAddressesCount + 1;
+      p->header.ttl = ring.devicesCount + 1;
       p->data[0] = RingNetworkProtocol::protocol_msgid_whoareyou;
       *pTxAction = PTxAction::Send;
-      goToProtocolState(EProtocolState::Enumerate_WaitHello);
+      ring.markRequestSent();
+      goToProtocolState(ring, EProtocolState::Enumerate_WaitHello, p->header.data_size);
       return;
     }
     break;
   case EProtocolState::Enumerate_WaitHello:
     if (p->isProtocolPacket() &&
-        p->isForDstAddress(ringNetwork->getAddress()) &&
+        p->isForDstAddress(ring.ringNetwork->getAddress()) &&
         p->header.data_size >= (1 + 4) &&
         p->data[0] == RingNetworkProtocol::protocol_msgid_hello)
     {
       // If we asked ourself who we are, the loop is completed
       led = !led;
       uint8_t src_address = p->header.src_address;
-      bool isMyself = (src_address == ringNetwork->getAddress());
+      bool isMyself = (src_address == ring.ringNetwork->getAddress());
       if (isMyself)
       {
-        goToStateIdle2();
+        onReplyReceived(ring, -1);
+        goToStateIdle2(ring);
+      }
+      else if (findDeviceByAddress(ring, src_address) >= 0)
+      {
+        // The late hello of a retried WhoAreYou, the device is already in the table
       }
       else
       {
-        enumeratedAddresses[enumeratedAddressesCount].address = src_address;
-        enumeratedAddresses[enumeratedAddressesCount].hardwareId = p->getDataUInt32(1);
-        enumeratedAddresses[enumeratedAddressesCount].crcReceived = 0;
+        // The other rings may be enumerating too, each device takes the next slot. It's filled
+        // before the count includes it, so mainLoop never reads a device half written
+        __disable_irq();
+        uint32_t deviceIdx = enumeratedAddressesCount;
+        auto &device = enumeratedAddresses[deviceIdx];
+        device.ringIdx = ring.idx;
+        device.address = src_address;
+        device.hardwareId = p->getDataUInt32(1);
+        device.crcReceived = 0;
+        device.uploadPending = false;
+        device.boardType = EBoardType::Board_Unknown;
+        device.outputsCount = 0;
+        device.capabilities = Cap_Fade;
+        device.firmwareVersion = 0;
+        device.stats.reset();
+        readDeviceCapabilities(device, p, 1 + 4);
         enumeratedAddressesCount += 1;
-        if (enumeratedAddressesCount == 10)
+        __enable_irq();
+        onReplyReceived(ring, deviceIdx);
+
+        ring.deferredQueue.post(EDeferredWork::Deferred_DeviceFound, src_address, device.hardwareId);
+        ring.devicesCount += 1;
+        uploadImageStoryboard = NULL;
+        if (ring.devicesCount == MaxDevicesPerRing)
         {
-          goToStateIdle2();
+          goToStateIdle2(ring);
         }
         else
         {
-          goToProtocolState(EProtocolState::Enumerate_Start);
+          goToProtocolState(ring, EProtocolState::Enumerate_Start);
         }
       }
       return;
@@ -769,13 +2904,13 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
       led = ledState;
       p->header.data_size = 2;
       p->header.control = 1;
-      p->header.src_address = ringNetwork->getAddress();
-      p->header.dst_address = enumeratedAddresses[0].address;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = enumeratedAddresses[ring.currDeviceIdx].address;
       p->header.ttl = RingNetworkProtocol::ttl_max;
       p->data[0] = EMsgType::SetLed;
       p->data[1] = ledState;
       *pTxAction = PTxAction::Send;
-      goToStateIdle();
+      goToStateIdle(ring);
       return;
     }
     break;
@@ -784,105 +2919,101 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
     if (isFree)
     {
       p->header.control = 1;
-      p->header.src_address = ringNetwork->getAddress();
-      p->header.dst_address = enumeratedAddresses[state_currDeviceIdx].address;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = enumeratedAddresses[ring.currDeviceIdx].address;
       p->header.ttl = RingNetworkProtocol::ttl_max;
-      p->data[0] = EMsgType::CreateStoryboard;
-      p->data[1] = 0; // timelines count, will be set later, we don't know yet
-      p->setDataInt32(2, storyboard.getDuration());
-
-      uint32_t timelinesCount = 0;
-      for (uint8_t i = 0; i < storyboard.getTimelinesCount(); i++)
-      {
-        auto t = storyboard.getTimelineByIdx(i);
-        if (t->getOutputHardwareId() == enumeratedAddresses[state_currDeviceIdx].hardwareId)
-        {
-          auto offset = 6 + timelinesCount * 2;
-          p->data[offset + 0] = t->getOutputId();
-          p->data[offset + 1] = t->getEntriesCount();
-          timelinesCount += 1;
-
-          // Never send more than 32 timelines, they won't fit.
-          // TODO Check storyboard validity: can't have more than 32 timelines for device
-          if (timelinesCount == 32)
-          {
-            break;
-          }
-        }
-      }
-
-      // serial.printf("Sending %i timelines\n", timelinesCount);
-
-      // Now we know
-      p->data[1] = timelinesCount;
-      p->header.data_size = 6 + timelinesCount * 2;
+      // The first packet of the device is the CreateStoryboard one
+      auto offset = uploadImage.getDeviceBegin(ring.currDeviceIdx);
+      auto size = uploadImage.getPacketSize(offset);
+      memcpy(p->data, uploadImage.getPacketData(offset), size);
+      p->header.data_size = size;
+      // During a reload the slaves store it in their shadow slot, until the commit
+      p->data[0] = uploadStoryboard != storyboard ? EMsgType::CreateShadowStoryboard : EMsgType::CreateStoryboard;
 
       *pTxAction = PTxAction::Send;
-      state_nextTimelineIdxMaybeToSend = 0;
-      goToProtocolState(EProtocolState::SendStoryboard_SendTimelines);
+      telemetry.onUploadPacket(p->header.data_size, 0);
+      ring.uploadPacketOffset = uploadImage.getNextPacketOffset(offset);
+      goToProtocolState(ring, EProtocolState::SendStoryboard_SendTimelines, p->header.data_size);
     }
     break;
 
   case EProtocolState::SendStoryboard_SendTimelines:
     if (isFree)
     {
-      // search for the next timeline to send
-      Timeline *t;
-      uint8_t idxTimelineToSend;
-      bool found = false;
-      for (uint8_t i = state_nextTimelineIdxMaybeToSend; i < storyboard.getTimelinesCount(); i++)
-      {
-        t = storyboard.getTimelineByIdx(i);
-        if (t->getOutputHardwareId() == enumeratedAddresses[state_currDeviceIdx].hardwareId)
-        {
-          found = true;
-          idxTimelineToSend = i;
-          break;
-        }
-      }
-
-      if (!found)
+      if (ring.uploadPacketOffset == uploadImage.getDeviceEnd(ring.currDeviceIdx))
       {
-        if (state_currDeviceIdx == enumeratedAddressesCount - 1)
+        // Its timelines count is in the CreateStoryboard packet
+        telemetry.onUploadDeviceCompleted(uploadImage.getPacketData(uploadImage.getDeviceBegin(ring.currDeviceIdx))[1]);
+        enumeratedAddresses[ring.currDeviceIdx].uploadPending = false;
+        // Unknown until read back, the one read before the upload is of the old storyboard
+        enumeratedAddresses[ring.currDeviceIdx].crcReceived = 0;
+        ring.uploadedAddressMask |= 1u << enumeratedAddresses[ring.currDeviceIdx].address;
+        auto nextDeviceIdx = findNextDeviceToUpload(ring, ring.currDeviceIdx + 1);
+        if (nextDeviceIdx < 0)
         {
-          // No more devices, done
-          goToStateIdle();
+          // No more devices, then the timelines shared by more of them
+          ring.uploadPacketOffset = uploadImage.getDeviceBegin(UploadImage::getMulticastIdx(ring.idx));
+          goToProtocolState(ring, EProtocolState::SendStoryboard_SendMulticast);
         }
         else
         {
-          state_currDeviceIdx += 1;
-          goToProtocolState(EProtocolState::SendStoryboard_Start);
+          ring.currDeviceIdx = nextDeviceIdx;
+          ring.retriesCount = 0;
+          goToProtocolState(ring, EProtocolState::SendStoryboard_Start);
         }
       }
       else
       {
         p->header.control = 1;
-        p->header.src_address = ringNetwork->getAddress();
-        p->header.dst_address = enumeratedAddresses[state_currDeviceIdx].address;
+        p->header.src_address = ring.ringNetwork->getAddress();
+        p->header.dst_address = enumeratedAddresses[ring.currDeviceIdx].address;
         p->header.ttl = RingNetworkProtocol::ttl_max;
-        p->data[0] = EMsgType::SetTimelineEntries;
-        p->data[1] = t->getOutputId();
-        p->data[2] = 0;
-        // For now send only first 20 entries, don't bother with cycles
-        auto entryCountToSend = Utils::min(20, t->getEntriesCount());
-        p->data[3] = entryCountToSend;
+        auto size = uploadImage.getPacketSize(ring.uploadPacketOffset);
+        memcpy(p->data, uploadImage.getPacketData(ring.uploadPacketOffset), size);
+        p->header.data_size = size;
+
+        *pTxAction = PTxAction::Send;
+        telemetry.onUploadPacket(p->header.data_size, p->data[3]);
 
-        // serial.printf("Sending %i entries\n", entryCountToSend);
+        // Stay in EProtocolState::SendStoryboard_SendTimelines state, re-arming the timeout
+        ring.uploadPacketOffset = uploadImage.getNextPacketOffset(ring.uploadPacketOffset);
+        goToProtocolState(ring, EProtocolState::SendStoryboard_SendTimelines, p->header.data_size);
+      }
+    }
+    break;
 
-        for (int i = 0; i < entryCountToSend; i++)
+  case EProtocolState::SendStoryboard_SendMulticast:
+    if (isFree)
+    {
+      if (ring.uploadPacketOffset == uploadImage.getDeviceEnd(UploadImage::getMulticastIdx(ring.idx)))
+      {
+        // Done, the upload is completed when the other rings are done too
+        goToStateIdle(ring);
+        if (state == EState::Idle)
         {
-          auto offset = 4 + i * 12;
-          auto entry = t->getEntry(i);
-          p->setDataInt32(offset + 0, entry->time);
-          p->setDataInt32(offset + 4, entry->value);
-          p->setDataInt32(offset + 8, entry->duration);
+          telemetry.endUpload(us_ticker_read(), true);
         }
-        p->header.data_size = 4 + entryCountToSend * 12;
-
-        *pTxAction = PTxAction::Send;
-
-        // Stay in EProtocolState::SendStoryboard_SendTimelines state
-        state_nextTimelineIdxMaybeToSend = idxTimelineToSend + 1;
+      }
+      else
+      {
+        auto offset = ring.uploadPacketOffset;
+        ring.uploadPacketOffset = uploadImage.getNextPacketOffset(offset);
+        auto size = uploadImage.getPacketSize(offset);
+        memcpy(p->data, uploadImage.getPacketData(offset), size);
+        // Only the devices uploaded now, the others may have a different storyboard
+        uint32_t addressMask = p->getDataUInt32(1) & ring.uploadedAddressMask;
+        if (addressMask != 0)
+        {
+          p->setDataUInt32(1, addressMask);
+          p->header.data_size = size;
+          p->header.control = 1;
+          p->header.src_address = ring.ringNetwork->getAddress();
+          p->header.dst_address = RingNetworkProtocol::broadcast_address;
+          p->header.ttl = RingNetworkProtocol::ttl_max;
+          *pTxAction = PTxAction::Send;
+          telemetry.onUploadPacket(p->header.data_size, p->data[7]);
+        }
+        goToProtocolState(ring, EProtocolState::SendStoryboard_SendMulticast, p->header.data_size);
       }
     }
     break;
@@ -892,29 +3023,34 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
     {
       p->header.data_size = 1;
       p->header.control = 1;
-      p->header.src_address = ringNetwork->getAddress();
-      p->header.dst_address = enumeratedAddresses[state_currDeviceIdx].address;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = enumeratedAddresses[ring.currDeviceIdx].address;
       p->header.ttl = RingNetworkProtocol::ttl_max;
       p->data[0] = EMsgType::GetState;
       *pTxAction = PTxAction::Send;
-      goToProtocolState(EProtocolState::ReadState_WaitCrc);
+      ring.markRequestSent();
+      goToProtocolState(ring, EProtocolState::ReadState_WaitCrc, p->header.data_size);
     }
     break;
 
   case EProtocolState::ReadState_WaitCrc:
-    if (p->isDataPacket(ringNetwork->getAddress(), 1 + 4 + 4, EMsgType::TellState))
+    if (p->isDataPacket(ring.ringNetwork->getAddress(), 1 + 4 + 4, EMsgType::TellState) &&
+        isFromCurrDevice(ring, p))
     {
-      enumeratedAddresses[state_currDeviceIdx].crcReceived = p->getDataUInt32(1);
-      enumeratedAddresses[state_currDeviceIdx].storyboardTime = p->getDataInt32(1 + 4);
+      onReplyReceived(ring, ring.currDeviceIdx);
+      enumeratedAddresses[ring.currDeviceIdx].crcReceived = p->getDataUInt32(1);
+      enumeratedAddresses[ring.currDeviceIdx].storyboardTime = p->getDataInt32(1 + 4);
+      readDeviceCapabilities(enumeratedAddresses[ring.currDeviceIdx], p, 1 + 4 + 4);
 
-      if (state_currDeviceIdx == enumeratedAddressesCount - 1)
+      auto nextDeviceIdx = findNextDeviceOnRing(ring, ring.currDeviceIdx + 1);
+      if (nextDeviceIdx < 0)
       {
-        goToStateIdle();
+        goToStateIdle(ring);
       }
       else
       {
-        state_currDeviceIdx += 1;
-        goToProtocolState(EProtocolState::ReadState_Start);
+        ring.currDeviceIdx = nextDeviceIdx;
+        goToProtocolState(ring, EProtocolState::ReadState_Start);
       }
     }
     break;
@@ -924,12 +3060,12 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
     {
       p->header.data_size = 1;
       p->header.control = 1;
-      p->header.src_address = ringNetwork->getAddress();
+      p->header.src_address = ring.ringNetwork->getAddress();
       p->header.dst_address = RingNetworkProtocol::broadcast_address;
       p->header.ttl = RingNetworkProtocol::ttl_max;
       p->data[0] = EMsgType::Play;
       *pTxAction = PTxAction::Send;
-      goToStateIdle();
+      goToStateIdle(ring);
     }
     break;
 
@@ -938,12 +3074,12 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
     {
       p->header.data_size = 1;
       p->header.control = 1;
-      p->header.src_address = ringNetwork->getAddress();
+      p->header.src_address = ring.ringNetwork->getAddress();
       p->header.dst_address = RingNetworkProtocol::broadcast_address;
       p->header.ttl = RingNetworkProtocol::ttl_max;
       p->data[0] = EMsgType::Stop;
       *pTxAction = PTxAction::Send;
-      goToStateIdle();
+      goToStateIdle(ring);
     }
     break;
   case EProtocolState::SetOutput_Start:
@@ -951,14 +3087,147 @@ void MasterBoard::onPacketReceived(RingPacket *p, PTxAction *pTxAction)
     {
       p->header.data_size = 1 + 1 + 4;
       p->header.control = 1;
-      p->header.src_address = ringNetwork->getAddress();
-      p->header.dst_address = enumeratedAddresses[state_currDeviceIdx].address;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = enumeratedAddresses[ring.currDeviceIdx].address;
       p->header.ttl = RingNetworkProtocol::ttl_max;
       p->data[0] = EMsgType::SetOutput;
       p->data[1] = stateArg_OutputId;
       p->setDataUInt32(2, stateArg_Value);
       *pTxAction = PTxAction::Send;
-      goToStateIdle();
+      goToStateIdle(ring);
+    }
+    break;
+
+  case EProtocolState::Sync_Start:
+    if (isFree)
+    {
+      p->header.data_size = 1 + 4;
+      p->header.control = 1;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = RingNetworkProtocol::broadcast_address;
+      p->header.ttl = RingNetworkProtocol::ttl_max;
+      p->data[0] = EMsgType::SyncStoryboardTime;
+      p->setDataInt32(1, storyboardTime);
+      *pTxAction = PTxAction::Send;
+      goToStateIdle(ring);
+    }
+    break;
+
+  case EProtocolState::Stats_Start:
+    if (isFree)
+    {
+      p->header.data_size = 1;
+      p->header.control = 1;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = enumeratedAddresses[ring.currDeviceIdx].address;
+      p->header.ttl = RingNetworkProtocol::ttl_max;
+      p->data[0] = EMsgType::GetStats;
+      *pTxAction = PTxAction::Send;
+      ring.markRequestSent();
+      goToProtocolState(ring, EProtocolState::Stats_WaitReply, p->header.data_size);
+    }
+    break;
+
+  case EProtocolState::Stats_WaitReply:
+    if ((p->isDataPacket(ring.ringNetwork->getAddress(), TellStatsSize, EMsgType::TellStats) ||
+         p->isDataPacket(ring.ringNetwork->getAddress(), TellStatsSize + 4, EMsgType::TellStats)) &&
+        isFromCurrDevice(ring, p))
+    {
+      onReplyReceived(ring, ring.currDeviceIdx);
+      auto &stats = enumeratedAddresses[ring.currDeviceIdx].stats;
+      stats.tickOverrunsCount = p->getDataUInt32(1);
+      stats.mainsFrequencyMilliHz = p->getDataUInt32(5);
+      stats.isMainsStable = p->data[9] != 0;
+      stats.freeHeapBytes = p->getDataUInt32(10);
+      stats.packetsReceivedCount = p->getDataUInt32(14);
+      stats.packetsDroppedCount = p->getDataUInt32(18);
+      stats.scheduleOverflowsCount = p->header.data_size > TellStatsSize ? p->getDataUInt32(TellStatsSize) : 0;
+      stats.lastUpdateTime = upTime;
+      stats.isValid = true;
+      goToStateIdle(ring);
+    }
+    break;
+
+  case EProtocolState::SelectShow_Start:
+    if (isFree)
+    {
+      p->header.data_size = 1 + 4;
+      p->header.control = 1;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = enumeratedAddresses[ring.currDeviceIdx].address;
+      p->header.ttl = RingNetworkProtocol::ttl_max;
+      p->data[0] = EMsgType::SelectShow;
+      p->setDataUInt32(1, showCrc);
+      *pTxAction = PTxAction::Send;
+      ring.markRequestSent();
+      goToProtocolState(ring, EProtocolState::SelectShow_WaitReply, p->header.data_size);
+    }
+    break;
+
+  case EProtocolState::SelectShow_WaitReply:
+    if (p->isDataPacket(ring.ringNetwork->getAddress(), 1 + 4 + 1, EMsgType::TellShow) &&
+        isFromCurrDevice(ring, p))
+    {
+      onReplyReceived(ring, ring.currDeviceIdx);
+      // Uploaded by the next step if it doesn't have it
+      enumeratedAddresses[ring.currDeviceIdx].uploadPending = p->getDataUInt32(1) != showCrc || p->data[5] == 0;
+
+      auto nextDeviceIdx = findNextDeviceWithShowCache(ring, ring.currDeviceIdx + 1);
+      if (nextDeviceIdx < 0)
+      {
+        goToStateIdle(ring);
+      }
+      else
+      {
+        ring.currDeviceIdx = nextDeviceIdx;
+        goToProtocolState(ring, EProtocolState::SelectShow_Start);
+      }
+    }
+    break;
+
+  case EProtocolState::StreamStart_Start:
+    if (isFree)
+    {
+      p->header.data_size = 1 + 4;
+      p->header.control = 1;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = RingNetworkProtocol::broadcast_address;
+      p->header.ttl = RingNetworkProtocol::ttl_max;
+      p->data[0] = EMsgType::StreamStart;
+      p->setDataInt32(1, streamReader.getDuration());
+      *pTxAction = PTxAction::Send;
+      goToStateIdle(ring);
+    }
+    break;
+
+  case EProtocolState::Commit_Start:
+    if (isFree)
+    {
+      p->header.data_size = 1 + 4 + 1;
+      p->header.control = 1;
+      p->header.src_address = ring.ringNetwork->getAddress();
+      p->header.dst_address = RingNetworkProtocol::broadcast_address;
+      p->header.ttl = RingNetworkProtocol::ttl_max;
+      p->data[0] = EMsgType::CommitStoryboard;
+      // Read the time and arm the switch together, with tick held off: the master switches at the
+      // wrap that follows the time sent, the same one the devices wait for after aligning to it.
+      // A ring that sends after that wrap, or when stopped, tells its devices to switch right away
+      __disable_irq();
+      p->setDataInt32(1, storyboardTime);
+      if (isPlaying && storyboard != uploadStoryboard)
+      {
+        p->data[5] = 1;
+        commitAtLoopEnd = true;
+      }
+      else
+      {
+        p->data[5] = 0;
+        if (storyboard != uploadStoryboard)
+          switchToUploadStoryboard();
+      }
+      __enable_irq();
+      *pTxAction = PTxAction::Send;
+      goToStateIdle(ring);
     }
     break;
   }
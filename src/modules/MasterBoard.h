@@ -1,12 +1,25 @@
 #ifndef _MASTERBOARD_H_
 #define _MASTERBOARD_H_
 
-#include "..\bitLabCore\src\os\bitLabCore.h"
-#include "..\bitLabCore\src\net\RingNetwork.h"
+#include "bitLabCore/src/os/bitLabCore.h"
+#include "bitLabCore/src/net/RingNetwork.h"
 
-#include "..\bitLabCore\src\storyboard\Storyboard.h"
+#include "bitLabCore/src/storyboard/Storyboard.h"
 
-#include "..\bitLabCore\src\display\SSD1306.h"
+#include "bitLabCore/src/display/SSD1306.h"
+
+#include "RttEstimator.h"
+#include "RingTelemetry.h"
+#include "Profiler.h"
+#include "TextDisplay.h"
+#include "CommandParser.h"
+#include "StoryboardOptimizer.h"
+#include "TimerWheel.h"
+#include "UploadImage.h"
+#include "DeferredQueue.h"
+#include "SerialRxBuffer.h"
+#include "StreamReader.h"
+#include "ShowCatalog.h"
 
 class MasterBoard : public CoreModule
 {
@@ -20,24 +33,28 @@ public:
   void tick(millisec timeDelta);
   // ------------------
 
+  // Call before the core runs, once for each ring. Without any, the first RingNetwork module is used
+  void addRing(RingNetwork *ringNetwork);
+
 private:
-  RingNetwork* ringNetwork;
   uint32_t hardwareId;
-  bool lastIsConnected;
   uint32_t connectionLostCount;
+  // Set when the first enumeration completes, from then on a reconnection starts a recovery
+  bool isEnumerationDone;
   
   DigitalOut led;
   DigitalIn inPlay;
   DigitalIn inStop;
   const millisec InputDebounceTimeoutValue = 50;
-  millisec inputDebounceTimeout;
+  TimerWheel::Timer inputDebounceTimer;
   enum EInputKey {
     Key_None,
     Key_A,
     Key_B
   };
   EInputKey pressedKey;
-  millisec pressedKeyTime;
+  // timers time when the key was pressed
+  uint32_t pressedKeyStartTime;
 
   enum EDisplayState {
     Home = 0,
@@ -52,9 +69,11 @@ private:
     Upload,
     Play,
     Stop,
+    Show, // One entry for each show in the catalog, see selectedShowIdx
     CommandsCount // Dummy entry to read the entries count
   };
   ECommand selectedCommand;
+  uint32_t selectedShowIdx;
 
   bool isDisplayDirty;
   void printDisplay();
@@ -62,15 +81,24 @@ private:
   const char* clockSourceDescr;
 
   I2C i2c;
+  // Used at startup, then the display is updated through textDisplay, sending only what changed
   SSD1306OverI2C oled;
+  TextDisplay textDisplay;
+
+  // All the timeouts of the module, advanced by tick
+  TimerWheel timers;
 
   millisec upTime;
-  millisec eachSecondTimeout;
-  bool secondElapsed;
+  TimerWheel::Timer eachSecondTimer;
+  volatile bool secondElapsed;
+  void onEachSecondTimer();
 
   millisec storyboardTime;
   millisec storyboardTimeAtLastGetState;
   bool isPlaying;
+  // Times storyboardTime wrapped since the play started
+  volatile uint32_t playLoopsCount;
+  inline millisec getPlayDuration() { return streamReader.isOpen() ? streamReader.getDuration() : storyboard->getDuration(); }
 
   // Serial protocol protocolState
   FILE *openFile;
@@ -92,53 +120,413 @@ private:
     ToggleLed_Start,
     SendStoryboard_Start,
     SendStoryboard_SendTimelines,
+    SendStoryboard_SendMulticast,
     ReadState_Start,
     ReadState_WaitCrc,
     Play_Start,
     Stop_Start,
     SetOutput_Start,
+    Commit_Start,
+    StreamStart_Start,
+    Stats_Start,
+    Stats_WaitReply,
+    Sync_Start,
+    SelectShow_Start,
+    SelectShow_WaitReply,
+  };
+
+  // The master drives more rings, each on its own UART and with its own devices.
+  // A procedure runs on all the rings at the same time: each ring has its own protocol state
+  // and goes through the devices that belong to it, the procedure is completed (state goes
+  // back to Idle) when all the rings are back to PS_Idle.
+  const static uint32_t MaxRings = 2;
+  const static uint32_t MaxDevicesPerRing = 10;
+  const static uint32_t MaxDevices = MaxRings * MaxDevicesPerRing;
+  // The upload image and the telemetry size their arrays on their own, they must fit the devices of the master
+  static_assert(UploadImage::MaxDevices == MaxDevices, "UploadImage::MaxDevices must match the master");
+  static_assert(UploadImage::MaxRings == MaxRings, "UploadImage::MaxRings must match the master");
+  static_assert(RingTelemetry::MaxDevices == MaxDevices, "RingTelemetry::MaxDevices must match the master");
+  struct RingContext {
+    MasterBoard *owner;
+    uint8_t idx;
+    RingNetwork *ringNetwork;
+    bool lastIsConnected;
+    volatile EProtocolState protocolState;
+
+    // data variables for the protocolState machine
+    uint32_t currDeviceIdx; // Index in enumeratedAddresses
+    uint32_t uploadPacketOffset; // Next packet to send in uploadImage
+    uint32_t uploadedAddressMask; // Devices that got their CreateStoryboard, by address, for the multicast packets
+    uint32_t retriesCount;
+    // Devices enumerated on this ring, the ttl of the next WhoAreYou is one more
+    uint32_t devicesCount;
+    uint32_t freePacketsCount;
+
+    TimerWheel::Timer waitStateTimer;
+    volatile bool waitStateTimedOut;
+
+    // Ring round trip measurement, used to size the waitStateTimer delay
+    RttEstimator rtt;
+    uint32_t lastPacketTimeUs;
+    bool lastPacketTimeValid;
+    uint32_t requestSentTimeUs;
+
+    // One for each ring, so that each queue has a single producer
+    DeferredQueue deferredQueue;
+
+    inline void onPacketReceived(RingPacket *p, PTxAction *pTxAction) { owner->onPacketReceived(*this, p, pTxAction); }
+    inline void onWaitStateTimer() { waitStateTimedOut = true; }
+    inline void markRequestSent() { requestSentTimeUs = us_ticker_read(); }
   };
-  EProtocolState protocolState;
+  RingContext rings[MaxRings];
+  uint32_t ringsCount;
+  bool areAllRingsIdle();
 
-  // data variables for the protocolState machine
-  uint32_t state_currDeviceIdx;
-  uint8_t state_nextTimelineIdxMaybeToSend;
   uint8_t stateArg_OutputId; // setOutput
   uint32_t stateArg_Value; // setOutput
 
-  void goToProtocolState(EProtocolState newProtocolState);
-  void goToState(EState newState, EProtocolState newProtocolState);
+  void goToProtocolState(RingContext &ring, EProtocolState newProtocolState, uint32_t sentDataSize = 0);
+  void startProtocolState(RingContext &ring, EProtocolState newProtocolState, uint32_t currDeviceIdx);
+  void startEnumeration();
+  // The ring goes to PS_Idle, then state goes to Idle if it was the last ring busy
+  void goToStateIdle(RingContext &ring);
+  // Like goToStateIdle, but state is left unchanged
+  void goToStateIdle2(RingContext &ring);
+  // All the rings
   void goToStateIdle();
-  void goToStateIdle2();
-  bool tryGoToStateIfIdleAndHasDevices(EProtocolState newState, uint32_t currDeviceIdx = 0);
-  uint32_t freePacketsCount;
+  // Starts the procedure on each ring, from its first device (its first with uploadPending for an upload).
+  // With deviceIdx >= 0 it runs only on the ring of that device, for that device
+  bool tryGoToStateIfIdleAndHasDevices(EProtocolState newState, int32_t deviceIdx = -1);
+
+  // What a device is, as it tells in the optional tail of Hello and TellState
+  enum EBoardType {
+    Board_Unknown = 0,
+    Board_Triac = 1,
+    Board_Relay = 2,
+  };
+  enum EBoardCapability {
+    // The outputs can fade between values, otherwise they are just on or off
+    Cap_Fade = 0x01,
+    // Accepts SetTimelineSwitchEntries, with time and on/off state only
+    Cap_SwitchEntries = 0x02,
+    // Takes its entries from the multicast packets, when its address is in the bitmap
+    Cap_Multicast = 0x04,
+    // Keeps more storyboards, by show crc, and switches to one of them with SelectShow
+    Cap_ShowCache = 0x08,
+  };
+
+  // Health of a device, as told by its last TellStats
+  struct NodeStats {
+    bool isValid;
+    millisec lastUpdateTime; // upTime
+    uint32_t tickOverrunsCount;
+    uint32_t mainsFrequencyMilliHz; // 0 if the board has no mains input
+    bool isMainsStable;
+    uint32_t freeHeapBytes;
+    uint32_t packetsReceivedCount;
+    uint32_t packetsDroppedCount;
+    // Relay switches lost because the board queue was full, 0 if the board doesn't tell it
+    uint32_t scheduleOverflowsCount;
+    // Kept by the master
+    uint32_t pollsCount;
+    uint32_t timeoutsCount;
+
+    inline void reset()
+    {
+      isValid = false;
+      lastUpdateTime = 0;
+      tickOverrunsCount = 0;
+      mainsFrequencyMilliHz = 0;
+      isMainsStable = false;
+      freeHeapBytes = 0;
+      packetsReceivedCount = 0;
+      packetsDroppedCount = 0;
+      scheduleOverflowsCount = 0;
+      pollsCount = 0;
+      timeoutsCount = 0;
+    }
+  };
 
   struct EnumeratedDeviceInfo {
-    uint8_t address;
+    uint8_t ringIdx;
+    uint8_t address; // On its ring
     uint32_t hardwareId;
+    // Read with GetState, 0 when unknown (not read yet, or uploaded after the last read)
     uint32_t crcReceived;
     millisec storyboardTime;
+    // Set for the devices the next SendStoryboard procedure will upload to
+    bool uploadPending;
+    uint8_t boardType;
+    uint8_t outputsCount;
+    uint8_t capabilities;
+    uint8_t firmwareVersion;
+    NodeStats stats;
+
+    inline bool usesSwitchEntries() { return (capabilities & Cap_SwitchEntries) && !(capabilities & Cap_Fade); }
+    // The address bitmap of the multicast packets has 32 bits
+    inline bool acceptsMulticast() { return (capabilities & Cap_Multicast) && address < 32; }
+    inline bool hasShowCache() { return (capabilities & Cap_ShowCache) != 0; }
   };
+  static const char *getBoardTypeDescr(uint8_t boardType);
+  void readDeviceCapabilities(EnumeratedDeviceInfo &device, RingPacket *p, uint32_t offset);
 
-  EnumeratedDeviceInfo enumeratedAddresses[10];
+  // The devices of all the rings, in the order they were found
+  EnumeratedDeviceInfo enumeratedAddresses[MaxDevices];
   uint32_t enumeratedAddressesCount;
   inline bool isIdleAndHasDevices() { return state == EState::Idle && enumeratedAddressesCount > 0; }
   int32_t findDeviceByHardwareId(uint32_t hardwareId);
+  // Index of the device with the address on the ring, -1 if none
+  int32_t findDeviceByAddress(RingContext &ring, uint8_t address);
+  // Index of the first device of the ring starting from fromIdx, -1 if none
+  int32_t findNextDeviceOnRing(RingContext &ring, uint32_t fromIdx);
+  // Index of the first device of the ring with uploadPending set, starting from fromIdx, -1 if none
+  int32_t findNextDeviceToUpload(RingContext &ring, uint32_t fromIdx);
+  // Index of the first device of the ring with Cap_ShowCache, starting from fromIdx, -1 if none
+  int32_t findNextDeviceWithShowCache(RingContext &ring, uint32_t fromIdx);
 
-  Storyboard storyboard;
+  // Double buffered: storyboard is the one playing, the other slot receives a new version
+  // while the current one keeps playing, see command_Reload
+  Storyboard storyboards[2];
+  Storyboard *storyboard;
+  // The one sent by the SendStoryboard procedure, the shadow slot during a reload
+  Storyboard *uploadStoryboard;
+  inline Storyboard *getShadowStoryboard() { return storyboard == &storyboards[0] ? &storyboards[1] : &storyboards[0]; }
+  // Validation and entry counts after the load time optimisation, one for each storyboard slot
+  StoryboardOptimizer optimizers[2];
+  inline StoryboardOptimizer *getOptimizer(Storyboard *sb) { return &optimizers[sb - storyboards]; }
 
-  void onPacketReceived(RingPacket*, PTxAction*);
+  // The packets of the SendStoryboard procedure, serialized in mainLoop for the storyboard
+  // and the devices known at that time. Set uploadImageStoryboard to NULL when a device changes,
+  // so the image is built again before the next upload.
+  UploadImage uploadImage;
+  Storyboard *uploadImageStoryboard;
+  // Packets not sent thanks to the multicast ones, compared to sending each timeline to each device
+  uint32_t uploadImagePacketsSaved;
+  bool buildUploadImage(Storyboard *sb);
+  // Writes the entries starting at offset, returns the offset after the last one
+  uint32_t writeEntries(RingPacket &packet, uint32_t offset, Timeline *t,
+                        uint32_t firstEntryIdx, uint32_t count, bool usesSwitchEntries);
+  // Sets uploadStoryboard, building its upload image if needed
+  bool prepareUpload(Storyboard *sb);
+
+  // Measures the time spent in processPacket, keep it constant and short:
+  // anything slow is posted to the deferredQueue of the ring and done by mainLoop
+  void onPacketReceived(RingContext &ring, RingPacket*, PTxAction*);
+  void processPacket(RingContext &ring, RingPacket*, PTxAction*);
+  enum EDeferredWork
+  {
+    Deferred_DebugPrint, // payload: text, without terminator
+    Deferred_DeviceFound, // payload: address, hardwareId
+  };
+  void mainLoop_deferred();
+
+  // Background poll of the device stats, one device each StatsPollInterval, only when the ring is idle.
+  // Any other procedure takes the ring from it, see tryGoToStateIfIdleAndHasDevices
+  const static millisec StatsPollInterval = 2000;
+  // TellStats without the optional schedule overflows count
+  const static uint32_t TellStatsSize = 1 + 4 + 4 + 1 + 4 + 4 + 4;
+  TimerWheel::Timer statsPollTimer;
+  volatile bool statsPollDue;
+  uint32_t statsPollDeviceIdx;
+  void onStatsPollTimer();
+  void mainLoop_statsPoll();
+  inline bool isPollingStats(RingContext &ring) { return ring.protocolState == EProtocolState::Stats_Start ||
+                                                         ring.protocolState == EProtocolState::Stats_WaitReply; }
+  // On any ring
+  bool isPollingStats();
+  // Stops the poll, so it doesn't make the state busy for a command or procedure that wants to start.
+  // Called first by the guards of the commands, before they check isStateBusy or isIdleAndHasDevices
+  void preemptStatsPoll();
+  void printNodes();
 
   void mainLoop_checkForWaitStateTimeout();
   void mainLoop_serialProtocol();
+  // Filled by onSerialRx, from the RX interrupt
+  SerialRxBuffer serialRxBuffer;
+  void onSerialRx();
+  CommandParser commandParser;
+  bool executeCommand(CommandParser &cp);
   void mainLoop_keyboard();
-  millisec waitStateTimeout;
-  bool waitStateTimeoutEnabled;
+  // Set when a procedure is abandoned after its retries on any ring, cleared when a new one starts
+  bool lastProcedureFailed;
+
+  // deviceIdx is the index in enumeratedAddresses of the replying device, -1 for the master itself
+  void onReplyReceived(RingContext &ring, int32_t deviceIdx);
+  // A late reply to an earlier request, from another device, must not be taken for the current one
+  inline bool isFromCurrDevice(RingContext &ring, RingPacket *p)
+  {
+    return p->header.src_address == enumeratedAddresses[ring.currDeviceIdx].address;
+  }
+
+  RingTelemetry telemetry;
+  void printStats();
+  void printUploadReport();
+  bool printProfile(bool reset);
+
+  // A timed out step is retried a few times before giving up the whole procedure
+  const static uint32_t MaxRetries = 3;
+  uint32_t retriesCount;
+  uint32_t timeoutsCount;
+  bool tryRetryProtocolState(RingContext &ring);
 
-  bool command_Load();
+  bool command_Load(Storyboard *target, const char *path);
   bool command_Upload();
   bool command_Play();
   bool command_Stop();
+  bool command_Run(const char *path);
+  bool command_Autostart();
+  bool command_Reload();
+  bool command_Stream(const char *path);
+  bool command_Export(const char *path);
+  bool command_Show(const char *name);
+
+  // Hot reload: the new storyboard is loaded and uploaded in the shadow slot, then a CommitStoryboard
+  // broadcast tells the slaves to switch at the next wrap of storyboardTime, when the master does too
+  enum EReloadStep
+  {
+    RS_None,
+    RS_Upload,
+    RS_WaitCommit,
+  };
+  EReloadStep reloadStep;
+  // Set when the commit is sent, the switch is done by tick at the end of the loop
+  volatile bool commitAtLoopEnd;
+  // Set when the upload is completed, until mainLoop starts the commit broadcast
+  volatile bool commitPending;
+  void mainLoop_reload();
+  void switchToUploadStoryboard();
+
+  // Load, check, upload where needed, then play.
+  // Runs after the enumeration if the autostart file is on the SD card, or with the autostart command.
+  // The crc each device reported after the last upload is kept in a cache file, so after a restart
+  // only the devices that lost or changed their storyboard get it uploaded again.
+  enum EAutostartStep
+  {
+    AS_None,
+    AS_Load,
+    AS_Check,
+    AS_Upload,
+    AS_Verify,
+    AS_Play,
+  };
+  EAutostartStep autostartStep;
+  uint32_t autostartStartTimeUs;
+  void mainLoop_autostart();
+  void endAutostart(bool isOk);
+  bool tryReadUploadCache(uint32_t storyboardCrc);
+  void writeUploadCache(uint32_t storyboardCrc);
+  // After the devices dropped their storyboard: all of them need an upload, and the cache is removed
+  void invalidateUploads();
+
+  // Streaming playback: the entries are read from a stream file on the SD card a window at a time
+  // (see StreamReader) and sent to the devices StreamLeadTime before they are due, while playing.
+  // The packets are prepared by mainLoop and sent by the packet callback when the ring is idle.
+  enum EStreamStep
+  {
+    SS_None,
+    SS_WaitStart,
+    SS_Running,
+  };
+  const static millisec StreamLeadTime = 1000;
+  const static uint32_t StreamEntriesPerPacket = 18;
+  EStreamStep streamStep;
+  StreamReader streamReader;
+  // Type, count, loop, then the entries
+  const static uint32_t StreamPacketHeaderSize = 1 + 1 + 4;
+  uint8_t streamPacket[StreamPacketHeaderSize + StreamEntriesPerPacket * 13];
+  uint8_t streamPacketSize;
+  uint8_t streamPacketRingIdx;
+  uint8_t streamPacketAddress;
+  volatile bool streamPacketReady;
+  uint32_t streamStartTimeUs;
+  uint32_t streamPacketsCount;
+  uint32_t streamEntriesCount;
+  // Entries sent when their time had already passed
+  uint32_t streamLateCount;
+  // Entries for devices not in the ring
+  uint32_t streamSkippedCount;
+  void mainLoop_stream();
+  void prepareStreamPacket();
+  void endStream(bool isOk);
+
+  // Recovery after the ring reconnects: enumerate again, then upload only to the devices that are new
+  // or report a crc different from the one they had before, then align the time of all of them
+  // and play again if the master was playing.
+  enum ERecoveryStep
+  {
+    RC_None,
+    RC_Enumerate,
+    RC_Check,
+    RC_Upload,
+    RC_Verify,
+    RC_Sync,
+    RC_Play,
+  };
+  ERecoveryStep recoveryStep;
+  uint32_t recoveryStartTimeUs;
+  // The devices before the reconnection
+  EnumeratedDeviceInfo previousDevices[MaxDevices];
+  uint32_t previousDevicesCount;
+  // The crc each device had before the reconnection, 0 for the new ones
+  uint32_t recoveryExpectedCrcs[MaxDevices];
+  uint32_t recoveryNewCount;
+  uint32_t recoveryLostCount;
+  uint32_t recoveryUploadCount;
+  void startRecovery();
+  void mainLoop_recovery();
+  void endRecovery(bool isOk);
+
+  // Switch to a show of the catalog: stop, load it, then SelectShow to the devices that keep more
+  // storyboards; only the ones that don't have it, and the devices without Cap_ShowCache, get
+  // it uploaded. Then the crcs are read back, and the show plays if the previous one was playing.
+  enum EShowStep
+  {
+    SW_None,
+    SW_Load,
+    SW_Select,
+    SW_Upload,
+    SW_Verify,
+    SW_Play,
+  };
+  ShowCatalog showCatalog;
+  EShowStep showStep;
+  // Index in showCatalog of the show being switched to
+  uint32_t showSwitchIdx;
+  // Name of the show in storyboard, empty if it was loaded from another file
+  char currentShowName[ShowCatalog::MaxNameLength + 1];
+  // Sent with SelectShow
+  uint32_t showCrc;
+  bool showWasPlaying;
+  uint32_t showStartTimeUs;
+  uint32_t showUploadCount;
+  void mainLoop_show();
+  void endShow(bool isOk);
+
+  // Command script executed from a file, one line per mainLoop.
+  // Commands that use the ring wait for the previous ring command to complete,
+  // the others are executed right away, even while a ring command is in progress.
+  FILE *scriptFile;
+  CommandParser scriptParser;
+  bool scriptLineReady;
+  uint32_t scriptLineNumber;
+  uint32_t scriptStartTimeUs;
+  struct ScriptCommandTiming
+  {
+    char name[12];
+    uint32_t lineNumber;
+    uint32_t startTimeUs;
+    uint32_t durationUs;
+  };
+  const static uint32_t MaxScriptTimings = 32;
+  ScriptCommandTiming scriptTimings[MaxScriptTimings];
+  uint32_t scriptTimingsCount;
+  // Line of the ring command in progress, 0 if none
+  uint32_t scriptRingCommandLineNumber;
+  // Index in scriptTimings of the ring command in progress, -1 if none or not timed
+  int32_t scriptRingCommandTimingIdx;
+  void mainLoop_script();
+  void endScript(bool isOk);
+  bool isRingCommand(CommandParser &cp);
 };
 
 #endif
\ No newline at end of file
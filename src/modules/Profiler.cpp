@@ -0,0 +1,96 @@
+#include "Profiler.h"
+
+#include "../config.h"
+
+Profiler::ScopeStats Profiler::stats[ProfileScopeCount];
+uint32_t Profiler::budgets[ProfileScopeCount];
+
+const uint32_t OneTickUs = 1000000 / TICKS_PER_SECOND;
+
+static uint32_t timePerUs()
+{
+#ifdef __MBED__
+  return SystemCoreClock / 1000000;
+#else
+  return 1000;
+#endif
+}
+
+void Profiler::init()
+{
+#ifdef __MBED__
+  // Start the cycle counter
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+  budgets[Profile_MasterTick] = OneTickUs;
+  budgets[Profile_MasterMainLoop] = 0;
+  budgets[Profile_PacketReceived] = OneTickUs / 2;
+  budgets[Profile_TriacTick] = OneTickUs;
+  budgets[Profile_RelayTick] = OneTickUs;
+  for (int i = 0; i < ProfileScopeCount; i++)
+  {
+    budgets[i] *= timePerUs();
+  }
+
+  reset();
+}
+
+void Profiler::reset()
+{
+  for (int i = 0; i < ProfileScopeCount; i++)
+  {
+    stats[i].count = 0;
+    stats[i].min = UINT32_MAX;
+    stats[i].max = 0;
+    stats[i].total = 0;
+    stats[i].overruns = 0;
+  }
+}
+
+void Profiler::record(EProfileScope scope, uint32_t startTime)
+{
+  // Unsigned math takes care of the counter wrap around
+  uint32_t elapsed = now() - startTime;
+
+  ScopeStats &s = stats[scope];
+  s.count += 1;
+  s.total += elapsed;
+  if (elapsed < s.min)
+    s.min = elapsed;
+  if (elapsed > s.max)
+    s.max = elapsed;
+  if (budgets[scope] > 0 && elapsed > budgets[scope])
+    s.overruns += 1;
+}
+
+const char *Profiler::getScopeName(EProfileScope scope)
+{
+  switch (scope)
+  {
+  case Profile_MasterTick:
+    return "tick";
+  case Profile_MasterMainLoop:
+    return "mainLoop";
+  case Profile_PacketReceived:
+    return "onPacketReceived";
+  case Profile_TriacTick:
+    return "triacTick";
+  case Profile_RelayTick:
+    return "relayTick";
+  default:
+    return "?";
+  }
+}
+
+uint32_t Profiler::getScopeBudgetUs(EProfileScope scope)
+{
+  return toUs(budgets[scope]);
+}
+
+uint32_t Profiler::toUs(uint64_t time)
+{
+  return (uint32_t)(time / timePerUs());
+}
@@ -0,0 +1,82 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <cstdint>
+
+#ifdef __MBED__
+#include "mbed.h"
+#else
+#include <chrono>
+#endif
+
+// Lightweight timing of the hot paths.
+// Enabled by defining UseProfiling in the build flags, otherwise PROFILE_SCOPE expands to nothing.
+// On target time is read from the DWT cycle counter, on host from std::chrono.
+
+enum EProfileScope
+{
+  Profile_MasterTick = 0,
+  Profile_MasterMainLoop,
+  Profile_PacketReceived,
+  Profile_TriacTick,
+  Profile_RelayTick,
+  ProfileScopeCount // Dummy entry to read the entries count
+};
+
+class Profiler
+{
+public:
+  static void init();
+  static void reset();
+
+  static inline uint32_t now();
+  static void record(EProfileScope scope, uint32_t startTime);
+
+  struct ScopeStats
+  {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t overruns;
+  };
+  static const char *getScopeName(EProfileScope scope);
+  static const ScopeStats &getScopeStats(EProfileScope scope) { return stats[scope]; }
+  // Time over which an execution of the scope is counted as an overrun, 0 if none
+  static uint32_t getScopeBudgetUs(EProfileScope scope);
+  static uint32_t toUs(uint64_t time);
+
+private:
+  static ScopeStats stats[ProfileScopeCount];
+  static uint32_t budgets[ProfileScopeCount];
+};
+
+#ifdef __MBED__
+inline uint32_t Profiler::now() { return DWT->CYCCNT; }
+#else
+inline uint32_t Profiler::now()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+#endif
+
+class ProfileScope
+{
+public:
+  inline ProfileScope(EProfileScope scope) : scope(scope), startTime(Profiler::now()) {}
+  inline ~ProfileScope() { Profiler::record(scope, startTime); }
+
+private:
+  EProfileScope scope;
+  uint32_t startTime;
+};
+
+#ifdef UseProfiling
+#define PROFILE_SCOPE(scope) ProfileScope _profileScope(scope)
+#else
+#define PROFILE_SCOPE(scope)
+#endif
+
+#endif
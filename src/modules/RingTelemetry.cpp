@@ -0,0 +1,192 @@
+#include "RingTelemetry.h"
+
+#include "mbed.h"
+
+RingTelemetry::RingTelemetry()
+{
+  reset();
+}
+
+void RingTelemetry::reset()
+{
+  freePacketsCount = 0;
+  dataPacketsCount = 0;
+  protocolPacketsCount = 0;
+  freePacketsAtLastSecond = 0;
+  dataPacketsAtLastSecond = 0;
+  freePacketsPerSecond = 0;
+  dataPacketsPerSecond = 0;
+  utilisation = 0;
+
+  callbacksCount = 0;
+  maxCallbackUs = 0;
+  maxCallbackUsCurrSecond = 0;
+  maxCallbackUsPerSecond = 0;
+
+  for (uint32_t i = 0; i < MsgTypeSlots; i++)
+    msgTypeCounts[i] = 0;
+  for (uint32_t i = 0; i < RotationBuckets; i++)
+    rotationHistogram[i] = 0;
+  for (uint32_t i = 0; i < MaxDevices; i++)
+  {
+    deviceLatencies[i].samplesCount = 0;
+    deviceLatencies[i].lastUs = 0;
+    deviceLatencies[i].minUs = UINT32_MAX;
+    deviceLatencies[i].maxUs = 0;
+    deviceLatencies[i].totalUs = 0;
+  }
+
+  upload.isRunning = false;
+  upload.isCompleted = false;
+  upload.devicesCount = 0;
+  upload.timelinesCount = 0;
+  upload.packetsCount = 0;
+  upload.bytesCount = 0;
+  upload.entriesCount = 0;
+  upload.rotationsCount = 0;
+  upload.startTimeUs = 0;
+  upload.durationUs = 0;
+  uploadEnded = false;
+}
+
+void RingTelemetry::onFreePacket()
+{
+  __disable_irq();
+  freePacketsCount += 1;
+  __enable_irq();
+}
+
+void RingTelemetry::onDataPacket(bool isProtocol, uint8_t msgType)
+{
+  __disable_irq();
+  dataPacketsCount += 1;
+  if (isProtocol)
+  {
+    protocolPacketsCount += 1;
+  }
+  else
+  {
+    msgTypeCounts[msgType < MsgTypeSlots - 1 ? msgType : MsgTypeSlots - 1] += 1;
+  }
+  __enable_irq();
+}
+
+void RingTelemetry::onRotation(uint32_t rotationUs)
+{
+  __disable_irq();
+  if (upload.isRunning)
+    upload.rotationsCount += 1;
+
+  uint32_t bucket = 0;
+  uint32_t limitUs = 64;
+  while (bucket < RotationBuckets - 1 && rotationUs >= limitUs)
+  {
+    bucket += 1;
+    limitUs <<= 1;
+  }
+  rotationHistogram[bucket] += 1;
+  __enable_irq();
+}
+
+void RingTelemetry::onDeviceReply(uint32_t deviceIdx, uint32_t latencyUs)
+{
+  if (deviceIdx >= MaxDevices)
+    return;
+
+  __disable_irq();
+  DeviceLatency &dl = deviceLatencies[deviceIdx];
+  dl.samplesCount += 1;
+  dl.lastUs = latencyUs;
+  dl.totalUs += latencyUs;
+  if (latencyUs < dl.minUs)
+    dl.minUs = latencyUs;
+  if (latencyUs > dl.maxUs)
+    dl.maxUs = latencyUs;
+  __enable_irq();
+}
+
+void RingTelemetry::onSecondElapsed()
+{
+  // Read the counters once, they are updated by the packet callback
+  uint32_t free = freePacketsCount;
+  uint32_t data = dataPacketsCount;
+
+  freePacketsPerSecond = free - freePacketsAtLastSecond;
+  dataPacketsPerSecond = data - dataPacketsAtLastSecond;
+  freePacketsAtLastSecond = free;
+  dataPacketsAtLastSecond = data;
+
+  uint32_t total = freePacketsPerSecond + dataPacketsPerSecond;
+  utilisation = total > 0 ? (dataPacketsPerSecond * 100) / total : 0;
+
+  __disable_irq();
+  maxCallbackUsPerSecond = maxCallbackUsCurrSecond;
+  maxCallbackUsCurrSecond = 0;
+  __enable_irq();
+}
+
+void RingTelemetry::onCallbackDuration(uint32_t durationUs)
+{
+  __disable_irq();
+  callbacksCount += 1;
+  if (durationUs > maxCallbackUs)
+    maxCallbackUs = durationUs;
+  if (durationUs > maxCallbackUsCurrSecond)
+    maxCallbackUsCurrSecond = durationUs;
+  __enable_irq();
+}
+
+void RingTelemetry::beginUpload(uint32_t nowUs)
+{
+  __disable_irq();
+  upload.isRunning = true;
+  upload.isCompleted = false;
+  upload.devicesCount = 0;
+  upload.timelinesCount = 0;
+  upload.packetsCount = 0;
+  upload.bytesCount = 0;
+  upload.entriesCount = 0;
+  upload.rotationsCount = 0;
+  upload.startTimeUs = nowUs;
+  upload.durationUs = 0;
+  __enable_irq();
+}
+
+void RingTelemetry::onUploadPacket(uint32_t bytes, uint32_t entries)
+{
+  __disable_irq();
+  upload.packetsCount += 1;
+  upload.bytesCount += bytes;
+  upload.entriesCount += entries;
+  __enable_irq();
+}
+
+void RingTelemetry::onUploadDeviceCompleted(uint32_t timelinesCount)
+{
+  __disable_irq();
+  upload.devicesCount += 1;
+  upload.timelinesCount += timelinesCount;
+  __enable_irq();
+}
+
+void RingTelemetry::endUpload(uint32_t nowUs, bool isCompleted)
+{
+  __disable_irq();
+  if (upload.isRunning)
+  {
+    upload.isRunning = false;
+    upload.isCompleted = isCompleted;
+    upload.durationUs = nowUs - upload.startTimeUs;
+    uploadEnded = true;
+  }
+  __enable_irq();
+}
+
+bool RingTelemetry::tryTakeUploadEnded()
+{
+  __disable_irq();
+  bool isEnded = uploadEnded;
+  uploadEnded = false;
+  __enable_irq();
+  return isEnded;
+}
@@ -0,0 +1,111 @@
+#ifndef _RINGTELEMETRY_H_
+#define _RINGTELEMETRY_H_
+
+#include <cstdint>
+
+// Network counters collected by the master in the ring packet callback.
+// Everything is kept in fixed size arrays, so recording a packet never allocates
+// and takes constant time. Rates are computed once a second by onSecondElapsed().
+// With a second ring both packet callbacks record here, so every update runs with the
+// interrupts disabled.
+class RingTelemetry
+{
+public:
+  RingTelemetry();
+
+  const static uint32_t MsgTypeSlots = 16;  // Last slot collects all msg types >= MsgTypeSlots - 1
+  const static uint32_t RotationBuckets = 12; // Bucket i counts rotations < (64us << i), the last one all the others
+  const static uint32_t MaxDevices = 20;
+
+  void reset();
+
+  // --- Called from the packet callback ---
+  void onFreePacket();
+  void onDataPacket(bool isProtocol, uint8_t msgType);
+  void onRotation(uint32_t rotationUs);
+  void onDeviceReply(uint32_t deviceIdx, uint32_t latencyUs);
+  // Time spent in the callback itself, it delays the forwarding of the packet
+  void onCallbackDuration(uint32_t durationUs);
+  // ---------------------------------------
+
+  void onSecondElapsed();
+
+  inline uint32_t getFreePacketsCount() { return freePacketsCount; }
+  inline uint32_t getDataPacketsCount() { return dataPacketsCount; }
+  inline uint32_t getProtocolPacketsCount() { return protocolPacketsCount; }
+  inline uint32_t getFreePacketsPerSecond() { return freePacketsPerSecond; }
+  inline uint32_t getDataPacketsPerSecond() { return dataPacketsPerSecond; }
+  // Percent of the packets of the last second that carried data
+  inline uint32_t getUtilisation() { return utilisation; }
+
+  inline uint32_t getCallbacksCount() { return callbacksCount; }
+  inline uint32_t getMaxCallbackUs() { return maxCallbackUs; }
+  // Worst callback duration of the last second
+  inline uint32_t getMaxCallbackUsPerSecond() { return maxCallbackUsPerSecond; }
+
+  inline uint32_t getMsgTypeCount(uint32_t slot) { return msgTypeCounts[slot]; }
+  inline uint32_t getRotationBucketCount(uint32_t bucket) { return rotationHistogram[bucket]; }
+  // Upper bound of the bucket, 0 for the last one that has none
+  inline uint32_t getRotationBucketLimitUs(uint32_t bucket) { return bucket < RotationBuckets - 1 ? (64u << bucket) : 0; }
+
+  struct DeviceLatency
+  {
+    uint32_t samplesCount;
+    uint32_t lastUs;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint32_t totalUs;
+
+    inline uint32_t getAvgUs() { return samplesCount > 0 ? totalUs / samplesCount : 0; }
+  };
+  inline const DeviceLatency &getDeviceLatency(uint32_t deviceIdx) { return deviceLatencies[deviceIdx]; }
+
+  // Cost of the last storyboard upload, on the ring
+  struct UploadReport
+  {
+    bool isRunning;
+    bool isCompleted;
+    uint32_t devicesCount;
+    // Of the devices uploaded
+    uint32_t timelinesCount;
+    uint32_t packetsCount;
+    uint32_t bytesCount;
+    uint32_t entriesCount;
+    uint32_t rotationsCount;
+    uint32_t startTimeUs;
+    uint32_t durationUs;
+  };
+  void beginUpload(uint32_t nowUs);
+  void onUploadPacket(uint32_t bytes, uint32_t entries);
+  void onUploadDeviceCompleted(uint32_t timelinesCount);
+  void endUpload(uint32_t nowUs, bool isCompleted);
+  inline bool getIsUploadRunning() { return upload.isRunning; }
+  inline const UploadReport &getUploadReport() { return upload; }
+  // Set when an upload ends, cleared by the call
+  bool tryTakeUploadEnded();
+
+private:
+  uint32_t freePacketsCount;
+  uint32_t dataPacketsCount;
+  uint32_t protocolPacketsCount;
+
+  uint32_t freePacketsAtLastSecond;
+  uint32_t dataPacketsAtLastSecond;
+  uint32_t freePacketsPerSecond;
+  uint32_t dataPacketsPerSecond;
+  uint32_t utilisation;
+
+  uint32_t callbacksCount;
+  uint32_t maxCallbackUs;
+  uint32_t maxCallbackUsCurrSecond;
+  uint32_t maxCallbackUsPerSecond;
+
+  uint32_t msgTypeCounts[MsgTypeSlots];
+  uint32_t rotationHistogram[RotationBuckets];
+  DeviceLatency deviceLatencies[MaxDevices];
+
+  UploadReport upload;
+  bool uploadEnded;
+};
+
+#endif
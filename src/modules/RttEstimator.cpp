@@ -0,0 +1,85 @@
+#include "RttEstimator.h"
+
+RttEstimator::RttEstimator()
+{
+  reset();
+}
+
+void RttEstimator::reset()
+{
+  smoothedRttUs8 = 0;
+  rttVarianceUs4 = 0;
+  rttSamplesCount = 0;
+  smoothedRotationUs8 = 0;
+  minRotationUs = UINT32_MAX;
+  maxRotationUs = 0;
+  rotationSamplesCount = 0;
+}
+
+void RttEstimator::addRttSample(uint32_t rttUs)
+{
+  if (rttSamplesCount == 0)
+  {
+    // First sample: srtt = rtt, rttvar = rtt / 2
+    smoothedRttUs8 = rttUs * 8;
+    rttVarianceUs4 = rttUs * 2;
+  }
+  else
+  {
+    // srtt = 7/8 srtt + 1/8 rtt
+    // rttvar = 3/4 rttvar + 1/4 |srtt - rtt|
+    int32_t error = (int32_t)rttUs - (int32_t)(smoothedRttUs8 / 8);
+    smoothedRttUs8 += error;
+    if (error < 0)
+      error = -error;
+    rttVarianceUs4 += error - (int32_t)(rttVarianceUs4 / 4);
+  }
+  rttSamplesCount += 1;
+}
+
+void RttEstimator::addRotationSample(uint32_t rotationUs)
+{
+  if (rotationSamplesCount == 0)
+  {
+    smoothedRotationUs8 = rotationUs * 8;
+  }
+  else
+  {
+    smoothedRotationUs8 += (int32_t)rotationUs - (int32_t)(smoothedRotationUs8 / 8);
+  }
+  if (rotationUs < minRotationUs)
+    minRotationUs = rotationUs;
+  if (rotationUs > maxRotationUs)
+    maxRotationUs = rotationUs;
+  rotationSamplesCount += 1;
+}
+
+uint32_t RttEstimator::getHopLatencyUs(uint32_t nodesCount)
+{
+  if (nodesCount == 0)
+    return 0;
+  return getRotationUs() / nodesCount;
+}
+
+millisec RttEstimator::getTimeout(uint32_t dataSize)
+{
+  if (!hasRttSamples())
+    return DefaultTimeout;
+
+  // Same rule as TCP: srtt + 4 * rttvar, but never less than two full rotations,
+  // since a reply always needs a free packet to come around before it can be sent
+  uint32_t timeoutUs = getSmoothedRttUs() + 4 * getRttVarianceUs();
+  if (timeoutUs < 2 * getRotationUs())
+    timeoutUs = 2 * getRotationUs();
+  // Bytes take the same time on every hop, the latency of the nodes doesn't grow with them, so
+  // scaling the whole rotation is an upper bound
+  if (rotationSamplesCount > 0)
+    timeoutUs += getMinRotationUs() * dataSize / FreePacketBytes;
+
+  millisec timeout = (millisec)((timeoutUs + 999) / 1000);
+  if (timeout < MinTimeout)
+    timeout = MinTimeout;
+  if (timeout > DefaultTimeout)
+    timeout = DefaultTimeout;
+  return timeout;
+}
@@ -0,0 +1,57 @@
+#ifndef _RTTESTIMATOR_H_
+#define _RTTESTIMATOR_H_
+
+#include <cstdint>
+
+#include "bitLabCore/src/os/types.h"
+
+// Keeps a smoothed estimate of the ring round trip time and of its variance
+// (Jacobson/Karels, like TCP) and derives from it the timeout used by the
+// waiting states of the MasterBoard protocol state machine.
+// All times are in microseconds, except for the timeout that is in millisec.
+class RttEstimator
+{
+public:
+  RttEstimator();
+
+  // Timeout used until the first sample is available, and upper bound for the computed ones
+  const static millisec DefaultTimeout = 1000;
+  const static millisec MinTimeout = 10;
+  // The rotation time is measured mostly on the free packet, that is just the ring packet header
+  const static uint32_t FreePacketBytes = 5;
+
+  void reset();
+  // Request/response round trip, measured from the send of a request to the reception of its reply
+  void addRttSample(uint32_t rttUs);
+  // Time between two consecutive packets reaching the master, that is a full ring rotation
+  void addRotationSample(uint32_t rotationUs);
+
+  inline bool hasRttSamples() { return rttSamplesCount > 0; }
+  inline uint32_t getRttSamplesCount() { return rttSamplesCount; }
+  inline uint32_t getSmoothedRttUs() { return smoothedRttUs8 / 8; }
+  inline uint32_t getRttVarianceUs() { return rttVarianceUs4 / 4; }
+
+  inline uint32_t getRotationSamplesCount() { return rotationSamplesCount; }
+  inline uint32_t getRotationUs() { return smoothedRotationUs8 / 8; }
+  inline uint32_t getMinRotationUs() { return minRotationUs; }
+  inline uint32_t getMaxRotationUs() { return maxRotationUs; }
+  // Average latency of a single hop, given the number of nodes in the ring
+  uint32_t getHopLatencyUs(uint32_t nodesCount);
+
+  // dataSize is the size of the packet sent at the start of the wait, that takes longer around the ring
+  // than the free packet
+  millisec getTimeout(uint32_t dataSize = 0);
+
+private:
+  // Smoothed values are kept scaled to avoid losing precision in the integer math
+  uint32_t smoothedRttUs8;
+  uint32_t rttVarianceUs4;
+  uint32_t rttSamplesCount;
+
+  uint32_t smoothedRotationUs8;
+  uint32_t minRotationUs;
+  uint32_t maxRotationUs;
+  uint32_t rotationSamplesCount;
+};
+
+#endif
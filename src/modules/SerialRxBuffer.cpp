@@ -0,0 +1,43 @@
+#include "SerialRxBuffer.h"
+
+SerialRxBuffer::SerialRxBuffer() : head(0),
+                                   tail(0),
+                                   droppedCount(0),
+                                   maxUsedBytes(0)
+{
+}
+
+bool SerialRxBuffer::put(char c)
+{
+  uint32_t currHead = head;
+  uint32_t used = currHead - tail;
+  if (used == Capacity)
+  {
+    droppedCount += 1;
+    return false;
+  }
+
+  buffer[currHead & Mask] = c;
+  // The char must be written before the consumer can see it
+  __DMB();
+  head = currHead + 1;
+
+  if (used + 1 > maxUsedBytes)
+    maxUsedBytes = used + 1;
+  return true;
+}
+
+bool SerialRxBuffer::tryGet(char &c)
+{
+  uint32_t currTail = tail;
+  if (currTail == head)
+    return false;
+
+  // Read the char only after seeing the head that published it
+  __DMB();
+  c = buffer[currTail & Mask];
+  // The space can be reused only after it was read
+  __DMB();
+  tail = currTail + 1;
+  return true;
+}
@@ -0,0 +1,41 @@
+#ifndef _SERIALRXBUFFER_H_
+#define _SERIALRXBUFFER_H_
+
+#include "mbed.h"
+
+// Chars received on the serial port, written by the RX interrupt and read by mainLoop.
+// The UART holds a single char, replaced by the next one after about 87us at 115200 baud,
+// so it must be emptied by the interrupt: mainLoop is often busy for longer than that.
+// Single producer (the interrupt) and single consumer (mainLoop), so no lock is needed,
+// like DeferredQueue. When the ring is full the char is dropped and counted.
+class SerialRxBuffer
+{
+public:
+  SerialRxBuffer();
+
+  const static uint32_t Capacity = 1024; // Must be a power of 2
+
+  // --- Producer ---
+  bool put(char c);
+  // ----------------
+
+  // --- Consumer ---
+  bool tryGet(char &c);
+  // ----------------
+
+  inline uint32_t getDroppedCount() { return droppedCount; }
+  inline uint32_t getMaxUsedBytes() { return maxUsedBytes; }
+
+private:
+  const static uint32_t Mask = Capacity - 1;
+
+  char buffer[Capacity];
+  // Free running counters, the position in buffer is the counter & Mask
+  volatile uint32_t head;
+  volatile uint32_t tail;
+
+  uint32_t droppedCount;
+  uint32_t maxUsedBytes;
+};
+
+#endif
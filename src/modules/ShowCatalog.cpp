@@ -0,0 +1,67 @@
+#include "ShowCatalog.h"
+
+ShowCatalog::ShowCatalog() : count(0),
+                             skippedLinesCount(0)
+{
+}
+
+bool ShowCatalog::load(const char *indexPath)
+{
+  count = 0;
+  skippedLinesCount = 0;
+
+  FILE *file = fopen(indexPath, "r");
+  if (file == NULL)
+    return false;
+
+  char line[MaxNameLength + MaxPathLength + 32];
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    // Empty lines and comments
+    char first = line[0];
+    if (first == '#' || first == '\r' || first == '\n' || first == '\0')
+      continue;
+
+    if (count == MaxShows)
+    {
+      skippedLinesCount += 1;
+      continue;
+    }
+
+    // The widths match MaxNameLength and MaxPathLength
+    Entry &entry = entries[count];
+    unsigned int crc, size;
+    if (sscanf(line, "%15s %39s %x %u", entry.name, entry.path, &crc, &size) != 4)
+    {
+      skippedLinesCount += 1;
+      continue;
+    }
+    entry.crc = crc;
+    entry.size = size;
+    count += 1;
+  }
+  fclose(file);
+  return true;
+}
+
+int32_t ShowCatalog::findByName(const char *name)
+{
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (strcmp(entries[i].name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+bool ShowCatalog::checkFile(const Entry &entry)
+{
+  FILE *file = fopen(entry.path, "r");
+  if (file == NULL)
+    return false;
+
+  fseek(file, 0, SEEK_END);
+  long fileSize = ftell(file);
+  fclose(file);
+  return fileSize == (long)entry.size;
+}
@@ -0,0 +1,47 @@
+#ifndef _SHOWCATALOG_H_
+#define _SHOWCATALOG_H_
+
+#include "mbed.h"
+
+// The shows on the SD card, read from an index file with one line for each show:
+//   <name> <storyboard file> <storyboard crc, hex> <file size in bytes>
+// Empty lines and lines starting with # are skipped.
+// The crc is the one the master computes when the file is loaded (see the load command), it
+// identifies the show on the devices that keep more storyboards, so a show they already have
+// is selected without uploading it again.
+class ShowCatalog
+{
+public:
+  ShowCatalog();
+
+  const static uint32_t MaxShows = 16;
+  const static uint32_t MaxNameLength = 15;
+  const static uint32_t MaxPathLength = 39;
+
+  struct Entry
+  {
+    char name[MaxNameLength + 1];
+    char path[MaxPathLength + 1];
+    uint32_t crc;
+    uint32_t size;
+  };
+
+  // Replaces the entries with the ones in the index file, returns false if it can't be read.
+  // Invalid lines are skipped, so are the lines after MaxShows entries
+  bool load(const char *indexPath);
+  inline uint32_t getCount() { return count; }
+  inline const Entry &getEntry(uint32_t idx) { return entries[idx]; }
+  // -1 if not found
+  int32_t findByName(const char *name);
+  // The file exists and has the size written in the index
+  bool checkFile(const Entry &entry);
+
+  inline uint32_t getSkippedLinesCount() { return skippedLinesCount; }
+
+private:
+  Entry entries[MaxShows];
+  uint32_t count;
+  uint32_t skippedLinesCount;
+};
+
+#endif
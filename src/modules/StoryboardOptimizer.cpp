@@ -0,0 +1,265 @@
+#include "StoryboardOptimizer.h"
+
+#include "Crc32.h"
+
+StoryboardOptimizer::StoryboardOptimizer()
+{
+  report.error = EError::None;
+  report.errorTimelineIdx = 0;
+  report.entriesBefore = 0;
+  report.entriesAfter = 0;
+  report.uploadBytesBefore = 0;
+  report.uploadBytesAfter = 0;
+  for (uint32_t i = 0; i < MaxTimelines; i++)
+  {
+    entriesCounts[i] = 0;
+    timelineCrcs[i] = 0;
+  }
+  storyboardCrc = 0;
+}
+
+bool StoryboardOptimizer::process(Storyboard *storyboard)
+{
+  report.error = EError::None;
+  report.errorTimelineIdx = 0;
+  report.entriesBefore = 0;
+  report.entriesAfter = 0;
+  report.uploadBytesBefore = 0;
+  report.uploadBytesAfter = 0;
+
+  if (!validate(storyboard))
+  {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < storyboard->getTimelinesCount(); i++)
+  {
+    auto t = storyboard->getTimelineByIdx(i);
+    uint32_t countBefore = t->getEntriesCount();
+
+    sortEntries(t);
+    entriesCounts[i] = simplifyEntries(t);
+
+    report.entriesBefore += countBefore;
+    report.entriesAfter += entriesCounts[i];
+    report.uploadBytesBefore += calcUploadBytes(countBefore);
+    report.uploadBytesAfter += calcUploadBytes(entriesCounts[i]);
+  }
+
+  calcCrcs(storyboard);
+  return true;
+}
+
+void StoryboardOptimizer::calcCrcs(Storyboard *storyboard)
+{
+  // One crc at a time, the hardware engine can't interleave them
+  Crc32 crc;
+  for (uint32_t i = 0; i < storyboard->getTimelinesCount(); i++)
+  {
+    auto t = storyboard->getTimelineByIdx(i);
+    crc.begin();
+    for (uint32_t j = 0; j < entriesCounts[i]; j++)
+    {
+      auto entry = t->getEntry(j);
+      crc.updateInt32(entry->time);
+      crc.updateInt32(entry->value);
+      crc.updateInt32(entry->duration);
+    }
+    timelineCrcs[i] = crc.end();
+  }
+
+  crc.begin();
+  crc.updateInt32(storyboard->getDuration());
+  for (uint32_t i = 0; i < storyboard->getTimelinesCount(); i++)
+  {
+    auto t = storyboard->getTimelineByIdx(i);
+    crc.updateInt32(t->getOutputHardwareId());
+    crc.updateInt32(t->getOutputId());
+    crc.updateInt32(timelineCrcs[i]);
+  }
+  storyboardCrc = crc.end();
+}
+
+bool StoryboardOptimizer::validate(Storyboard *storyboard)
+{
+  auto timelinesCount = storyboard->getTimelinesCount();
+  if (timelinesCount > MaxTimelines)
+  {
+    report.error = EError::TooManyTimelines;
+    return false;
+  }
+
+  for (uint32_t i = 0; i < timelinesCount; i++)
+  {
+    auto t = storyboard->getTimelineByIdx(i);
+    report.errorTimelineIdx = i;
+
+    if (t->getOutputId() > MaxOutputId)
+    {
+      report.error = EError::InvalidOutputId;
+      return false;
+    }
+
+    // Count the timelines of the same device, and check that no other drives the same output
+    uint32_t deviceTimelinesCount = 0;
+    for (uint32_t j = 0; j < timelinesCount; j++)
+    {
+      auto other = storyboard->getTimelineByIdx(j);
+      if (other->getOutputHardwareId() != t->getOutputHardwareId())
+        continue;
+
+      deviceTimelinesCount += 1;
+      if (j != i && other->getOutputId() == t->getOutputId())
+      {
+        report.error = EError::DuplicateOutput;
+        return false;
+      }
+    }
+    if (deviceTimelinesCount > MaxTimelinesPerDevice)
+    {
+      report.error = EError::TooManyTimelinesForDevice;
+      return false;
+    }
+
+    if (t->getEntriesCount() > MaxEntriesPerTimeline)
+    {
+      report.error = EError::TooManyEntries;
+      return false;
+    }
+
+    for (uint32_t e = 0; e < t->getEntriesCount(); e++)
+    {
+      auto entry = t->getEntry(e);
+      if (entry->time < 0 || entry->time >= storyboard->getDuration())
+      {
+        report.error = EError::InvalidEntryTime;
+        return false;
+      }
+      if (entry->duration < 0)
+      {
+        report.error = EError::InvalidEntryDuration;
+        return false;
+      }
+    }
+  }
+
+  report.errorTimelineIdx = 0;
+  return true;
+}
+
+void StoryboardOptimizer::sortEntries(Timeline *t)
+{
+  // Insertion sort by time: stable, so entries with the same time keep their order,
+  // and linear on the already sorted timelines that are the common case
+  uint32_t count = t->getEntriesCount();
+  for (uint32_t i = 1; i < count; i++)
+  {
+    auto entry = *t->getEntry(i);
+    uint32_t j = i;
+    while (j > 0 && t->getEntry(j - 1)->time > entry.time)
+    {
+      *t->getEntry(j) = *t->getEntry(j - 1);
+      j -= 1;
+    }
+    *t->getEntry(j) = entry;
+  }
+}
+
+uint8_t StoryboardOptimizer::simplifyEntries(Timeline *t)
+{
+  // An entry starts at its time a fade from the current value to its value, lasting its duration.
+  // The first entry is always kept: when the storyboard loops the value it starts from is
+  // the one left by the last entry, not a known one.
+  uint32_t count = t->getEntriesCount();
+  if (count <= 1)
+    return count;
+
+  uint32_t keptCount = 1;
+  auto last = t->getEntry(0);
+  // Value the last kept entry fades from, known only if the entry before it was completed
+  int32_t lastFromValue = 0;
+  bool lastFromValueKnown = false;
+
+  for (uint32_t i = 1; i < count; i++)
+  {
+    auto entry = t->getEntry(i);
+    bool lastIsCompleted = entry->time >= last->time + last->duration;
+
+    if (lastIsCompleted)
+    {
+      if (entry->value == last->value)
+      {
+        // The output is already at this value, the entry has no effect
+        continue;
+      }
+
+      if (entry->time == last->time + last->duration &&
+          last->duration > 0 &&
+          entry->duration > 0 &&
+          lastFromValueKnown &&
+          (int64_t)(last->value - lastFromValue) * entry->duration == (int64_t)(entry->value - last->value) * last->duration)
+      {
+        // Continues the last fade with the same slope, extend it
+        last->value = entry->value;
+        last->duration += entry->duration;
+        continue;
+      }
+
+      if (entry->time == last->time && last->duration == 0 && entry->duration == 0)
+      {
+        // Both are immediate and at the same time, only the later one is visible
+        *last = *entry;
+        continue;
+      }
+
+      lastFromValue = last->value;
+      lastFromValueKnown = true;
+    }
+    else
+    {
+      // Overlaps the fade in progress, that is interrupted at an intermediate value
+      lastFromValueKnown = false;
+    }
+
+    last = t->getEntry(keptCount);
+    *last = *entry;
+    keptCount += 1;
+  }
+
+  return keptCount;
+}
+
+uint32_t StoryboardOptimizer::calcUploadBytes(uint32_t entriesCount)
+{
+  // Each timeline has 2 bytes in CreateStoryboard, then SetTimelineEntries packets of
+  // a 4 bytes header and 12 bytes per entry
+  uint32_t packetsCount = (entriesCount + EntriesPerPacket - 1) / EntriesPerPacket;
+  if (packetsCount == 0)
+    packetsCount = 1;
+  return 2 + packetsCount * 4 + entriesCount * 12;
+}
+
+const char *StoryboardOptimizer::getErrorDescr(EError error)
+{
+  switch (error)
+  {
+  case EError::None:
+    return "none";
+  case EError::TooManyTimelines:
+    return "too many timelines";
+  case EError::TooManyTimelinesForDevice:
+    return "too many timelines for a device";
+  case EError::DuplicateOutput:
+    return "output used by more timelines";
+  case EError::InvalidOutputId:
+    return "invalid output id";
+  case EError::TooManyEntries:
+    return "too many entries in the timeline";
+  case EError::InvalidEntryTime:
+    return "entry time out of the storyboard duration";
+  case EError::InvalidEntryDuration:
+    return "negative entry duration";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef _STORYBOARDOPTIMIZER_H_
+#define _STORYBOARDOPTIMIZER_H_
+
+#include <cstdint>
+
+#include "bitLabCore/src/storyboard/Storyboard.h"
+
+// Load time pass over a storyboard: validates the limits of the upload protocol,
+// then sorts and simplifies the entries of each timeline in place and computes their crc.
+// The Timeline entries count can't be changed, so the simplified entries are moved
+// to the front and the count to use is kept here, see getEntriesCount.
+class StoryboardOptimizer
+{
+public:
+  StoryboardOptimizer();
+
+  const static uint32_t MaxTimelines = 255;
+  const static uint32_t MaxTimelinesPerDevice = 32;
+  const static uint32_t MaxOutputId = 32;
+  // The entries count of a timeline is a byte, in the CreateStoryboard packet too
+  const static uint32_t MaxEntriesPerTimeline = 255;
+  // Entries sent in a single SetTimelineEntries packet
+  const static uint32_t EntriesPerPacket = 20;
+  // Entries sent in a single SetTimelineSwitchEntries packet, they are 5 bytes instead of 12
+  const static uint32_t SwitchEntriesPerPacket = 48;
+
+  enum EError
+  {
+    None,
+    TooManyTimelines,
+    TooManyTimelinesForDevice,
+    DuplicateOutput,
+    InvalidOutputId,
+    TooManyEntries,
+    InvalidEntryTime,
+    InvalidEntryDuration,
+  };
+
+  struct Report
+  {
+    EError error;
+    // Timeline that caused the error
+    uint32_t errorTimelineIdx;
+    uint32_t entriesBefore;
+    uint32_t entriesAfter;
+    uint32_t uploadBytesBefore;
+    uint32_t uploadBytesAfter;
+  };
+
+  // Returns false if the storyboard is not valid, the report tells why
+  bool process(Storyboard *storyboard);
+  inline const Report &getReport() { return report; }
+  inline uint8_t getEntriesCount(uint32_t timelineIdx) { return entriesCounts[timelineIdx]; }
+  // Crc of the entries sent for the timeline, equal timelines have the same one whatever their output
+  inline uint32_t getTimelineCrc(uint32_t timelineIdx) { return timelineCrcs[timelineIdx]; }
+  // Crc of the whole processed storyboard, from the timeline crcs
+  inline uint32_t getStoryboardCrc() { return storyboardCrc; }
+  static const char *getErrorDescr(EError error);
+
+private:
+  Report report;
+  uint8_t entriesCounts[MaxTimelines];
+  uint32_t timelineCrcs[MaxTimelines];
+  uint32_t storyboardCrc;
+
+  bool validate(Storyboard *storyboard);
+  void sortEntries(Timeline *t);
+  uint8_t simplifyEntries(Timeline *t);
+  static uint32_t calcUploadBytes(uint32_t entriesCount);
+  void calcCrcs(Storyboard *storyboard);
+};
+
+#endif
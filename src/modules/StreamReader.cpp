@@ -0,0 +1,131 @@
+#include "StreamReader.h"
+
+#include "bitLabCore/src/utils.h"
+
+StreamReader::StreamReader() : file(NULL),
+                               duration(0),
+                               entriesCount(0),
+                               nextEntryIdx(0),
+                               loop(0),
+                               head(0),
+                               tail(0),
+                               entriesReadCount(0),
+                               chunksReadCount(0)
+{
+}
+
+bool StreamReader::open(const char *path)
+{
+  close();
+
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return false;
+
+  uint8_t header[HeaderSize];
+  if (fread(header, 1, HeaderSize, f) != HeaderSize ||
+      header[0] != 'B' || header[1] != 'L' || header[2] != 'S' || header[3] != '1')
+  {
+    fclose(f);
+    return false;
+  }
+
+  duration = readInt32(&header[4]);
+  entriesCount = (uint32_t)readInt32(&header[8]);
+  if (duration <= 0)
+  {
+    fclose(f);
+    return false;
+  }
+
+  file = f;
+  nextEntryIdx = 0;
+  loop = 0;
+  head = 0;
+  tail = 0;
+  entriesReadCount = 0;
+  chunksReadCount = 0;
+  return true;
+}
+
+void StreamReader::close()
+{
+  if (file != NULL)
+  {
+    fclose(file);
+    file = NULL;
+  }
+  head = 0;
+  tail = 0;
+}
+
+bool StreamReader::refill()
+{
+  if (file == NULL || entriesCount == 0)
+    return true;
+  if (WindowSize - getAvailable() < ChunkEntries)
+    return true;
+
+  if (nextEntryIdx == entriesCount)
+  {
+    // Start over, the entries read from now on belong to the next loop
+    if (fseek(file, HeaderSize, SEEK_SET) != 0)
+      return false;
+    nextEntryIdx = 0;
+    loop += 1;
+  }
+
+  uint32_t count = Utils::min(ChunkEntries, entriesCount - nextEntryIdx);
+  uint8_t buff[ChunkEntries * EntrySize];
+  if (fread(buff, EntrySize, count, file) != count)
+    return false;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const uint8_t *bytes = &buff[i * EntrySize];
+    Entry &entry = window[head & (WindowSize - 1)];
+    entry.time = readInt32(&bytes[0]);
+    entry.value = readInt32(&bytes[4]);
+    entry.duration = readInt32(&bytes[8]);
+    entry.hardwareId = (uint32_t)readInt32(&bytes[12]);
+    entry.outputId = bytes[16];
+    entry.loop = loop;
+    head += 1;
+  }
+  nextEntryIdx += count;
+  entriesReadCount += count;
+  chunksReadCount += 1;
+  return true;
+}
+
+bool StreamReader::writeHeader(FILE *f, millisec duration, uint32_t entriesCount)
+{
+  uint8_t header[HeaderSize] = {'B', 'L', 'S', '1'};
+  writeInt32(&header[4], duration);
+  writeInt32(&header[8], (int32_t)entriesCount);
+  return fwrite(header, 1, HeaderSize, f) == HeaderSize;
+}
+
+bool StreamReader::writeEntry(FILE *f, const Entry &entry)
+{
+  uint8_t bytes[EntrySize];
+  writeInt32(&bytes[0], entry.time);
+  writeInt32(&bytes[4], entry.value);
+  writeInt32(&bytes[8], entry.duration);
+  writeInt32(&bytes[12], (int32_t)entry.hardwareId);
+  bytes[16] = entry.outputId;
+  return fwrite(bytes, 1, EntrySize, f) == EntrySize;
+}
+
+int32_t StreamReader::readInt32(const uint8_t *bytes)
+{
+  return (int32_t)(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+}
+
+void StreamReader::writeInt32(uint8_t *bytes, int32_t value)
+{
+  bytes[0] = (uint8_t)value;
+  bytes[1] = (uint8_t)(value >> 8);
+  bytes[2] = (uint8_t)(value >> 16);
+  bytes[3] = (uint8_t)(value >> 24);
+}
@@ -0,0 +1,73 @@
+#ifndef _STREAMREADER_H_
+#define _STREAMREADER_H_
+
+#include "mbed.h"
+
+#include "bitLabCore/src/os/types.h"
+
+// Reads a storyboard stream file a window at a time, so the show doesn't have to fit in RAM.
+// The file has all the entries of all the timelines sorted by time:
+//   header: "BLS1", duration (int32), entries count (uint32)
+//   entry:  time (int32), value (int32), duration (int32), output hardwareId (uint32), outputId (uint8)
+// All values little endian, 17 bytes per entry. When the file ends it starts again from the first
+// entry, with the loop number increased, like a storyboard that plays in loop.
+// refill() does the SD reads and is called from mainLoop, one chunk at a time.
+class StreamReader
+{
+public:
+  StreamReader();
+
+  const static uint32_t HeaderSize = 12;
+  const static uint32_t EntrySize = 17;
+  const static uint32_t WindowSize = 128; // Must be a power of 2
+  const static uint32_t ChunkEntries = 32;
+
+  struct Entry
+  {
+    millisec time;
+    int32_t value;
+    millisec duration;
+    uint32_t hardwareId;
+    uint8_t outputId;
+    uint32_t loop;
+  };
+
+  bool open(const char *path);
+  void close();
+  inline bool isOpen() { return file != NULL; }
+  inline millisec getDuration() { return duration; }
+  inline uint32_t getEntriesCount() { return entriesCount; }
+
+  // Reads the next chunk if the window has room for it, returns false on a read error
+  bool refill();
+  inline uint32_t getAvailable() { return head - tail; }
+  inline const Entry &peek() { return window[tail & (WindowSize - 1)]; }
+  inline void pop() { tail += 1; }
+
+  inline uint32_t getEntriesReadCount() { return entriesReadCount; }
+  inline uint32_t getChunksReadCount() { return chunksReadCount; }
+
+  // Used to write a stream file, see the export command
+  static bool writeHeader(FILE *f, millisec duration, uint32_t entriesCount);
+  static bool writeEntry(FILE *f, const Entry &entry);
+
+private:
+  FILE *file;
+  millisec duration;
+  uint32_t entriesCount;
+  // Position of the next entry to read from the file
+  uint32_t nextEntryIdx;
+  uint32_t loop;
+
+  Entry window[WindowSize];
+  uint32_t head;
+  uint32_t tail;
+
+  uint32_t entriesReadCount;
+  uint32_t chunksReadCount;
+
+  static int32_t readInt32(const uint8_t *bytes);
+  static void writeInt32(uint8_t *bytes, int32_t value);
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "TextDisplay.h"
+
+#include <cstdarg>
+
+// Classic 5x7 font for ASCII 0x20-0x7E, one byte per column, bit 0 is the top pixel
+static const uint8_t font5x7[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, // ' '
+    0x00, 0x00, 0x5F, 0x00, 0x00, // !
+    0x00, 0x07, 0x00, 0x07, 0x00, // "
+    0x14, 0x7F, 0x14, 0x7F, 0x14, // #
+    0x24, 0x2A, 0x7F, 0x2A, 0x12, // $
+    0x23, 0x13, 0x08, 0x64, 0x62, // %
+    0x36, 0x49, 0x55, 0x22, 0x50, // &
+    0x00, 0x05, 0x03, 0x00, 0x00, // '
+    0x00, 0x1C, 0x22, 0x41, 0x00, // (
+    0x00, 0x41, 0x22, 0x1C, 0x00, // )
+    0x08, 0x2A, 0x1C, 0x2A, 0x08, // *
+    0x08, 0x08, 0x3E, 0x08, 0x08, // +
+    0x00, 0x50, 0x30, 0x00, 0x00, // ,
+    0x08, 0x08, 0x08, 0x08, 0x08, // -
+    0x00, 0x60, 0x60, 0x00, 0x00, // .
+    0x20, 0x10, 0x08, 0x04, 0x02, // /
+    0x3E, 0x51, 0x49, 0x45, 0x3E, // 0
+    0x00, 0x42, 0x7F, 0x40, 0x00, // 1
+    0x42, 0x61, 0x51, 0x49, 0x46, // 2
+    0x21, 0x41, 0x45, 0x4B, 0x31, // 3
+    0x18, 0x14, 0x12, 0x7F, 0x10, // 4
+    0x27, 0x45, 0x45, 0x45, 0x39, // 5
+    0x3C, 0x4A, 0x49, 0x49, 0x30, // 6
+    0x01, 0x71, 0x09, 0x05, 0x03, // 7
+    0x36, 0x49, 0x49, 0x49, 0x36, // 8
+    0x06, 0x49, 0x49, 0x29, 0x1E, // 9
+    0x00, 0x36, 0x36, 0x00, 0x00, // :
+    0x00, 0x56, 0x36, 0x00, 0x00, // ;
+    0x08, 0x14, 0x22, 0x41, 0x00, // <
+    0x14, 0x14, 0x14, 0x14, 0x14, // =
+    0x00, 0x41, 0x22, 0x14, 0x08, // >
+    0x02, 0x01, 0x51, 0x09, 0x06, // ?
+    0x32, 0x49, 0x79, 0x41, 0x3E, // @
+    0x7E, 0x11, 0x11, 0x11, 0x7E, // A
+    0x7F, 0x49, 0x49, 0x49, 0x36, // B
+    0x3E, 0x41, 0x41, 0x41, 0x22, // C
+    0x7F, 0x41, 0x41, 0x22, 0x1C, // D
+    0x7F, 0x49, 0x49, 0x49, 0x41, // E
+    0x7F, 0x09, 0x09, 0x09, 0x01, // F
+    0x3E, 0x41, 0x49, 0x49, 0x7A, // G
+    0x7F, 0x08, 0x08, 0x08, 0x7F, // H
+    0x00, 0x41, 0x7F, 0x41, 0x00, // I
+    0x20, 0x40, 0x41, 0x3F, 0x01, // J
+    0x7F, 0x08, 0x14, 0x22, 0x41, // K
+    0x7F, 0x40, 0x40, 0x40, 0x40, // L
+    0x7F, 0x02, 0x0C, 0x02, 0x7F, // M
+    0x7F, 0x04, 0x08, 0x10, 0x7F, // N
+    0x3E, 0x41, 0x41, 0x41, 0x3E, // O
+    0x7F, 0x09, 0x09, 0x09, 0x06, // P
+    0x3E, 0x41, 0x51, 0x21, 0x5E, // Q
+    0x7F, 0x09, 0x19, 0x29, 0x46, // R
+    0x46, 0x49, 0x49, 0x49, 0x31, // S
+    0x01, 0x01, 0x7F, 0x01, 0x01, // T
+    0x3F, 0x40, 0x40, 0x40, 0x3F, // U
+    0x1F, 0x20, 0x40, 0x20, 0x1F, // V
+    0x3F, 0x40, 0x38, 0x40, 0x3F, // W
+    0x63, 0x14, 0x08, 0x14, 0x63, // X
+    0x07, 0x08, 0x70, 0x08, 0x07, // Y
+    0x61, 0x51, 0x49, 0x45, 0x43, // Z
+    0x00, 0x7F, 0x41, 0x41, 0x00, // [
+    0x02, 0x04, 0x08, 0x10, 0x20, // '\'
+    0x00, 0x41, 0x41, 0x7F, 0x00, // ]
+    0x04, 0x02, 0x01, 0x02, 0x04, // ^
+    0x40, 0x40, 0x40, 0x40, 0x40, // _
+    0x00, 0x01, 0x02, 0x04, 0x00, // `
+    0x20, 0x54, 0x54, 0x54, 0x78, // a
+    0x7F, 0x48, 0x44, 0x44, 0x38, // b
+    0x38, 0x44, 0x44, 0x44, 0x20, // c
+    0x38, 0x44, 0x44, 0x48, 0x7F, // d
+    0x38, 0x54, 0x54, 0x54, 0x18, // e
+    0x08, 0x7E, 0x09, 0x01, 0x02, // f
+    0x0C, 0x52, 0x52, 0x52, 0x3E, // g
+    0x7F, 0x08, 0x04, 0x04, 0x78, // h
+    0x00, 0x44, 0x7D, 0x40, 0x00, // i
+    0x20, 0x40, 0x44, 0x3D, 0x00, // j
+    0x7F, 0x10, 0x28, 0x44, 0x00, // k
+    0x00, 0x41, 0x7F, 0x40, 0x00, // l
+    0x7C, 0x04, 0x18, 0x04, 0x78, // m
+    0x7C, 0x08, 0x04, 0x04, 0x78, // n
+    0x38, 0x44, 0x44, 0x44, 0x38, // o
+    0x7C, 0x14, 0x14, 0x14, 0x08, // p
+    0x08, 0x14, 0x14, 0x18, 0x7C, // q
+    0x7C, 0x08, 0x04, 0x04, 0x08, // r
+    0x48, 0x54, 0x54, 0x54, 0x20, // s
+    0x04, 0x3F, 0x44, 0x40, 0x20, // t
+    0x3C, 0x40, 0x40, 0x20, 0x7C, // u
+    0x1C, 0x20, 0x40, 0x20, 0x1C, // v
+    0x3C, 0x40, 0x30, 0x40, 0x3C, // w
+    0x44, 0x28, 0x10, 0x28, 0x44, // x
+    0x0C, 0x50, 0x50, 0x50, 0x3C, // y
+    0x44, 0x64, 0x54, 0x4C, 0x44, // z
+    0x00, 0x08, 0x36, 0x41, 0x00, // {
+    0x00, 0x00, 0x7F, 0x00, 0x00, // |
+    0x00, 0x41, 0x36, 0x08, 0x00, // }
+    0x08, 0x04, 0x08, 0x10, 0x08, // ~
+};
+
+const uint8_t SSD1306_ControlCommand = 0x00;
+const uint8_t SSD1306_ControlData = 0x40;
+const uint8_t SSD1306_MemoryMode = 0x20;
+const uint8_t SSD1306_ColumnAddress = 0x21;
+const uint8_t SSD1306_PageAddress = 0x22;
+
+TextDisplay::TextDisplay(I2C &i2c, int address) : i2c(i2c),
+                                                  address(address),
+                                                  cursorColumn(0),
+                                                  cursorRow(0),
+                                                  isTransferring(false),
+                                                  transferRow(0),
+                                                  transferColumn(0),
+                                                  bytesSent(0),
+                                                  bytesSentCount(0),
+                                                  maxBytesPerService(0),
+                                                  flushesCount(0)
+{
+  memset(text, ' ', sizeof(text));
+  memset(frame, ' ', sizeof(frame));
+  // Unknown, so the first flush redraws everything; nothing is sent before it,
+  // the boot screen stays until the first frame is printed
+  memset(shown, '\0', sizeof(shown));
+}
+
+void TextDisplay::init()
+{
+  // Horizontal addressing mode, needed to write a column range of a page
+  const uint8_t commands[] = {SSD1306_MemoryMode, 0x00};
+  sendCommands(commands, sizeof(commands));
+
+  // The grid never writes the columns past Columns * CharWidth, clear them once here
+  // or they keep what was drawn before, like the boot screen
+  const uint8_t firstUnusedColumn = Columns * CharWidth;
+  const uint8_t clearCommands[] = {
+      SSD1306_ColumnAddress, firstUnusedColumn, Width - 1,
+      SSD1306_PageAddress, 0, Rows - 1};
+  sendCommands(clearCommands, sizeof(clearCommands));
+
+  char buff[1 + (Width - Columns * CharWidth) * Rows];
+  buff[0] = SSD1306_ControlData;
+  memset(&buff[1], 0, sizeof(buff) - 1);
+  i2c.write(address, buff, sizeof(buff));
+  bytesSent += sizeof(buff);
+}
+
+void TextDisplay::invalidate()
+{
+  memset(shown, '\0', sizeof(shown));
+  // Restart the scan from the top
+  isTransferring = true;
+  transferRow = 0;
+  transferColumn = 0;
+}
+
+void TextDisplay::clear()
+{
+  memset(text, ' ', sizeof(text));
+  cursorColumn = 0;
+  cursorRow = 0;
+}
+
+void TextDisplay::setTextCursor(int column, int row)
+{
+  cursorColumn = column;
+  cursorRow = row;
+}
+
+void TextDisplay::printf(const char *format, ...)
+{
+  char buff[Columns * Rows + 1];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buff, sizeof(buff), format, args);
+  va_end(args);
+
+  for (char *c = buff; *c != '\0'; c++)
+  {
+    putChar(*c);
+  }
+}
+
+void TextDisplay::putChar(char c)
+{
+  if (c == '\n')
+  {
+    cursorColumn = 0;
+    cursorRow += 1;
+    return;
+  }
+  if (c == '\r')
+  {
+    cursorColumn = 0;
+    return;
+  }
+
+  if (cursorColumn >= Columns)
+  {
+    // Wrap to the next row
+    cursorColumn = 0;
+    cursorRow += 1;
+  }
+  if (cursorRow >= Rows)
+  {
+    // Past the end of the screen, drop
+    return;
+  }
+  text[cursorRow][cursorColumn] = c;
+  cursorColumn += 1;
+}
+
+void TextDisplay::flush()
+{
+  memcpy(frame, text, sizeof(frame));
+  flushesCount += 1;
+
+  // The new frame may differ anywhere, even before the point reached by the transfer in progress
+  isTransferring = true;
+  transferRow = 0;
+  transferColumn = 0;
+}
+
+void TextDisplay::service()
+{
+  if (!isTransferring)
+    return;
+
+  bytesSent = 0;
+  while (transferRow < Rows)
+  {
+    // Find the next changed character of the row
+    int first = transferColumn;
+    while (first < Columns && frame[transferRow][first] == shown[transferRow][first])
+      first += 1;
+
+    if (first == Columns)
+    {
+      transferRow += 1;
+      transferColumn = 0;
+      continue;
+    }
+
+    // Extend the span over the changed characters, but not past a chunk
+    int last = first;
+    while (last + 1 < Columns &&
+           last + 1 < first + ChunkColumns &&
+           frame[transferRow][last + 1] != shown[transferRow][last + 1])
+      last += 1;
+
+    sendSpan(transferRow, first, last);
+    memcpy(&shown[transferRow][first], &frame[transferRow][first], last - first + 1);
+    transferColumn = last + 1;
+    break;
+  }
+
+  if (transferRow == Rows)
+  {
+    isTransferring = false;
+  }
+
+  bytesSentCount += bytesSent;
+  if (bytesSent > maxBytesPerService)
+    maxBytesPerService = bytesSent;
+}
+
+void TextDisplay::sendCommands(const uint8_t *commands, int count)
+{
+  char buff[8];
+  buff[0] = SSD1306_ControlCommand;
+  memcpy(&buff[1], commands, count);
+  i2c.write(address, buff, count + 1);
+  bytesSent += count + 1;
+}
+
+void TextDisplay::sendSpan(int row, int firstColumn, int lastColumn)
+{
+  const uint8_t commands[] = {
+      SSD1306_ColumnAddress, (uint8_t)(firstColumn * CharWidth), (uint8_t)((lastColumn + 1) * CharWidth - 1),
+      SSD1306_PageAddress, (uint8_t)row, (uint8_t)row};
+  sendCommands(commands, sizeof(commands));
+
+  char buff[1 + ChunkColumns * CharWidth];
+  int length = 0;
+  buff[length++] = SSD1306_ControlData;
+  for (int col = firstColumn; col <= lastColumn; col++)
+  {
+    uint8_t c = frame[row][col];
+    if (c < 0x20 || c > 0x7E)
+      c = '?';
+    const uint8_t *glyph = &font5x7[(c - 0x20) * 5];
+    for (int i = 0; i < 5; i++)
+      buff[length++] = glyph[i];
+    // Spacing column
+    buff[length++] = 0;
+  }
+  i2c.write(address, buff, length);
+  bytesSent += length;
+}
@@ -0,0 +1,71 @@
+#ifndef _TEXTDISPLAY_H_
+#define _TEXTDISPLAY_H_
+
+#include "mbed.h"
+
+// Retained mode text layer over an SSD1306 on I2C.
+// Text is printed into a character grid, flush() publishes it as the new frame and
+// service() sends over I2C, a small chunk per call, only the characters that differ
+// from what is on screen. This bounds the time spent on the display by each mainLoop.
+// Each text row is one SSD1306 page (8 pixels), each character is 6 columns wide.
+class TextDisplay
+{
+public:
+  TextDisplay(I2C &i2c, int address = 0x78);
+
+  const static int Columns = 21;
+  const static int Rows = 8;
+  const static int CharWidth = 6;
+  // Pixel columns of the panel, the grid leaves the last Width - Columns * CharWidth ones unused
+  const static int Width = 128;
+  // Max characters sent by a single service() call
+  const static int ChunkColumns = 4;
+
+  // Switches the controller to horizontal addressing and blanks the columns right of the grid.
+  // The rest of the screen is left as it is until the first flush, that redraws it all
+  void init();
+  // Forget what is on screen, so the next flush redraws everything
+  void invalidate();
+
+  void clear();
+  void setTextCursor(int column, int row);
+  void printf(const char *format, ...);
+
+  // Publishes the printed text as the frame to transfer, doesn't block
+  void flush();
+  // Sends the next chunk of the pending frame, call it once per mainLoop
+  void service();
+  inline bool getIsTransferring() { return isTransferring; }
+
+  inline uint32_t getBytesSentCount() { return bytesSentCount; }
+  inline uint32_t getMaxBytesPerService() { return maxBytesPerService; }
+  inline uint32_t getFlushesCount() { return flushesCount; }
+
+private:
+  I2C &i2c;
+  int address;
+
+  // Back buffer, written by printf
+  char text[Rows][Columns];
+  // Front buffer, the last flushed frame that service() is transferring
+  char frame[Rows][Columns];
+  // What is currently on screen, '\0' means unknown
+  char shown[Rows][Columns];
+  int cursorColumn;
+  int cursorRow;
+
+  bool isTransferring;
+  int transferRow;
+  int transferColumn;
+
+  uint32_t bytesSent;
+  uint32_t bytesSentCount;
+  uint32_t maxBytesPerService;
+  uint32_t flushesCount;
+
+  void putChar(char c);
+  void sendCommands(const uint8_t *commands, int count);
+  void sendSpan(int row, int firstColumn, int lastColumn);
+};
+
+#endif
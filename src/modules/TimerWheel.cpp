@@ -0,0 +1,191 @@
+#include "TimerWheel.h"
+
+TimerWheel::Timer::Timer() : next(NULL),
+                             prev(NULL),
+                             expiresAt(0),
+                             period(0),
+                             callback()
+{
+}
+
+TimerWheel::TimerWheel() : now(0),
+                           activeCount(0)
+{
+  for (uint32_t level = 0; level < Levels; level++)
+  {
+    for (uint32_t i = 0; i < SlotsPerLevel; i++)
+    {
+      initList(&slots[level][i]);
+    }
+  }
+  initList(&expired);
+}
+
+void TimerWheel::start(Timer &timer, millisec delay, Callback<void()> callback)
+{
+  arm(timer, delay, 0, callback);
+}
+
+void TimerWheel::startPeriodic(Timer &timer, millisec period, Callback<void()> callback)
+{
+  arm(timer, period, period, callback);
+}
+
+void TimerWheel::arm(Timer &timer, millisec delay, millisec period, Callback<void()> &callback)
+{
+  // The slot of the current millisecond was already processed, the earliest is the next one
+  if (delay < 1)
+    delay = 1;
+
+  __disable_irq();
+  if (isActive(timer))
+  {
+    unlink(&timer);
+  }
+  else
+  {
+    activeCount += 1;
+  }
+  timer.expiresAt = now + delay;
+  timer.period = period;
+  timer.callback = callback;
+  insert(&timer);
+  __enable_irq();
+}
+
+void TimerWheel::stop(Timer &timer)
+{
+  __disable_irq();
+  if (isActive(timer))
+  {
+    unlink(&timer);
+    activeCount -= 1;
+  }
+  __enable_irq();
+}
+
+void TimerWheel::advance(millisec timeDelta)
+{
+  for (millisec i = 0; i < timeDelta; i++)
+  {
+    if (activeCount == 0)
+    {
+      // Nothing to cascade or expire, just move the time
+      __disable_irq();
+      if (activeCount == 0)
+      {
+        now += timeDelta - i;
+        __enable_irq();
+        return;
+      }
+      __enable_irq();
+    }
+    step();
+  }
+}
+
+void TimerWheel::step()
+{
+  __disable_irq();
+  now += 1;
+  uint32_t idx0 = now & SlotMask;
+  if (idx0 == 0)
+  {
+    uint32_t idx1 = (now >> SlotBits) & SlotMask;
+    if (idx1 == 0)
+    {
+      cascade(&slots[2][(now >> (2 * SlotBits)) & SlotMask]);
+    }
+    cascade(&slots[1][idx1]);
+  }
+
+  // Everything in the current level 0 slot expires now
+  Timer *slot = &slots[0][idx0];
+  while (slot->next != slot)
+  {
+    Timer *timer = slot->next;
+    unlink(timer);
+    link(&expired, timer);
+  }
+
+  while (expired.next != &expired)
+  {
+    Timer *timer = expired.next;
+    unlink(timer);
+    if (timer->period > 0)
+    {
+      timer->expiresAt = now + timer->period;
+      insert(timer);
+    }
+    else
+    {
+      activeCount -= 1;
+    }
+    Callback<void()> callback = timer->callback;
+    // The callback can start or stop timers, including this one
+    __enable_irq();
+    if (callback)
+    {
+      callback();
+    }
+    __disable_irq();
+  }
+  __enable_irq();
+}
+
+void TimerWheel::cascade(Timer *slot)
+{
+  while (slot->next != slot)
+  {
+    Timer *timer = slot->next;
+    unlink(timer);
+    insert(timer);
+  }
+}
+
+void TimerWheel::insert(Timer *timer)
+{
+  uint32_t expiresAt = timer->expiresAt;
+  uint32_t delta = expiresAt - now;
+  Timer *slot;
+  if (delta < SlotsPerLevel)
+  {
+    slot = &slots[0][expiresAt & SlotMask];
+  }
+  else if (delta < (1 << (2 * SlotBits)))
+  {
+    slot = &slots[1][(expiresAt >> SlotBits) & SlotMask];
+  }
+  else
+  {
+    if (delta >= MaxDelta)
+    {
+      // Too far: park it in the farthest slot, when cascaded it is placed again with the real expiresAt
+      expiresAt = now + MaxDelta - 1;
+    }
+    slot = &slots[2][(expiresAt >> (2 * SlotBits)) & SlotMask];
+  }
+  link(slot, timer);
+}
+
+void TimerWheel::initList(Timer *sentinel)
+{
+  sentinel->next = sentinel;
+  sentinel->prev = sentinel;
+}
+
+void TimerWheel::link(Timer *sentinel, Timer *timer)
+{
+  timer->prev = sentinel->prev;
+  timer->next = sentinel;
+  sentinel->prev->next = timer;
+  sentinel->prev = timer;
+}
+
+void TimerWheel::unlink(Timer *timer)
+{
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
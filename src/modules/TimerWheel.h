@@ -0,0 +1,67 @@
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include "mbed.h"
+
+#include "bitLabCore/src/os/types.h"
+
+// Hierarchical timing wheel with millisec resolution, advanced by the tick of the module that owns it.
+// Three levels of 64 slots cover about 262 seconds, longer delays are parked in the farthest slot
+// and placed again when it comes around. Each tick only looks at the slot of the current millisecond,
+// the upper levels are cascaded down once every 64 and 4096 ticks, so advancing is O(1) amortized
+// regardless of how many timers are running.
+// Timers are owned by the caller and linked in the slots through their own pointers, nothing is allocated.
+// The callbacks are called from advance(), keep them short (usually they just set a flag for mainLoop).
+class TimerWheel
+{
+public:
+  TimerWheel();
+
+  struct Timer
+  {
+    Timer();
+
+  private:
+    friend class TimerWheel;
+    Timer *next;
+    Timer *prev;
+    uint32_t expiresAt;
+    // When not zero, the timer is armed again each time it expires
+    millisec period;
+    Callback<void()> callback;
+  };
+
+  // (Re)arms the timer to expire after delay millisec; without callback it can only be polled with isActive()
+  void start(Timer &timer, millisec delay, Callback<void()> callback = Callback<void()>());
+  void startPeriodic(Timer &timer, millisec period, Callback<void()> callback);
+  void stop(Timer &timer);
+  inline bool isActive(const Timer &timer) const { return timer.next != NULL; }
+
+  void advance(millisec timeDelta);
+  inline uint32_t getNow() const { return now; }
+  inline uint32_t getActiveCount() const { return activeCount; }
+
+private:
+  const static uint32_t SlotBits = 6;
+  const static uint32_t SlotsPerLevel = 1 << SlotBits;
+  const static uint32_t SlotMask = SlotsPerLevel - 1;
+  const static uint32_t Levels = 3;
+  const static uint32_t MaxDelta = 1 << (SlotBits * Levels);
+
+  // Each slot is the sentinel of a circular list
+  Timer slots[Levels][SlotsPerLevel];
+  // Timers due in the current step, waiting for their callback
+  Timer expired;
+  uint32_t now;
+  uint32_t activeCount;
+
+  void arm(Timer &timer, millisec delay, millisec period, Callback<void()> &callback);
+  void step();
+  void cascade(Timer *slot);
+  void insert(Timer *timer);
+  static void initList(Timer *sentinel);
+  static void link(Timer *sentinel, Timer *timer);
+  static void unlink(Timer *timer);
+};
+
+#endif
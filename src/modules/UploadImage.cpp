@@ -0,0 +1,48 @@
+#include "UploadImage.h"
+
+#include <cstring>
+
+UploadImage::UploadImage()
+{
+  clear();
+}
+
+void UploadImage::clear()
+{
+  bytesCount = 0;
+  packetsCount = 0;
+  overflow = false;
+  for (uint32_t i = 0; i < MaxDevices + MaxRings; i++)
+  {
+    deviceBegin[i] = 0;
+    deviceEnd[i] = 0;
+  }
+  currDeviceIdx = 0;
+}
+
+void UploadImage::beginDevice(uint32_t deviceIdx)
+{
+  currDeviceIdx = deviceIdx;
+  deviceBegin[deviceIdx] = bytesCount;
+  deviceEnd[deviceIdx] = bytesCount;
+}
+
+bool UploadImage::addPacket(const uint8_t *payload, uint8_t size)
+{
+  if (bytesCount + 1 + size > MaxBytes)
+  {
+    overflow = true;
+    return false;
+  }
+
+  data[bytesCount] = size;
+  memcpy(&data[bytesCount + 1], payload, size);
+  bytesCount += 1 + size;
+  packetsCount += 1;
+  return true;
+}
+
+void UploadImage::endDevice()
+{
+  deviceEnd[currDeviceIdx] = bytesCount;
+}
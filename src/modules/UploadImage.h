@@ -0,0 +1,52 @@
+#ifndef _UPLOADIMAGE_H_
+#define _UPLOADIMAGE_H_
+
+#include <cstdint>
+
+// The payloads of all the packets of a storyboard upload, already serialized, grouped by device.
+// Built in mainLoop when the storyboard is loaded, so during the upload the packet callback
+// only copies the next payload into the free packet, without looking at the storyboard.
+// Packets are stored one after the other as [size][payload] in a fixed buffer;
+// they are addressed by the offset of their size byte.
+class UploadImage
+{
+public:
+  UploadImage();
+
+  const static uint32_t MaxBytes = 12 * 1024;
+  const static uint32_t MaxDevices = 20;
+  const static uint32_t MaxRings = 2;
+  // Pseudo device for the packets sent to more devices at once, one for each ring
+  static inline uint32_t getMulticastIdx(uint32_t ringIdx) { return MaxDevices + ringIdx; }
+
+  void clear();
+
+  // --- Building, devices in any order, packets in the order they are sent ---
+  void beginDevice(uint32_t deviceIdx);
+  // Returns false if the buffer is full, the image is then not usable
+  bool addPacket(const uint8_t *payload, uint8_t size);
+  void endDevice();
+  // ----------------------------------------------------------------------------
+
+  inline bool isOverflow() { return overflow; }
+  inline uint32_t getBytesCount() { return bytesCount; }
+  inline uint32_t getPacketsCount() { return packetsCount; }
+
+  // The device has no packets when begin == end
+  inline uint32_t getDeviceBegin(uint32_t deviceIdx) { return deviceBegin[deviceIdx]; }
+  inline uint32_t getDeviceEnd(uint32_t deviceIdx) { return deviceEnd[deviceIdx]; }
+  inline uint8_t getPacketSize(uint32_t offset) { return data[offset]; }
+  inline const uint8_t *getPacketData(uint32_t offset) { return &data[offset + 1]; }
+  inline uint32_t getNextPacketOffset(uint32_t offset) { return offset + 1 + data[offset]; }
+
+private:
+  uint8_t data[MaxBytes];
+  uint32_t bytesCount;
+  uint32_t packetsCount;
+  bool overflow;
+  uint32_t deviceBegin[MaxDevices + MaxRings];
+  uint32_t deviceEnd[MaxDevices + MaxRings];
+  uint32_t currDeviceIdx;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _HOST_PINNAMES_H_
+#define _HOST_PINNAMES_H_
+
+// The nucleo_f401re pins referenced by the firmware
+enum PinName
+{
+  PA_0,
+  PA_1,
+  PA_4,
+  PA_9,
+  PA_10,
+  PA_11,
+  PA_12,
+  PB_0,
+  PB_13,
+  PB_14,
+  PC_0,
+  PC_1,
+  PC_2,
+  PC_3,
+  PC_14,
+  D2,
+  D3,
+  D4,
+  D5,
+  D6,
+  D7,
+  D8,
+  D9,
+  D10,
+  D11,
+  D12,
+  D14,
+  LED2,
+  USBTX,
+  USBRX,
+  PinNamesCount,
+  NC = -1
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _HOST_SSD1306_H_
+#define _HOST_SSD1306_H_
+
+#include <string>
+
+#include "mbed.h"
+
+// Keeps the printed text instead of drawing it. display() writes a full frame on the I2C,
+// like the driver does, so it takes the same bus time.
+class SSD1306OverI2C
+{
+public:
+  SSD1306OverI2C(I2C &i2c, PinName reset, uint8_t address = 0x78) : i2c(i2c), address(address) {}
+
+  void clearDisplay() { text.clear(); }
+  void setTextCursor(int x, int y) {}
+  int printf(const char *format, ...)
+  {
+    char buff[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buff, sizeof(buff), format, args);
+    va_end(args);
+    text += buff;
+    return length;
+  }
+  void display()
+  {
+    // Column and page range, then the 1024 bytes of the frame in 16 bytes writes
+    char buff[1 + 16];
+    memset(buff, 0, sizeof(buff));
+    i2c.write(address, buff, 7);
+    for (int i = 0; i < 1024 / 16; i++)
+      i2c.write(address, buff, sizeof(buff));
+    displayedText = text;
+  }
+
+  // --- Host only ---
+  // The text shown by the last display()
+  inline const std::string &getDisplayedText() { return displayedText; }
+
+private:
+  I2C &i2c;
+  uint8_t address;
+  std::string text;
+  std::string displayedText;
+};
+
+#endif
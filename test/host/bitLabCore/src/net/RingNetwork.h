@@ -0,0 +1,545 @@
+#ifndef _HOST_RINGNETWORK_H_
+#define _HOST_RINGNETWORK_H_
+
+#include <deque>
+
+#include "../os/bitLabCore.h"
+#include "../utils.h"
+
+// Stand-in for the ring network, simulated on host: the master and a list of VirtualNode, with a
+// single packet travelling the ring like on the real one. Each hop lasts the time to send the packet
+// on the UART plus the latency of the node, on the HostClock. The packet callback runs when the
+// packet reaches the master, as a timed interrupt of the HostClock like the RX one on target, so also
+// while the other modules are blocked on their peripherals.
+
+enum class PTxAction
+{
+  Send,
+  SendFreePacket
+};
+
+namespace RingNetworkProtocol
+{
+const uint8_t protocol_msgid_whoareyou = 1;
+const uint8_t protocol_msgid_hello = 2;
+const uint8_t ttl_max = 255;
+const uint8_t broadcast_address = 255;
+} // namespace RingNetworkProtocol
+
+struct RingPacketHeader
+{
+  uint8_t data_size;
+  // 0 for the protocol packets, 1 for the data ones
+  uint8_t control;
+  uint8_t src_address;
+  uint8_t dst_address;
+  uint8_t ttl;
+};
+
+struct RingPacket
+{
+  RingPacketHeader header;
+  uint8_t data[256];
+
+  // The free packet has no data
+  inline bool isFreePacket() { return header.data_size == 0; }
+  inline bool isProtocolPacket() { return !isFreePacket() && header.control == 0; }
+  inline bool isForDstAddress(uint8_t address) { return header.dst_address == address; }
+  // size 0 is any size
+  inline bool isDataPacket(uint8_t address, uint32_t size, uint8_t msgType)
+  {
+    return !isFreePacket() && header.control == 1 && header.dst_address == address &&
+           (size == 0 || header.data_size == size) && data[0] == msgType;
+  }
+
+  inline uint32_t getDataUInt32(uint32_t offset)
+  {
+    return data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | ((uint32_t)data[offset + 3] << 24);
+  }
+  inline int32_t getDataInt32(uint32_t offset) { return (int32_t)getDataUInt32(offset); }
+  inline void setDataUInt32(uint32_t offset, uint32_t value)
+  {
+    for (int i = 0; i < 4; i++)
+      data[offset + i] = (uint8_t)(value >> (i * 8));
+  }
+  inline void setDataInt32(uint32_t offset, int32_t value) { setDataUInt32(offset, (uint32_t)value); }
+
+  // --- Host only ---
+  inline void setFree()
+  {
+    header.data_size = 0;
+    header.control = 0;
+    header.src_address = 0;
+    header.dst_address = 0;
+    header.ttl = 0;
+  }
+};
+
+// A device of the simulated ring: answers the master like the slave firmware does, keeps the
+// storyboard it receives and plays it on the HostClock.
+class VirtualNode
+{
+public:
+  enum EMsgType
+  {
+    SetLed = 1,
+    CreateStoryboard = 2,
+    SetTimelineEntries = 3,
+    GetState = 4,
+    TellState = 5,
+    SyncStoryboardTime = 6,
+    Play = 7,
+    Pause = 8,
+    Stop = 9,
+    SetOutput = 10,
+  };
+
+  struct Entry
+  {
+    millisec time;
+    int32_t value;
+    millisec duration;
+  };
+
+  VirtualNode(uint32_t hardwareId) : hardwareId(hardwareId),
+                                     address(0),
+                                     replyDelayUs(0),
+                                     droppedRequestsCount(0),
+                                     ledState(false),
+                                     isPlaying(false),
+                                     duration(0),
+                                     timeAtPlay(0),
+                                     playStartUs(0),
+                                     invalidPacketsCount(0)
+  {
+    for (uint32_t i = 0; i < 256; i++)
+      receivedCounts[i] = 0;
+  }
+
+  inline uint32_t getHardwareId() { return hardwareId; }
+  inline uint8_t getAddress() { return address; }
+
+  // The replies are sent delayUs after the request, on the first free packet that comes by,
+  // instead of right away in place of the request
+  inline void setReplyDelayUs(uint32_t delayUs) { replyDelayUs = delayUs; }
+  // The held replies go out on the next free packet, whatever their delay
+  void releaseReplies()
+  {
+    for (auto &pending : pendingReplies)
+      pending.dueUs = HostClock::getNowUs();
+  }
+  // The next count requests for the node are lost
+  inline void dropRequests(uint32_t count) { droppedRequestsCount += count; }
+
+  inline uint32_t getReceivedCount(uint8_t msgType) { return receivedCounts[msgType]; }
+  // Packets for the node that don't match the storyboard it has
+  inline uint32_t getInvalidPacketsCount() { return invalidPacketsCount; }
+  inline bool getLed() { return ledState; }
+  inline bool getIsPlaying() { return isPlaying; }
+  inline millisec getDuration() { return duration; }
+  millisec getStoryboardTime()
+  {
+    if (!isPlaying)
+      return timeAtPlay;
+    int64_t time = timeAtPlay + (int64_t)(HostClock::getNowUs() - playStartUs) / 1000;
+    return duration > 0 ? time % duration : time;
+  }
+  inline uint32_t getTimelinesCount() { return timelines.size(); }
+  // The entries received for the output, empty if it has no timeline
+  std::vector<Entry> getEntries(uint8_t outputId)
+  {
+    auto t = findTimeline(outputId);
+    return t != NULL ? t->entries : std::vector<Entry>();
+  }
+  // Value of the output at the current storyboard time, from its entries: each one fades from the
+  // value the output has at its time to its value in its duration
+  int32_t getOutputValue(uint8_t outputId)
+  {
+    auto t = findTimeline(outputId);
+    if (t == NULL)
+      return 0;
+    millisec time = getStoryboardTime();
+    Fade fade = {0, 0, 0, 0};
+    for (auto &entry : t->entries)
+    {
+      if (entry.time > time)
+        break;
+      fade = {fade.valueAt(entry.time), entry.value, entry.time, entry.duration};
+    }
+    return fade.valueAt(time);
+  }
+  // Value set with SetOutput, 0 if none
+  inline uint32_t getSetOutputValue(uint8_t outputId) { return setOutputValues[outputId]; }
+  uint32_t getCrc()
+  {
+    uint32_t crc = crc32Int(duration, 0);
+    for (auto &t : timelines)
+    {
+      crc = crc32Int(t.outputId, crc);
+      crc = crc32Int(t.entries.size(), crc);
+      for (auto &entry : t.entries)
+      {
+        crc = crc32Int(entry.time, crc);
+        crc = crc32Int(entry.value, crc);
+        crc = crc32Int(entry.duration, crc);
+      }
+    }
+    return crc;
+  }
+
+  // Gives the node an empty storyboard of that duration without an upload, so its crc tells it
+  // from the other nodes
+  inline void setDuration(millisec value) { duration = value; }
+
+  // Called by RingNetwork
+  void setAddress(uint8_t value) { address = value; }
+  void onPacket(RingPacket &p)
+  {
+    if (p.isProtocolPacket() && p.data[0] == RingNetworkProtocol::protocol_msgid_whoareyou)
+    {
+      p.header.ttl -= 1;
+      if (p.header.ttl == 0 && !tryDropRequest(p))
+        reply(p, 1 + 4, [this](RingPacket &r) {
+          r.header.control = 0;
+          r.data[0] = RingNetworkProtocol::protocol_msgid_hello;
+          r.setDataUInt32(1, hardwareId);
+        });
+    }
+    else if (!p.isFreePacket() && p.header.control == 1 &&
+             (p.header.dst_address == address || p.header.dst_address == RingNetworkProtocol::broadcast_address))
+    {
+      receivedCounts[p.data[0]] += 1;
+      if (p.header.dst_address == address && tryDropRequest(p))
+        return;
+      onDataPacket(p);
+      // Taken by the node, unless it's a broadcast or a reply took its place
+      if (p.header.dst_address == address)
+        p.setFree();
+    }
+
+    if (p.isFreePacket() && !pendingReplies.empty() && pendingReplies.front().dueUs <= HostClock::getNowUs())
+    {
+      p = pendingReplies.front().packet;
+      pendingReplies.pop_front();
+    }
+  }
+
+private:
+  struct Fade
+  {
+    int32_t from;
+    int32_t to;
+    millisec startTime;
+    millisec duration;
+
+    int32_t valueAt(millisec time)
+    {
+      if (duration <= 0 || time >= startTime + duration)
+        return to;
+      return from + (int32_t)((int64_t)(to - from) * (time - startTime) / duration);
+    }
+  };
+  struct TimelineState
+  {
+    uint8_t outputId;
+    std::vector<Entry> entries;
+  };
+  struct PendingReply
+  {
+    uint64_t dueUs;
+    RingPacket packet;
+  };
+
+  uint32_t hardwareId;
+  uint8_t address;
+  uint32_t replyDelayUs;
+  uint32_t droppedRequestsCount;
+  std::deque<PendingReply> pendingReplies;
+  uint32_t receivedCounts[256];
+
+  bool ledState;
+  bool isPlaying;
+  millisec duration;
+  millisec timeAtPlay;
+  uint64_t playStartUs;
+  std::vector<TimelineState> timelines;
+  std::map<uint8_t, uint32_t> setOutputValues;
+  uint32_t invalidPacketsCount;
+
+  bool tryDropRequest(RingPacket &p)
+  {
+    if (droppedRequestsCount == 0)
+      return false;
+    droppedRequestsCount -= 1;
+    p.setFree();
+    return true;
+  }
+
+  // Replaces the request with the reply filled by fill, or sends it later if it has a delay
+  template <typename F>
+  void reply(RingPacket &p, uint8_t size, F fill)
+  {
+    RingPacket r;
+    r.header.data_size = size;
+    r.header.control = 1;
+    r.header.src_address = address;
+    r.header.dst_address = p.header.src_address;
+    r.header.ttl = RingNetworkProtocol::ttl_max;
+    fill(r);
+    if (replyDelayUs == 0)
+    {
+      p = r;
+    }
+    else
+    {
+      pendingReplies.push_back({HostClock::getNowUs() + replyDelayUs, r});
+      p.setFree();
+    }
+  }
+
+  void onDataPacket(RingPacket &p)
+  {
+    bool isForMe = p.header.dst_address == address;
+    switch (p.data[0])
+    {
+    case EMsgType::SetLed:
+      ledState = p.data[1] != 0;
+      break;
+
+    case EMsgType::CreateStoryboard:
+      duration = p.getDataInt32(2);
+      timeAtPlay = 0;
+      playStartUs = HostClock::getNowUs();
+      timelines.clear();
+      for (uint32_t i = 0; i < p.data[1]; i++)
+      {
+        TimelineState t;
+        t.outputId = p.data[6 + i * 2];
+        t.entries.resize(p.data[6 + i * 2 + 1], {0, 0, 0});
+        timelines.push_back(t);
+      }
+      break;
+
+    case EMsgType::SetTimelineEntries:
+    {
+      auto t = findTimeline(p.data[1]);
+      uint32_t first = p.data[2];
+      uint32_t count = p.data[3];
+      if (t == NULL || first + count > t->entries.size() || p.header.data_size != 4 + count * 12)
+      {
+        invalidPacketsCount += 1;
+        break;
+      }
+      for (uint32_t i = 0; i < count; i++)
+      {
+        auto offset = 4 + i * 12;
+        t->entries[first + i] = {p.getDataInt32(offset), p.getDataInt32(offset + 4), p.getDataInt32(offset + 8)};
+      }
+      break;
+    }
+
+    case EMsgType::GetState:
+      if (isForMe)
+        reply(p, 1 + 4 + 4, [this](RingPacket &r) {
+          r.data[0] = EMsgType::TellState;
+          r.setDataUInt32(1, getCrc());
+          r.setDataInt32(5, getStoryboardTime());
+        });
+      break;
+
+    case EMsgType::SyncStoryboardTime:
+      timeAtPlay = p.getDataInt32(1);
+      playStartUs = HostClock::getNowUs();
+      break;
+
+    case EMsgType::Play:
+      if (!isPlaying)
+      {
+        isPlaying = true;
+        playStartUs = HostClock::getNowUs();
+      }
+      break;
+
+    case EMsgType::Pause:
+      timeAtPlay = getStoryboardTime();
+      isPlaying = false;
+      break;
+
+    case EMsgType::Stop:
+      timeAtPlay = 0;
+      isPlaying = false;
+      break;
+
+    case EMsgType::SetOutput:
+      setOutputValues[p.data[1]] = p.getDataUInt32(2);
+      break;
+    }
+  }
+
+  TimelineState *findTimeline(uint8_t outputId)
+  {
+    for (auto &t : timelines)
+    {
+      if (t.outputId == outputId)
+        return &t;
+    }
+    return NULL;
+  }
+
+  static uint32_t crc32Int(uint32_t value, uint32_t crc)
+  {
+    for (int i = 0; i < 4; i++)
+      crc = Utils::crc32((uint8_t)(value >> (i * 8)), crc);
+    return crc;
+  }
+};
+
+class RingNetwork : public CoreModule
+{
+public:
+  RingNetwork(PinName tx, PinName rx, bool isMaster) : isConnected(true),
+                                                        isAddressAssignedFlag(false),
+                                                        baudRate(115200),
+                                                        nodeLatencyUs(10),
+                                                        position(0),
+                                                        nextArrivalUs(0)
+  {
+    packet.setFree();
+    resetCounters();
+    HostClock::attachInterrupt(this, [this]() { return isConnected && isAddressAssignedFlag ? nextArrivalUs : UINT64_MAX; },
+                               [this]() { arrive(); });
+  }
+  ~RingNetwork() { HostClock::detachInterrupt(this); }
+
+  // --- CoreModule ---
+  const char *getName() { return "RingNetwork"; }
+  // Starts the packet from the master once connected, then it moves along the ring on the HostClock
+  void mainLoop()
+  {
+    if (isConnected && !isAddressAssignedFlag)
+      connect();
+  }
+  // ------------------
+
+  void attachOnPacketReceived(Callback<void(RingPacket *, PTxAction *)> callback) { onPacketReceived = callback; }
+  bool getIsConnected() { return isConnected; }
+  bool isAddressAssigned() { return isAddressAssignedFlag; }
+  uint8_t getAddress() { return MasterAddress; }
+
+  // --- Host only ---
+  const static uint8_t MasterAddress = 1;
+
+  // Appended after the last node, the address is assigned when the ring connects: from 2, in ring order
+  VirtualNode &addNode(uint32_t hardwareId)
+  {
+    nodes.push_back(VirtualNode(hardwareId));
+    return nodes.back();
+  }
+  inline VirtualNode &getNode(uint32_t idx) { return nodes[idx]; }
+  inline uint32_t getNodesCount() { return nodes.size(); }
+  // When disconnected the packet is lost; on connection the addresses are assigned again
+  // and a free packet starts from the master
+  void setConnected(bool value)
+  {
+    isConnected = value;
+    isAddressAssignedFlag = false;
+  }
+  // UART speed of every hop, 8N1
+  inline void setBaudRate(uint32_t value) { baudRate = value; }
+  // Time a node holds the packet before forwarding it, besides receiving it
+  inline void setNodeLatencyUs(uint32_t value) { nodeLatencyUs = value; }
+
+  // Packet arrivals at the master, that is full rotations of the ring
+  inline uint32_t getRotationsCount() { return rotationsCount; }
+  // Packets with data sent by the master, and their data bytes
+  inline uint32_t getSentPacketsCount() { return sentPacketsCount; }
+  inline uint32_t getSentBytesCount() { return sentBytesCount; }
+  // Bytes on the wire of every hop, headers and free packets included
+  inline uint64_t getWireBytesCount() { return wireBytesCount; }
+  void resetCounters()
+  {
+    rotationsCount = 0;
+    sentPacketsCount = 0;
+    sentBytesCount = 0;
+    wireBytesCount = 0;
+  }
+
+private:
+  std::deque<VirtualNode> nodes;
+  Callback<void(RingPacket *, PTxAction *)> onPacketReceived;
+  bool isConnected;
+  bool isAddressAssignedFlag;
+  uint32_t baudRate;
+  uint32_t nodeLatencyUs;
+
+  RingPacket packet;
+  // 0 is the master, then the index of the node + 1
+  uint32_t position;
+  uint64_t nextArrivalUs;
+
+  uint32_t rotationsCount;
+  uint32_t sentPacketsCount;
+  uint32_t sentBytesCount;
+  uint64_t wireBytesCount;
+
+  void connect()
+  {
+    for (uint32_t i = 0; i < nodes.size(); i++)
+      nodes[i].setAddress(MasterAddress + 1 + i);
+    isAddressAssignedFlag = true;
+    packet.setFree();
+    position = 0;
+    nextArrivalUs = HostClock::getNowUs();
+  }
+
+  void arrive()
+  {
+    if (position == 0)
+    {
+      rotationsCount += 1;
+      onMasterPacket();
+    }
+    else
+    {
+      nodes[position - 1].onPacket(packet);
+    }
+
+    // Header, data and checksum, 10 bits each
+    uint32_t bytesCount = sizeof(RingPacketHeader) + packet.header.data_size + 1;
+    wireBytesCount += bytesCount;
+    nextArrivalUs += (uint64_t)bytesCount * 10 * 1000000 / baudRate + nodeLatencyUs;
+    position = (position + 1) % (nodes.size() + 1);
+  }
+
+  void onMasterPacket()
+  {
+    // The WhoAreYou that went around the whole ring expires at the master, that answers itself
+    if (packet.isProtocolPacket() && packet.data[0] == RingNetworkProtocol::protocol_msgid_whoareyou)
+    {
+      packet.header.ttl -= 1;
+      if (packet.header.ttl == 0)
+      {
+        packet.header.data_size = 1 + 4;
+        packet.header.src_address = MasterAddress;
+        packet.header.dst_address = MasterAddress;
+        packet.data[0] = RingNetworkProtocol::protocol_msgid_hello;
+        packet.setDataUInt32(1, 0);
+      }
+    }
+
+    PTxAction action = PTxAction::SendFreePacket;
+    if (onPacketReceived)
+      onPacketReceived(&packet, &action);
+    if (action == PTxAction::SendFreePacket)
+    {
+      packet.setFree();
+    }
+    else
+    {
+      sentPacketsCount += 1;
+      sentBytesCount += packet.header.data_size;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef _HOST_BITLABCORE_H_
+#define _HOST_BITLABCORE_H_
+
+#include <functional>
+#include <vector>
+
+#include "mbed.h"
+#include "types.h"
+
+class bitLabCore;
+
+class CoreModule
+{
+public:
+  virtual ~CoreModule() {}
+
+  virtual const char *getName() = 0;
+  virtual void init(const bitLabCore *core) {}
+  virtual void mainLoop() {}
+  virtual void tick(millisec timeDelta) {}
+};
+
+// Drives the modules on the HostClock, see runFor: the whole firmware runs in virtual time,
+// much faster than real time since nothing waits.
+class bitLabCore
+{
+public:
+  bitLabCore() : hardwareId(0x484F5354),
+                 mainLoopPeriodUs(50),
+                 isStarted(false),
+                 nextTickUs(0)
+  {
+  }
+
+  void init() {}
+  void addModule(CoreModule *module) { modules.push_back(module); }
+  // Like on target it never returns, the tests use runFor and runUntil instead
+  void run()
+  {
+    while (true)
+      runFor(1000000);
+  }
+
+  CoreModule *findModule(const char *name) const
+  {
+    for (auto module : modules)
+    {
+      if (strcmp(module->getName(), name) == 0)
+        return module;
+    }
+    return NULL;
+  }
+  uint32_t getHardwareId() const { return hardwareId; }
+  const char *getClockSourceDescr() const { return "host"; }
+
+  // --- Host only ---
+  void setHardwareId(uint32_t value) { hardwareId = value; }
+  // Virtual time between two mainLoop calls, time spent by the modules in the peripherals adds to it
+  void setMainLoopPeriodUs(uint32_t value) { mainLoopPeriodUs = value; }
+
+  // Runs the modules for the given virtual time: init them on the first call, then call mainLoop
+  // every mainLoopPeriodUs, and tick(1) once per millisecond like the ticker interrupt does
+  void runFor(uint64_t durationUs)
+  {
+    runUntil([]() { return false; }, durationUs);
+  }
+
+  // Like runFor, stops as soon as the condition is true, checked after each mainLoop.
+  // Returns the condition, false if the time ran out.
+  bool runUntil(const std::function<bool()> &condition, uint64_t maxDurationUs)
+  {
+    start();
+    uint64_t endUs = HostClock::getNowUs() + maxDurationUs;
+    while (HostClock::getNowUs() < endUs)
+    {
+      uint64_t loopStartUs = HostClock::getNowUs();
+      for (auto module : modules)
+        module->mainLoop();
+
+      // Whatever the modules spent, the loop takes at least its period
+      if (HostClock::getNowUs() < loopStartUs + mainLoopPeriodUs)
+        HostClock::advanceUs(loopStartUs + mainLoopPeriodUs - HostClock::getNowUs());
+      while (nextTickUs <= HostClock::getNowUs())
+      {
+        for (auto module : modules)
+          module->tick(1);
+        nextTickUs += 1000;
+      }
+
+      if (condition())
+        return true;
+    }
+    return false;
+  }
+
+private:
+  std::vector<CoreModule *> modules;
+  uint32_t hardwareId;
+  uint32_t mainLoopPeriodUs;
+  bool isStarted;
+  uint64_t nextTickUs;
+
+  void start()
+  {
+    if (isStarted)
+      return;
+    isStarted = true;
+    nextTickUs = HostClock::getNowUs() + 1000;
+    for (auto module : modules)
+      module->init(this);
+  }
+};
+
+#endif
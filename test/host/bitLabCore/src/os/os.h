@@ -0,0 +1,19 @@
+#ifndef _HOST_OS_H_
+#define _HOST_OS_H_
+
+#include "mbed.h"
+
+class Os
+{
+public:
+  // Printed on the HostConsole, like on the serial port on target
+  static void debug(const char *format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    HostConsole::get().vprintf(format, args);
+    va_end(args);
+  }
+};
+
+#endif
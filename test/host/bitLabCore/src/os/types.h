@@ -0,0 +1,8 @@
+#ifndef _HOST_TYPES_H_
+#define _HOST_TYPES_H_
+
+#include <cstdint>
+
+typedef int32_t millisec;
+
+#endif
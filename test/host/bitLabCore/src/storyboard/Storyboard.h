@@ -0,0 +1,87 @@
+#ifndef _HOST_STORYBOARD_H_
+#define _HOST_STORYBOARD_H_
+
+#include <vector>
+
+#include "../os/types.h"
+#include "../utils.h"
+
+struct TimelineEntry
+{
+  millisec time;
+  int32_t value;
+  millisec duration;
+};
+
+class Timeline
+{
+public:
+  Timeline() : outputHardwareId(0), outputId(0) {}
+  Timeline(uint32_t outputHardwareId, uint8_t outputId) : outputHardwareId(outputHardwareId), outputId(outputId) {}
+
+  uint32_t getOutputHardwareId() { return outputHardwareId; }
+  uint8_t getOutputId() { return outputId; }
+  uint32_t getEntriesCount() { return entries.size(); }
+  TimelineEntry *getEntry(uint32_t idx) { return &entries[idx]; }
+
+  // --- Host only ---
+  void addEntry(millisec time, int32_t value, millisec duration) { entries.push_back({time, value, duration}); }
+
+private:
+  uint32_t outputHardwareId;
+  uint8_t outputId;
+  std::vector<TimelineEntry> entries;
+};
+
+class Storyboard
+{
+public:
+  Storyboard() : duration(0) {}
+
+  uint32_t getTimelinesCount() { return timelines.size(); }
+  Timeline *getTimelineByIdx(uint32_t idx) { return &timelines[idx]; }
+  millisec getDuration() { return duration; }
+
+  uint32_t calcCrc32(uint32_t crc)
+  {
+    crc = crc32Int(duration, crc);
+    for (auto &t : timelines)
+    {
+      crc = crc32Int(t.getOutputHardwareId(), crc);
+      crc = crc32Int(t.getOutputId(), crc);
+      for (uint32_t i = 0; i < t.getEntriesCount(); i++)
+      {
+        crc = crc32Int(t.getEntry(i)->time, crc);
+        crc = crc32Int(t.getEntry(i)->value, crc);
+        crc = crc32Int(t.getEntry(i)->duration, crc);
+      }
+    }
+    return crc;
+  }
+
+  // --- Host only ---
+  void clear()
+  {
+    duration = 0;
+    timelines.clear();
+  }
+  void setDuration(millisec value) { duration = value; }
+  Timeline *addTimeline(uint32_t outputHardwareId, uint8_t outputId)
+  {
+    timelines.push_back(Timeline(outputHardwareId, outputId));
+    return &timelines.back();
+  }
+
+private:
+  millisec duration;
+  std::vector<Timeline> timelines;
+
+  static uint32_t crc32Int(uint32_t value, uint32_t crc)
+  {
+    for (int i = 0; i < 4; i++)
+      crc = Utils::crc32((uint8_t)(value >> (i * 8)), crc);
+    return crc;
+  }
+};
+
+#endif
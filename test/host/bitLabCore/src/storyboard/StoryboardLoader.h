@@ -0,0 +1,189 @@
+#ifndef _HOST_STORYBOARDLOADER_H_
+#define _HOST_STORYBOARDLOADER_H_
+
+#include <string>
+
+#include "Storyboard.h"
+
+// Reads the storyboard json (see src/test/test1.json) into the storyboard, replacing its content.
+// The keys can be in any order, the unknown ones are skipped. The parse stops at the end of the
+// top level object, so the text doesn't need a terminator; on a syntax error the storyboard is
+// left with what was read up to there.
+class StoryboardLoader
+{
+public:
+  StoryboardLoader(Storyboard *storyboard, const char *json) : storyboard(storyboard), p(json) {}
+
+  void load()
+  {
+    storyboard->clear();
+    parseObject([this](const std::string &key) {
+      if (key == "duration")
+      {
+        double value;
+        if (!parseNumber(value))
+          return false;
+        storyboard->setDuration((millisec)value);
+        return true;
+      }
+      if (key == "timelines")
+        return parseArray([this]() { return parseTimeline(); });
+      return skipValue();
+    });
+  }
+
+private:
+  Storyboard *storyboard;
+  const char *p;
+
+  bool parseTimeline()
+  {
+    double outputHardwareId = 0;
+    double outputId = 0;
+    std::vector<TimelineEntry> entries;
+    bool isOk = parseObject([&](const std::string &key) {
+      if (key == "outputHardwareId")
+        return parseNumber(outputHardwareId);
+      if (key == "outputId")
+        return parseNumber(outputId);
+      if (key == "entries")
+      {
+        return parseArray([&]() {
+          TimelineEntry entry = {0, 0, 0};
+          double value;
+          bool isEntryOk = parseObject([&](const std::string &entryKey) {
+            if (!(entryKey == "time" || entryKey == "value" || entryKey == "duration"))
+              return skipValue();
+            if (!parseNumber(value))
+              return false;
+            if (entryKey == "time")
+              entry.time = (millisec)value;
+            else if (entryKey == "value")
+              entry.value = (int32_t)value;
+            else
+              entry.duration = (millisec)value;
+            return true;
+          });
+          entries.push_back(entry);
+          return isEntryOk;
+        });
+      }
+      return skipValue();
+    });
+
+    auto t = storyboard->addTimeline((uint32_t)outputHardwareId, (uint8_t)outputId);
+    for (auto &entry : entries)
+      t->addEntry(entry.time, entry.value, entry.duration);
+    return isOk;
+  }
+
+  void skipSpaces()
+  {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+      p++;
+  }
+  bool expect(char c)
+  {
+    skipSpaces();
+    if (*p != c)
+      return false;
+    p++;
+    return true;
+  }
+
+  // onKey is called with each key, and must read its value
+  template <typename F>
+  bool parseObject(F onKey)
+  {
+    if (!expect('{'))
+      return false;
+    if (expect('}'))
+      return true;
+    do
+    {
+      std::string key;
+      if (!parseString(key) || !expect(':') || !onKey(key))
+        return false;
+    } while (expect(','));
+    return expect('}');
+  }
+
+  // onItem is called for each item, and must read it
+  template <typename F>
+  bool parseArray(F onItem)
+  {
+    if (!expect('['))
+      return false;
+    if (expect(']'))
+      return true;
+    do
+    {
+      if (!onItem())
+        return false;
+    } while (expect(','));
+    return expect(']');
+  }
+
+  bool parseString(std::string &value)
+  {
+    if (!expect('"'))
+      return false;
+    value.clear();
+    while (*p != '"')
+    {
+      if (*p == '\0')
+        return false;
+      if (*p == '\\' && p[1] != '\0')
+        p++;
+      value += *p++;
+    }
+    p++;
+    return true;
+  }
+
+  bool parseNumber(double &value)
+  {
+    skipSpaces();
+    char *end;
+    value = strtod(p, &end);
+    if (end == p)
+      return false;
+    p = end;
+    return true;
+  }
+
+  bool skipValue()
+  {
+    skipSpaces();
+    std::string text;
+    double number;
+    switch (*p)
+    {
+    case '{':
+      return parseObject([this](const std::string &) { return skipValue(); });
+    case '[':
+      return parseArray([this]() { return skipValue(); });
+    case '"':
+      return parseString(text);
+    case 't':
+      return skipWord("true");
+    case 'f':
+      return skipWord("false");
+    case 'n':
+      return skipWord("null");
+    default:
+      return parseNumber(number);
+    }
+  }
+
+  bool skipWord(const char *word)
+  {
+    auto length = strlen(word);
+    if (strncmp(p, word, length) != 0)
+      return false;
+    p += length;
+    return true;
+  }
+};
+
+#endif
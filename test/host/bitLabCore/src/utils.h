@@ -0,0 +1,83 @@
+#ifndef _HOST_UTILS_H_
+#define _HOST_UTILS_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+class Utils
+{
+public:
+  template <typename A, typename B>
+  static inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+  template <typename A, typename B>
+  static inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+  template <typename A, typename B>
+  static inline typename std::common_type<A, B>::type absDiff(A a, B b) { return a > b ? a - b : b - a; }
+
+  static inline bool bitIsSet(uint32_t value, uint32_t bit) { return ((value >> bit) & 1) != 0; }
+  static inline void nop() {}
+
+  // Crc-32 (IEEE, reflected), one byte at a time: start with 0, pass back the result for the next byte
+  static uint32_t crc32(uint8_t byte, uint32_t crc)
+  {
+    crc = ~crc ^ byte;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    return ~crc;
+  }
+
+  static bool strTryParse(const char *str, uint32_t length, uint32_t &value, uint32_t base = 10)
+  {
+    char buff[16];
+    if (length == 0 || length >= sizeof(buff))
+      return false;
+    memcpy(buff, str, length);
+    buff[length] = '\0';
+    char *end;
+    value = strtoul(buff, &end, base);
+    return *end == '\0';
+  }
+
+  static bool tryBase64Decode(const char *str, uint32_t length, uint8_t *buff, uint32_t buffSize, uint32_t *decodedLength)
+  {
+    uint32_t bits = 0;
+    uint32_t bitsCount = 0;
+    *decodedLength = 0;
+    for (uint32_t i = 0; i < length && str[i] != '='; i++)
+    {
+      int value = base64Value(str[i]);
+      if (value < 0)
+        return false;
+      bits = (bits << 6) | value;
+      bitsCount += 6;
+      if (bitsCount >= 8)
+      {
+        bitsCount -= 8;
+        if (*decodedLength == buffSize)
+          return false;
+        buff[(*decodedLength)++] = (uint8_t)(bits >> bitsCount);
+      }
+    }
+    return true;
+  }
+
+private:
+  static int base64Value(char c)
+  {
+    if (c >= 'A' && c <= 'Z')
+      return c - 'A';
+    if (c >= 'a' && c <= 'z')
+      return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+      return c - '0' + 52;
+    if (c == '+')
+      return 62;
+    if (c == '/')
+      return 63;
+    return -1;
+  }
+};
+
+#endif
@@ -0,0 +1,457 @@
+#ifndef _HOST_MBED_H_
+#define _HOST_MBED_H_
+
+// Stand-in for the parts of mbed used by the firmware, for the native env only.
+// Time is virtual: us_ticker_read returns HostClock, that only the simulation (see bitLabCore::runFor)
+// and the slow peripherals, like I2C, move forward.
+// Interrupts run on the host thread: the RX interrupt of the serial port when the test types on
+// the HostConsole, the edge interrupts when it sets a pin with HostPins, the timed ones, like the RX
+// of the ring, when the clock passes their time (see HostClock). The critical sections are no-ops.
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PinNames.h"
+
+template <typename F>
+class Callback;
+
+template <typename R, typename... A>
+class Callback<R(A...)>
+{
+public:
+  Callback() {}
+  Callback(R (*func)(A...)) : func(func) {}
+  template <typename T>
+  Callback(T *obj, R (T::*method)(A...)) : func([obj, method](A... args) { return (obj->*method)(args...); }) {}
+
+  R operator()(A... args) const { return func(args...); }
+  explicit operator bool() const { return (bool)func; }
+
+private:
+  std::function<R(A...)> func;
+};
+
+template <typename R, typename... A>
+Callback<R(A...)> callback(R (*func)(A...))
+{
+  return Callback<R(A...)>(func);
+}
+
+template <typename T, typename R, typename... A>
+Callback<R(A...)> callback(T *obj, R (T::*method)(A...))
+{
+  return Callback<R(A...)>(obj, method);
+}
+
+// --- Virtual time ---
+
+// The time moves forward only with advanceUs, that stops at the due time of each timed interrupt
+// to run it, also when a module is blocked on a slow peripheral, like on target.
+class HostClock
+{
+public:
+  // Returns the time the interrupt is due next, UINT64_MAX if none
+  typedef std::function<uint64_t()> DueTimeGetter;
+
+  static inline uint64_t getNowUs() { return nowUs(); }
+  static void advanceUs(uint64_t us)
+  {
+    uint64_t endUs = nowUs() + us;
+    // An interrupt doesn't interrupt itself, it runs to the end first
+    if (!isInInterrupt())
+    {
+      isInInterrupt() = true;
+      while (true)
+      {
+        Interrupt *next = NULL;
+        uint64_t nextDueUs = endUs;
+        for (auto &entry : interrupts())
+        {
+          uint64_t dueUs = entry.second.getDueUs();
+          if (dueUs <= nextDueUs)
+          {
+            next = &entry.second;
+            nextDueUs = dueUs;
+          }
+        }
+        if (next == NULL)
+          break;
+        if (nextDueUs > nowUs())
+          nowUs() = nextDueUs;
+        next->handler();
+      }
+      isInInterrupt() = false;
+    }
+    nowUs() = endUs;
+  }
+  // Only between tests, with nothing left running that measured the time before
+  static inline void reset() { nowUs() = 0; }
+
+  static inline void attachInterrupt(const void *owner, DueTimeGetter getDueUs, std::function<void()> handler)
+  {
+    interrupts()[owner] = {getDueUs, handler};
+  }
+  static inline void detachInterrupt(const void *owner) { interrupts().erase(owner); }
+
+private:
+  struct Interrupt
+  {
+    DueTimeGetter getDueUs;
+    std::function<void()> handler;
+  };
+  static inline uint64_t &nowUs()
+  {
+    static uint64_t value = 0;
+    return value;
+  }
+  static inline bool &isInInterrupt()
+  {
+    static bool value = false;
+    return value;
+  }
+  static inline std::map<const void *, Interrupt> &interrupts()
+  {
+    static std::map<const void *, Interrupt> value;
+    return value;
+  }
+};
+
+inline uint32_t us_ticker_read() { return (uint32_t)HostClock::getNowUs(); }
+inline void wait_us(int us) { HostClock::advanceUs(us); }
+inline void wait_ms(int ms) { HostClock::advanceUs((uint64_t)ms * 1000); }
+
+// --- Pins ---
+
+enum PinMode
+{
+  PullNone,
+  PullUp,
+  PullDown,
+};
+
+// Level of each pin: written by DigitalOut, read by DigitalIn and InterruptIn.
+// The tests drive the inputs with set, that runs the edge handlers like the interrupt would.
+// The levels are a flat array, so a pin write stays a store as on target and the benchmarks
+// of the board drivers don't measure the stand-in.
+class HostPins
+{
+public:
+  typedef std::function<void(int level)> EdgeHandler;
+
+  static inline int read(PinName pin) { return pin != NC ? levels()[pin] : 0; }
+  static inline void write(PinName pin, int level)
+  {
+    if (pin != NC)
+      levels()[pin] = level ? 1 : 0;
+  }
+  static inline void set(PinName pin, int level)
+  {
+    int previous = read(pin);
+    write(pin, level);
+    if (previous == read(pin))
+      return;
+    for (auto &entry : handlers())
+    {
+      if (entry.second.pin == pin)
+        entry.second.handler(read(pin));
+    }
+  }
+  static inline void reset()
+  {
+    for (int pin = 0; pin < PinNamesCount; pin++)
+      levels()[pin] = 0;
+  }
+
+  static inline void attachEdge(const void *owner, PinName pin, EdgeHandler handler)
+  {
+    handlers()[owner] = {pin, handler};
+  }
+  static inline void detachEdge(const void *owner) { handlers().erase(owner); }
+
+private:
+  struct Entry
+  {
+    PinName pin;
+    EdgeHandler handler;
+  };
+  static inline int *levels()
+  {
+    static int value[PinNamesCount];
+    return value;
+  }
+  static inline std::map<const void *, Entry> &handlers()
+  {
+    static std::map<const void *, Entry> value;
+    return value;
+  }
+};
+
+class DigitalOut
+{
+public:
+  DigitalOut(PinName pin) : pin(pin), value(0) {}
+  DigitalOut(PinName pin, int value) : pin(pin), value(0) { write(value); }
+
+  void write(int newValue)
+  {
+    value = newValue ? 1 : 0;
+    HostPins::write(pin, value);
+  }
+  int read() { return value; }
+  DigitalOut &operator=(int newValue)
+  {
+    write(newValue);
+    return *this;
+  }
+  operator int() { return read(); }
+
+private:
+  PinName pin;
+  int value;
+};
+
+class DigitalIn
+{
+public:
+  DigitalIn(PinName pin) : pin(pin) {}
+  DigitalIn(PinName pin, PinMode) : pin(pin) {}
+
+  int read() { return HostPins::read(pin); }
+  void mode(PinMode) {}
+  operator int() { return read(); }
+
+private:
+  PinName pin;
+};
+
+class InterruptIn
+{
+public:
+  InterruptIn(PinName pin) : pin(pin)
+  {
+    HostPins::attachEdge(this, pin, [this](int level) {
+      if (level && onRise)
+        onRise();
+      if (!level && onFall)
+        onFall();
+    });
+  }
+  ~InterruptIn() { HostPins::detachEdge(this); }
+
+  void rise(Callback<void()> func) { onRise = func; }
+  void fall(Callback<void()> func) { onFall = func; }
+  int read() { return HostPins::read(pin); }
+  void mode(PinMode) {}
+  operator int() { return read(); }
+
+private:
+  PinName pin;
+  Callback<void()> onRise;
+  Callback<void()> onFall;
+};
+
+// --- I2C ---
+
+// Counts what is written, and takes the virtual time the transfer lasts at the bus frequency:
+// 9 clocks per byte with the ack, the address byte included.
+class I2C
+{
+public:
+  I2C(PinName sda, PinName scl) : hz(100000), isLogEnabled(false) { resetCounters(); }
+
+  void frequency(int newHz) { hz = newHz; }
+  int write(int address, const char *data, int length, bool repeated = false)
+  {
+    writesCount += 1;
+    bytesCount += length;
+    if (isLogEnabled)
+      log.push_back(std::vector<uint8_t>((const uint8_t *)data, (const uint8_t *)data + length));
+    HostClock::advanceUs(getTransferUs(length));
+    return 0;
+  }
+  int read(int address, char *data, int length, bool repeated = false)
+  {
+    memset(data, 0, length);
+    HostClock::advanceUs(getTransferUs(length));
+    return 0;
+  }
+
+  // --- Host only ---
+  inline int getFrequency() { return hz; }
+  inline uint64_t getTransferUs(int length) { return (uint64_t)(length + 1) * 9 * 1000000 / hz; }
+  inline uint32_t getWritesCount() { return writesCount; }
+  inline uint32_t getBytesCount() { return bytesCount; }
+  void resetCounters()
+  {
+    writesCount = 0;
+    bytesCount = 0;
+    log.clear();
+  }
+  // Keeps each write, disabled by default since the displays write for as long as the firmware runs
+  void setLogEnabled(bool value)
+  {
+    isLogEnabled = value;
+    log.clear();
+  }
+  inline const std::vector<std::vector<uint8_t>> &getLog() { return log; }
+
+private:
+  int hz;
+  uint32_t writesCount;
+  uint32_t bytesCount;
+  bool isLogEnabled;
+  std::vector<std::vector<uint8_t>> log;
+};
+
+// --- Serial ---
+
+// The PC side of the USB serial port: collects what the firmware prints and types the commands
+class HostConsole
+{
+public:
+  static HostConsole &get()
+  {
+    static HostConsole console;
+    return console;
+  }
+
+  // Queues the text as received from the PC, the RX handlers run for each char like the interrupt would
+  void type(const char *text)
+  {
+    for (; *text != '\0'; text++)
+    {
+      input.push_back(*text);
+      if (onRx)
+        onRx();
+    }
+  }
+  inline const std::string &getOutput() { return output; }
+  std::string takeOutput()
+  {
+    std::string result;
+    result.swap(output);
+    return result;
+  }
+  // Copies the output to stdout too, to follow a test while it runs
+  inline void setEcho(bool value) { isEchoEnabled = value; }
+  void reset()
+  {
+    input.clear();
+    output.clear();
+    onRx = Callback<void()>();
+  }
+
+  // Used by the serial stand-ins
+  void write(const char *buff, size_t length)
+  {
+    output.append(buff, length);
+    if (isEchoEnabled)
+      fwrite(buff, 1, length, stdout);
+  }
+  int vprintf(const char *format, va_list args)
+  {
+    char buff[512];
+    int length = vsnprintf(buff, sizeof(buff), format, args);
+    if (length > 0)
+      write(buff, length < (int)sizeof(buff) ? length : sizeof(buff) - 1);
+    return length;
+  }
+  inline bool readable() { return !input.empty(); }
+  int read()
+  {
+    if (input.empty())
+      return -1;
+    char c = input.front();
+    input.pop_front();
+    return (uint8_t)c;
+  }
+  inline void attachRx(Callback<void()> func) { onRx = func; }
+
+private:
+  HostConsole() : isEchoEnabled(false) {}
+
+  std::deque<char> input;
+  std::string output;
+  Callback<void()> onRx;
+  bool isEchoEnabled;
+};
+
+class RawSerial
+{
+public:
+  enum IrqType
+  {
+    RxIrq = 0,
+    TxIrq
+  };
+
+  RawSerial(PinName tx, PinName rx, int baud = 9600) {}
+
+  void baud(int) {}
+  int putc(int c)
+  {
+    char ch = c;
+    HostConsole::get().write(&ch, 1);
+    return c;
+  }
+  int puts(const char *str)
+  {
+    HostConsole::get().write(str, strlen(str));
+    return 0;
+  }
+  int printf(const char *format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    int length = HostConsole::get().vprintf(format, args);
+    va_end(args);
+    return length;
+  }
+  int readable() { return HostConsole::get().readable(); }
+  int writeable() { return 1; }
+  int getc() { return HostConsole::get().read(); }
+  void attach(Callback<void()> func, IrqType type = RxIrq)
+  {
+    if (type == RxIrq)
+      HostConsole::get().attachRx(func);
+  }
+};
+
+class Serial : public RawSerial
+{
+public:
+  Serial(PinName tx, PinName rx, int baud = 9600) : RawSerial(tx, rx, baud) {}
+
+  // Like fgets: up to the newline included, or size - 1 chars. The line is already typed
+  // in full on host, there is nothing to wait for.
+  char *gets(char *buff, int size)
+  {
+    int length = 0;
+    while (length < size - 1 && readable())
+    {
+      char c = getc();
+      buff[length++] = c;
+      if (c == '\n')
+        break;
+    }
+    buff[length] = '\0';
+    return length > 0 ? buff : NULL;
+  }
+};
+
+// --- Core ---
+
+inline void __disable_irq() {}
+inline void __enable_irq() {}
+inline void __DMB() {}
+
+#endif
@@ -0,0 +1,244 @@
+#include <unity.h>
+
+#include <chrono>
+#include <cstring>
+
+#include "../../src/modules/CommandParser.h"
+
+static CommandParser *parser;
+
+// The parser before the persistent line buffer, for the benchmark: mainLoop built one on the
+// stack for each command and serial.gets copied the line into it
+namespace baseline
+{
+struct Token
+{
+  uint32_t idxStart;
+  uint32_t length;
+};
+
+class CommandParser
+{
+public:
+  CommandParser() : tokensCount(0) {}
+
+  const static uint32_t lineSize = 256;
+  char line[lineSize];
+
+  bool tryParse()
+  {
+    line[lineSize - 1] = '\0';
+    char *ptrCurr = line;
+    tokensCount = 0;
+    while (true)
+    {
+      char *ptrSeparator = ptrCurr;
+      while (*ptrSeparator != '\0' && *ptrSeparator != '\n' && *ptrSeparator != ' ')
+        ptrSeparator += 1;
+      if (ptrSeparator > ptrCurr)
+      {
+        if (tokensCount == tokensSize)
+          return false;
+        tokens[tokensCount].idxStart = ptrCurr - line;
+        tokens[tokensCount].length = ptrSeparator - ptrCurr;
+        tokensCount += 1;
+      }
+      ptrCurr = ptrSeparator;
+      bool isSpace = (*ptrSeparator == ' ');
+      *ptrSeparator = '\0';
+      if (!isSpace)
+        break;
+      ptrCurr += 1;
+    }
+    return tokensCount > 0;
+  }
+  bool isCommand(const char *cmd)
+  {
+    if (tokensCount < 1)
+      return false;
+    return strncmp(cmd, &line[tokens[0].idxStart], tokens[0].length) == 0;
+  }
+
+private:
+  const static uint32_t tokensSize = 128;
+  Token tokens[tokensSize];
+  uint32_t tokensCount;
+};
+} // namespace baseline
+
+// Feeds the line, returns what the last feed returned
+static bool feedLine(const char *line)
+{
+  bool isComplete = false;
+  for (const char *c = line; *c != '\0'; c++)
+  {
+    isComplete = parser->feed(*c);
+  }
+  return isComplete;
+}
+
+void setUp()
+{
+  parser = new CommandParser();
+}
+
+void tearDown()
+{
+  delete parser;
+}
+
+void test_line_is_complete_at_newline()
+{
+  TEST_ASSERT_FALSE(feedLine("state"));
+  TEST_ASSERT_FALSE(feedLine("\r"));
+  TEST_ASSERT_TRUE(feedLine("\n"));
+  TEST_ASSERT_TRUE(parser->tryParse());
+  TEST_ASSERT_TRUE(parser->isCommand("state"));
+  TEST_ASSERT_TRUE(parser->argsCountIs(0));
+}
+
+void test_tokens()
+{
+  TEST_ASSERT_TRUE(feedLine("  setled  12 ff \n"));
+  TEST_ASSERT_TRUE(parser->tryParse());
+  TEST_ASSERT_EQUAL_UINT32(3, parser->getTokensCount());
+  TEST_ASSERT_TRUE(parser->isCommand("setled"));
+  TEST_ASSERT_FALSE(parser->isCommand("set"));
+  TEST_ASSERT_EQUAL_STRING("12", parser->getTokenString(1));
+  TEST_ASSERT_EQUAL_STRING("ff", parser->getTokenString(2));
+  TEST_ASSERT_EQUAL_UINT32(2, parser->getTokenLength(2));
+  TEST_ASSERT_NULL(parser->getTokenString(3));
+}
+
+void test_quoted_token()
+{
+  TEST_ASSERT_TRUE(feedLine("run \"/sd/my script.txt\" x\n"));
+  TEST_ASSERT_TRUE(parser->tryParse());
+  TEST_ASSERT_EQUAL_UINT32(3, parser->getTokensCount());
+  TEST_ASSERT_EQUAL_STRING("/sd/my script.txt", parser->getTokenString(1));
+  TEST_ASSERT_TRUE(parser->tokenIs(2, "x"));
+}
+
+void test_missing_closing_quote()
+{
+  TEST_ASSERT_TRUE(feedLine("run \"/sd/a\n"));
+  TEST_ASSERT_FALSE(parser->tryParse());
+}
+
+void test_empty_line()
+{
+  TEST_ASSERT_TRUE(feedLine("   \n"));
+  TEST_ASSERT_FALSE(parser->tryParse());
+}
+
+void test_too_many_tokens()
+{
+  TEST_ASSERT_TRUE(feedLine("a b c d e f g h i\n"));
+  TEST_ASSERT_FALSE(parser->tryParse());
+}
+
+void test_overflow_discards_the_line()
+{
+  for (uint32_t i = 0; i < CommandParser::lineSize + 10; i++)
+  {
+    TEST_ASSERT_FALSE(parser->feed('a'));
+  }
+  TEST_ASSERT_TRUE(parser->feed('\n'));
+  TEST_ASSERT_FALSE(parser->tryParse());
+
+  // The next line is parsed normally after the reset
+  parser->reset();
+  TEST_ASSERT_TRUE(feedLine("state\n"));
+  TEST_ASSERT_TRUE(parser->tryParse());
+  TEST_ASSERT_TRUE(parser->isCommand("state"));
+}
+
+void test_reset_between_lines()
+{
+  TEST_ASSERT_TRUE(feedLine("first 1\n"));
+  TEST_ASSERT_TRUE(parser->tryParse());
+  parser->reset();
+  TEST_ASSERT_TRUE(feedLine("second\n"));
+  TEST_ASSERT_TRUE(parser->tryParse());
+  TEST_ASSERT_TRUE(parser->isCommand("second"));
+  TEST_ASSERT_TRUE(parser->argsCountIs(0));
+}
+
+// serial.gets read the line char by char from the UART, the copy here is the best case for it
+static bool parseWithBaseline(const char *line)
+{
+  baseline::CommandParser cp;
+  strncpy(cp.line, line, cp.lineSize);
+  return cp.tryParse() && cp.isCommand("upload");
+}
+
+static bool parseWithParser(const char *line)
+{
+  feedLine(line);
+  bool isUpload = parser->tryParse() && parser->isCommand("upload");
+  parser->reset();
+  return isUpload;
+}
+
+void test_benchmark_against_the_baseline_parser()
+{
+  // Short commands, and a long one like the chunks of the file upload
+  static const char *lines[] = {
+      "state\n",
+      "setOutput 1001 4 2000\n",
+      "upload\n",
+      "run \"/sd/script.txt\"\n",
+      "writeFileChunk 0 QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejAxMjM0NTY3ODk=\n",
+  };
+  const uint32_t linesCount = sizeof(lines) / sizeof(lines[0]);
+  const uint32_t roundsCount = 200000;
+
+  uint32_t bytesCount = 0;
+  for (auto line : lines)
+    bytesCount += strlen(line);
+
+  uint32_t matches[2] = {0, 0};
+  int64_t wallNs[2];
+  for (int p = 0; p < 2; p++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < roundsCount; i++)
+    {
+      auto line = lines[i % linesCount];
+      matches[p] += p == 0 ? parseWithBaseline(line) : parseWithParser(line);
+    }
+    wallNs[p] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+  TEST_ASSERT_EQUAL_UINT32(roundsCount / linesCount, matches[0]);
+  TEST_ASSERT_EQUAL_UINT32(matches[0], matches[1]);
+
+  // The baseline one was on the stack of mainLoop for each command, the parser is a member
+  // of MasterBoard fed from SerialRxBuffer, the stack only has the locals of feed and tryParse
+  TEST_ASSERT_TRUE(sizeof(CommandParser) < sizeof(baseline::CommandParser) / 3);
+
+  uint64_t bytesPerRound = bytesCount / linesCount;
+  char message[200];
+  snprintf(message, sizeof(message),
+           "{\"bench\":\"parser\",\"baselineNsPerLine\":%lld,\"nsPerLine\":%lld,"
+           "\"baselineMBps\":%llu,\"MBps\":%llu,\"baselineBytes\":%u,\"bytes\":%u}",
+           (long long)(wallNs[0] / roundsCount), (long long)(wallNs[1] / roundsCount),
+           (unsigned long long)(bytesPerRound * roundsCount * 1000 / wallNs[0]),
+           (unsigned long long)(bytesPerRound * roundsCount * 1000 / wallNs[1]),
+           (uint32_t)sizeof(baseline::CommandParser), (uint32_t)sizeof(CommandParser));
+  TEST_MESSAGE(message);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_line_is_complete_at_newline);
+  RUN_TEST(test_tokens);
+  RUN_TEST(test_quoted_token);
+  RUN_TEST(test_missing_closing_quote);
+  RUN_TEST(test_empty_line);
+  RUN_TEST(test_too_many_tokens);
+  RUN_TEST(test_overflow_discards_the_line);
+  RUN_TEST(test_reset_between_lines);
+  RUN_TEST(test_benchmark_against_the_baseline_parser);
+  return UNITY_END();
+}
@@ -0,0 +1,162 @@
+#include <unity.h>
+
+#include "../../src/modules/Crc32.h"
+
+// Emulation of the STM32F4 CRC peripheral: poly 0x04C11DB7, msb first, one word per write to DR
+static uint32_t emulatedCrcValue = 0xFFFFFFFF;
+
+struct EmulatedCrcData
+{
+  EmulatedCrcData &operator=(uint32_t word)
+  {
+    emulatedCrcValue ^= word;
+    for (int i = 0; i < 32; i++)
+    {
+      emulatedCrcValue = (emulatedCrcValue & 0x80000000) ? (emulatedCrcValue << 1) ^ 0x04C11DB7 : (emulatedCrcValue << 1);
+    }
+    return *this;
+  }
+  operator uint32_t() const { return emulatedCrcValue; }
+};
+
+struct EmulatedCrcControl
+{
+  EmulatedCrcControl &operator=(uint32_t value)
+  {
+    if (value & 1)
+      emulatedCrcValue = 0xFFFFFFFF;
+    return *this;
+  }
+};
+
+struct EmulatedCrc
+{
+  EmulatedCrcData DR;
+  EmulatedCrcControl CR;
+};
+
+struct EmulatedRcc
+{
+  uint32_t AHB1ENR;
+};
+
+static EmulatedCrc emulatedCrc;
+static EmulatedRcc emulatedRcc;
+#define CRC (&emulatedCrc)
+#define RCC (&emulatedRcc)
+#define CRC_CR_RESET 1u
+#define RCC_AHB1ENR_CRCEN (1u << 12)
+
+static uint32_t __RBIT(uint32_t value)
+{
+  uint32_t result = 0;
+  for (int i = 0; i < 32; i++)
+  {
+    result = (result << 1) | ((value >> i) & 1);
+  }
+  return result;
+}
+
+// The hardware path of Crc32 compiled a second time, under another name, against the emulation above
+#undef _CRC32_H_
+#define TARGET_STM32F4
+#define Crc32 HardwareCrc32
+#include "../../src/modules/Crc32.cpp"
+#undef Crc32
+
+// Bit at a time definition of the zlib crc, the reference for both paths
+static uint32_t referenceCrc(const uint8_t *data, uint32_t length)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (uint32_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+    }
+  }
+  return ~crc;
+}
+
+static uint8_t testData[257];
+
+void setUp()
+{
+  uint32_t seed = 12345;
+  for (uint32_t i = 0; i < sizeof(testData); i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    testData[i] = (uint8_t)(seed >> 16);
+  }
+}
+
+void tearDown()
+{
+}
+
+void test_known_value()
+{
+  const char *check = "123456789";
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, Crc32::calc(check, 9));
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, HardwareCrc32::calc(check, 9));
+}
+
+void test_table_matches_reference()
+{
+  for (uint32_t length = 0; length <= sizeof(testData); length++)
+  {
+    TEST_ASSERT_EQUAL_HEX32(referenceCrc(testData, length), Crc32::calc(testData, length));
+  }
+}
+
+void test_hardware_matches_table()
+{
+  // All the lengths, so every count of bytes left for the table after the words
+  for (uint32_t length = 0; length <= sizeof(testData); length++)
+  {
+    TEST_ASSERT_EQUAL_HEX32(Crc32::calc(testData, length), HardwareCrc32::calc(testData, length));
+  }
+}
+
+void test_split_updates()
+{
+  // Updates that don't end on a word boundary go through the pending bytes
+  uint32_t expected = Crc32::calc(testData, sizeof(testData));
+  for (uint32_t chunk = 1; chunk <= 9; chunk++)
+  {
+    Crc32 crc;
+    HardwareCrc32 hardwareCrc;
+    crc.begin();
+    hardwareCrc.begin();
+    for (uint32_t offset = 0; offset < sizeof(testData); offset += chunk)
+    {
+      uint32_t length = sizeof(testData) - offset < chunk ? sizeof(testData) - offset : chunk;
+      crc.update(&testData[offset], length);
+      hardwareCrc.update(&testData[offset], length);
+    }
+    TEST_ASSERT_EQUAL_HEX32(expected, crc.end());
+    TEST_ASSERT_EQUAL_HEX32(expected, hardwareCrc.end());
+  }
+}
+
+void test_update_int32_is_little_endian()
+{
+  uint8_t bytes[] = {0x78, 0x56, 0x34, 0x12, 0xFF, 0xFF, 0xFF, 0xFF};
+  Crc32 crc;
+  crc.begin();
+  crc.updateInt32(0x12345678);
+  crc.updateInt32(-1);
+  TEST_ASSERT_EQUAL_HEX32(Crc32::calc(bytes, sizeof(bytes)), crc.end());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_known_value);
+  RUN_TEST(test_table_matches_reference);
+  RUN_TEST(test_hardware_matches_table);
+  RUN_TEST(test_split_updates);
+  RUN_TEST(test_update_int32_is_little_endian);
+  return UNITY_END();
+}
@@ -0,0 +1,232 @@
+#include <unity.h>
+
+#include <chrono>
+#include <string>
+
+#include "../../src/modules/MasterBoard.h"
+
+// The firmware of main.cpp on a simulated ring, see test/host: the master and its ring run
+// in virtual time, the tests type the commands and check what the nodes received
+static bitLabCore *core;
+static RingNetwork *ring;
+static MasterBoard *master;
+
+static void start(uint32_t nodesCount)
+{
+  ring = new RingNetwork(PA_11, PA_12, true);
+  for (uint32_t i = 0; i < nodesCount; i++)
+  {
+    ring->addNode(0x1000 + i);
+  }
+  core->addModule(ring);
+  core->addModule(master);
+}
+
+static bool runUntilOutput(const char *text, uint64_t maxDurationUs)
+{
+  return core->runUntil([text]() { return HostConsole::get().getOutput().find(text) != std::string::npos; },
+                        maxDurationUs);
+}
+
+// Types the command and waits for its reply, returns true if it's Ok
+static bool command(const char *line)
+{
+  HostConsole::get().takeOutput();
+  HostConsole::get().type(line);
+  HostConsole::get().type("\n");
+  core->runUntil([]() {
+    auto &output = HostConsole::get().getOutput();
+    return output.find("Ok\n") != std::string::npos || output.find("Error\n") != std::string::npos;
+  },
+                 1000000);
+  return HostConsole::get().getOutput().find("Ok\n") != std::string::npos;
+}
+
+static bool runUntilAllNodesReceived(uint8_t msgType, uint32_t count, uint64_t maxDurationUs)
+{
+  return core->runUntil([msgType, count]() {
+    for (uint32_t i = 0; i < ring->getNodesCount(); i++)
+    {
+      if (ring->getNode(i).getReceivedCount(msgType) < count)
+        return false;
+    }
+    return true;
+  },
+                        maxDurationUs);
+}
+
+void setUp()
+{
+  HostClock::reset();
+  HostPins::reset();
+  HostConsole::get().reset();
+  core = new bitLabCore();
+  master = new MasterBoard();
+  ring = NULL;
+}
+
+void tearDown()
+{
+  delete master;
+  delete ring;
+  delete core;
+}
+
+void test_enumerates_the_nodes()
+{
+  start(5);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed, 5 found", 1000000));
+
+  TEST_ASSERT_TRUE(command("state"));
+  for (uint32_t i = 0; i < 5; i++)
+  {
+    char device[64];
+    snprintf(device, sizeof(device), "addr:%u; hwId:%08X;", ring->getNode(i).getAddress(), ring->getNode(i).getHardwareId());
+    TEST_ASSERT_TRUE(HostConsole::get().getOutput().find(device) != std::string::npos);
+  }
+}
+
+void test_check_reads_the_crc_of_every_node()
+{
+  start(5);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+
+  TEST_ASSERT_TRUE(command("check"));
+  TEST_ASSERT_TRUE(runUntilAllNodesReceived(VirtualNode::GetState, 1, 1000000));
+  // The last reply is still on its way
+  core->runFor(100000);
+
+  TEST_ASSERT_TRUE(command("state"));
+  for (uint32_t i = 0; i < 5; i++)
+  {
+    char device[64];
+    snprintf(device, sizeof(device), "hwId:%08X; crc:%08X;", ring->getNode(i).getHardwareId(), ring->getNode(i).getCrc());
+    TEST_ASSERT_TRUE(HostConsole::get().getOutput().find(device) != std::string::npos);
+  }
+}
+
+void test_retries_a_lost_request()
+{
+  start(5);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+
+  ring->getNode(2).dropRequests(1);
+  TEST_ASSERT_TRUE(command("check"));
+  TEST_ASSERT_TRUE(runUntilAllNodesReceived(VirtualNode::GetState, 1, 5000000));
+  TEST_ASSERT_TRUE(HostConsole::get().getOutput().find("retry 1/3") != std::string::npos);
+  TEST_ASSERT_EQUAL_UINT32(2, ring->getNode(2).getReceivedCount(VirtualNode::GetState));
+  TEST_ASSERT_EQUAL_UINT32(1, ring->getNode(3).getReceivedCount(VirtualNode::GetState));
+}
+
+void test_ignores_the_late_hello_of_a_retried_whoareyou()
+{
+  // Node 2 answers the retry, then the hello of the first WhoAreYou comes while the master
+  // waits for node 3, that takes its time so the ring is free
+  start(10);
+  ring->getNode(2).setReplyDelayUs(1000000);
+  ring->getNode(3).setReplyDelayUs(5000);
+  TEST_ASSERT_TRUE(runUntilOutput("retry 1/3", 1000000));
+  ring->getNode(2).setReplyDelayUs(0);
+  TEST_ASSERT_TRUE(runUntilOutput("addr=4 ", 1000000));
+  core->runFor(2000);
+  ring->getNode(2).releaseReplies();
+
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+  TEST_ASSERT_TRUE(HostConsole::get().getOutput().find("Enumeration completed, 10 found") != std::string::npos);
+
+  TEST_ASSERT_TRUE(command("state"));
+  for (uint32_t i = 0; i < 10; i++)
+  {
+    char device[64];
+    snprintf(device, sizeof(device), "addr:%u; hwId:%08X;", ring->getNode(i).getAddress(), ring->getNode(i).getHardwareId());
+    TEST_ASSERT_TRUE(HostConsole::get().getOutput().find(device) != std::string::npos);
+  }
+}
+
+void test_ignores_the_late_reply_of_another_node()
+{
+  start(10);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+  for (uint32_t i = 0; i < 10; i++)
+  {
+    ring->getNode(i).setDuration(1000 * (i + 1));
+  }
+
+  // Node 2 answers the retry, then the reply to the first GetState comes while the master waits
+  // for node 3, that takes its time so the ring is free
+  ring->getNode(2).setReplyDelayUs(1000000);
+  ring->getNode(3).setReplyDelayUs(5000);
+  TEST_ASSERT_TRUE(command("check"));
+  TEST_ASSERT_TRUE(runUntilOutput("retry 1/3", 1000000));
+  ring->getNode(2).setReplyDelayUs(0);
+  TEST_ASSERT_TRUE(core->runUntil([]() { return ring->getNode(3).getReceivedCount(VirtualNode::GetState) == 1; }, 1000000));
+  core->runFor(2000);
+  ring->getNode(2).releaseReplies();
+  TEST_ASSERT_TRUE(runUntilAllNodesReceived(VirtualNode::GetState, 1, 1000000));
+  core->runFor(100000);
+
+  TEST_ASSERT_TRUE(command("state"));
+  for (uint32_t i = 0; i < 10; i++)
+  {
+    char device[64];
+    snprintf(device, sizeof(device), "hwId:%08X; crc:%08X;", ring->getNode(i).getHardwareId(), ring->getNode(i).getCrc());
+    TEST_ASSERT_TRUE(HostConsole::get().getOutput().find(device) != std::string::npos);
+  }
+}
+
+void test_set_output_reaches_the_node()
+{
+  start(3);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+
+  TEST_ASSERT_TRUE(command("setOutput 1001 4 2000"));
+  TEST_ASSERT_TRUE(core->runUntil([]() { return ring->getNode(1).getSetOutputValue(4) == 2000; }, 1000000));
+  TEST_ASSERT_EQUAL_UINT32(0, ring->getNode(0).getReceivedCount(VirtualNode::SetOutput));
+  TEST_ASSERT_EQUAL_UINT32(0, ring->getNode(2).getReceivedCount(VirtualNode::SetOutput));
+}
+
+void test_upload_creates_the_storyboard_on_every_node()
+{
+  start(5);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+
+  TEST_ASSERT_TRUE(command("upload"));
+  TEST_ASSERT_TRUE(runUntilAllNodesReceived(VirtualNode::CreateStoryboard, 1, 1000000));
+}
+
+void test_runs_much_faster_than_real_time()
+{
+  const uint32_t nodesCount = 10;
+  const uint64_t durationUs = 10000000;
+  start(nodesCount);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+  ring->resetCounters();
+
+  auto wallStart = std::chrono::steady_clock::now();
+  core->runFor(durationUs);
+  auto wallEnd = std::chrono::steady_clock::now();
+  int64_t wallUs = std::chrono::duration_cast<std::chrono::microseconds>(wallEnd - wallStart).count();
+
+  // An idle ring at 115200 baud: the free packet is 6 bytes on each of the 11 hops
+  TEST_ASSERT_TRUE(ring->getRotationsCount() > 1000);
+  TEST_ASSERT_TRUE(wallUs < (int64_t)durationUs);
+
+  char message[160];
+  snprintf(message, sizeof(message), "%u nodes, %llu ms simulated in %lld ms, %u rotations",
+           nodesCount, (unsigned long long)(durationUs / 1000), (long long)(wallUs / 1000), ring->getRotationsCount());
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_enumerates_the_nodes);
+  RUN_TEST(test_check_reads_the_crc_of_every_node);
+  RUN_TEST(test_retries_a_lost_request);
+  RUN_TEST(test_ignores_the_late_hello_of_a_retried_whoareyou);
+  RUN_TEST(test_ignores_the_late_reply_of_another_node);
+  RUN_TEST(test_set_output_reaches_the_node);
+  RUN_TEST(test_upload_creates_the_storyboard_on_every_node);
+  RUN_TEST(test_runs_much_faster_than_real_time);
+  return UNITY_END();
+}
@@ -0,0 +1,202 @@
+#include <unity.h>
+
+#include <chrono>
+
+#include "../../src/boards/relay_board.h"
+
+static RelayBoard *board;
+
+void setUp()
+{
+  board = new RelayBoard();
+}
+
+void tearDown()
+{
+  delete board;
+}
+
+void test_events_are_applied_in_time_order()
+{
+  // Scheduled out of order, each one is applied when its time comes
+  TEST_ASSERT_TRUE(board->scheduleOutput(0, 0, 300));
+  TEST_ASSERT_TRUE(board->scheduleOutput(0, 1, 100));
+  TEST_ASSERT_TRUE(board->scheduleOutput(1, 1, 200));
+  TEST_ASSERT_EQUAL_INT(3, board->getScheduledOutputsCount());
+
+  board->onTick(99);
+  TEST_ASSERT_EQUAL_INT(3, board->getScheduledOutputsCount());
+  TEST_ASSERT_EQUAL_INT(0, board->getOutput(0));
+  TEST_ASSERT_EQUAL_INT(0, board->getOutput(1));
+  board->onTick(150);
+  TEST_ASSERT_EQUAL_INT(2, board->getScheduledOutputsCount());
+  TEST_ASSERT_EQUAL_INT(1, board->getOutput(0));
+  TEST_ASSERT_EQUAL_INT(0, board->getOutput(1));
+  board->onTick(200);
+  TEST_ASSERT_EQUAL_INT(1, board->getScheduledOutputsCount());
+  TEST_ASSERT_EQUAL_INT(1, board->getOutput(0));
+  TEST_ASSERT_EQUAL_INT(1, board->getOutput(1));
+  board->onTick(1000);
+  TEST_ASSERT_EQUAL_INT(0, board->getScheduledOutputsCount());
+  TEST_ASSERT_EQUAL_INT(0, board->getOutput(0));
+  TEST_ASSERT_EQUAL_INT(1, board->getOutput(1));
+}
+
+void test_same_time_keeps_scheduling_order()
+{
+  // Many events at the same time are applied in the order they were scheduled,
+  // so each output ends with the value scheduled last for it
+  const int eventsCount = 100;
+  for (int i = 0; i < eventsCount; i++)
+  {
+    TEST_ASSERT_TRUE(board->scheduleOutput(i % 32, (i / 32) % 2, 50));
+  }
+  board->onTick(49);
+  TEST_ASSERT_EQUAL_INT(eventsCount, board->getScheduledOutputsCount());
+  board->onTick(50);
+  TEST_ASSERT_EQUAL_INT(0, board->getScheduledOutputsCount());
+  for (int output = 0; output < 32; output++)
+  {
+    int lastIdx = output + (eventsCount - 1 - output) / 32 * 32;
+    TEST_ASSERT_EQUAL_INT((lastIdx / 32) % 2, board->getOutput(output));
+  }
+
+  // Same for a single output switching back and forth, the last one is 0
+  for (int i = 0; i < 11; i++)
+  {
+    TEST_ASSERT_TRUE(board->scheduleOutput(3, i % 2 == 0, 60));
+  }
+  TEST_ASSERT_TRUE(board->scheduleOutput(3, 0, 60));
+  board->onTick(60);
+  TEST_ASSERT_EQUAL_INT(0, board->getOutput(3));
+}
+
+void test_invalid_output_is_rejected()
+{
+  TEST_ASSERT_FALSE(board->scheduleOutput(-1, 1, 0));
+  TEST_ASSERT_FALSE(board->scheduleOutput(32, 1, 0));
+  TEST_ASSERT_EQUAL_INT(0, board->getScheduledOutputsCount());
+}
+
+void test_full_queue_is_reported()
+{
+  int maxCount = board->getMaxScheduledOutputsCount();
+  for (int i = 0; i < maxCount; i++)
+  {
+    TEST_ASSERT_TRUE(board->scheduleOutput(i % 32, 1, i));
+  }
+  TEST_ASSERT_EQUAL_INT(maxCount, board->getScheduledOutputsCount());
+  TEST_ASSERT_EQUAL_UINT32(0, board->getScheduleOverflowsCount());
+
+  TEST_ASSERT_FALSE(board->scheduleOutput(0, 1, 0));
+  TEST_ASSERT_FALSE(board->scheduleOutput(1, 1, 0));
+  TEST_ASSERT_EQUAL_UINT32(2, board->getScheduleOverflowsCount());
+  TEST_ASSERT_EQUAL_INT(maxCount, board->getScheduledOutputsCount());
+
+  board->clearScheduledOutputs();
+  TEST_ASSERT_EQUAL_INT(0, board->getScheduledOutputsCount());
+  TEST_ASSERT_TRUE(board->scheduleOutput(0, 1, 0));
+}
+
+void test_interleaved_times_drain_in_order()
+{
+  // Pseudo random times, some equal. After each tick only the later events are left, and
+  // each output has the value of its last due event, the latest scheduled among equal times
+  const int eventsCount = 200;
+  millisec times[eventsCount];
+  uint32_t seed = 1;
+  for (int i = 0; i < eventsCount; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    times[i] = (seed >> 16) % 100 * 10;
+    TEST_ASSERT_TRUE(board->scheduleOutput(i % 32, (i / 3) % 2, times[i]));
+  }
+  int lastCount = board->getScheduledOutputsCount();
+  for (millisec time = 0; time <= 1000; time += 10)
+  {
+    board->onTick(time);
+    TEST_ASSERT_TRUE(board->getScheduledOutputsCount() <= lastCount);
+    lastCount = board->getScheduledOutputsCount();
+
+    int dueCount = 0;
+    for (int output = 0; output < 32; output++)
+    {
+      int expected = 0;
+      millisec expectedTime = -1;
+      for (int i = output; i < eventsCount; i += 32)
+      {
+        if (times[i] <= time && times[i] >= expectedTime)
+        {
+          expected = (i / 3) % 2;
+          expectedTime = times[i];
+        }
+      }
+      TEST_ASSERT_EQUAL_INT(expected, board->getOutput(output));
+    }
+    for (int i = 0; i < eventsCount; i++)
+      dueCount += times[i] <= time;
+    TEST_ASSERT_EQUAL_INT(eventsCount - dueCount, lastCount);
+  }
+  TEST_ASSERT_EQUAL_INT(0, lastCount);
+}
+
+void test_tick_cost_with_a_full_queue()
+{
+  // 32 outputs, each with an equal share of a full queue, switching over a one minute storyboard.
+  // Prints the cost of scheduling and of the ticks, one each millisecond, to compare the changes;
+  // the bounds are loose, the target is much slower than the host
+  const int outputsCount = 32;
+  const millisec duration = 60000;
+  int eventsPerOutput = board->getMaxScheduledOutputsCount() / outputsCount;
+
+  auto scheduleStart = std::chrono::steady_clock::now();
+  for (int e = 0; e < eventsPerOutput; e++)
+  {
+    for (int output = 0; output < outputsCount; output++)
+    {
+      // Spread over the storyboard, with the outputs slightly shifted so they don't all switch together
+      millisec time = (millisec)((int64_t)e * duration / eventsPerOutput) + output * 7;
+      TEST_ASSERT_TRUE(board->scheduleOutput(output, e % 2 == 0, time));
+    }
+  }
+  auto scheduleEnd = std::chrono::steady_clock::now();
+  int eventsCount = board->getScheduledOutputsCount();
+  TEST_ASSERT_EQUAL_INT(eventsPerOutput * outputsCount, eventsCount);
+
+  int64_t maxTickNs = 0;
+  int64_t totalTickNs = 0;
+  int ticksCount = 0;
+  for (millisec time = 0; time <= duration + outputsCount * 7; time++)
+  {
+    auto tickStart = std::chrono::steady_clock::now();
+    board->onTick(time);
+    auto tickEnd = std::chrono::steady_clock::now();
+    int64_t tickNs = std::chrono::duration_cast<std::chrono::nanoseconds>(tickEnd - tickStart).count();
+    totalTickNs += tickNs;
+    if (tickNs > maxTickNs)
+      maxTickNs = tickNs;
+    ticksCount += 1;
+  }
+  TEST_ASSERT_EQUAL_INT(0, board->getScheduledOutputsCount());
+
+  int64_t scheduleNs = std::chrono::duration_cast<std::chrono::nanoseconds>(scheduleEnd - scheduleStart).count();
+  char message[160];
+  snprintf(message, sizeof(message), "%d events on %d outputs: schedule avg %lld ns/event, tick avg %lld ns max %lld ns",
+           eventsCount, outputsCount, (long long)(scheduleNs / eventsCount), (long long)(totalTickNs / ticksCount),
+           (long long)maxTickNs);
+  TEST_MESSAGE(message);
+  // A tick pops only the due events, never the whole queue
+  TEST_ASSERT_TRUE(totalTickNs / ticksCount < 100000);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_events_are_applied_in_time_order);
+  RUN_TEST(test_same_time_keeps_scheduling_order);
+  RUN_TEST(test_invalid_output_is_rejected);
+  RUN_TEST(test_full_queue_is_reported);
+  RUN_TEST(test_interleaved_times_drain_in_order);
+  RUN_TEST(test_tick_cost_with_a_full_queue);
+  return UNITY_END();
+}
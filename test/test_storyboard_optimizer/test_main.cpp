@@ -0,0 +1,231 @@
+#include <unity.h>
+
+#include <cstring>
+
+#include "../../src/modules/StoryboardOptimizer.h"
+#include "bitLabCore/src/storyboard/StoryboardLoader.h"
+
+static Storyboard *storyboard;
+static StoryboardOptimizer *optimizer;
+static char json[2048];
+
+// Loads a storyboard with one timeline for each entries list, all on the same device
+static void load(millisec duration, const char *entries0, const char *entries1 = NULL)
+{
+  const char *timelineFormat = "{\"name\": \"t%d\", \"outputHardwareId\": 1000, \"outputId\": %d, \"outputType\": 0, \"entries\": [%s]}";
+  char timeline0[512];
+  char timeline1[512];
+  snprintf(timeline0, sizeof(timeline0), timelineFormat, 0, 1, entries0);
+  if (entries1 != NULL)
+  {
+    snprintf(timeline1, sizeof(timeline1), timelineFormat, 1, 2, entries1);
+    snprintf(json, sizeof(json), "{\"duration\": %d, \"timelines\": [%s, %s]}", duration, timeline0, timeline1);
+  }
+  else
+  {
+    snprintf(json, sizeof(json), "{\"duration\": %d, \"timelines\": [%s]}", duration, timeline0);
+  }
+
+  StoryboardLoader loader(storyboard, json);
+  loader.load();
+}
+
+static void assertEntry(uint32_t timelineIdx, uint32_t entryIdx, millisec time, int32_t value, millisec duration)
+{
+  auto entry = storyboard->getTimelineByIdx(timelineIdx)->getEntry(entryIdx);
+  TEST_ASSERT_EQUAL_INT32(time, entry->time);
+  TEST_ASSERT_EQUAL_INT32(value, entry->value);
+  TEST_ASSERT_EQUAL_INT32(duration, entry->duration);
+}
+
+void setUp()
+{
+  storyboard = new Storyboard();
+  optimizer = new StoryboardOptimizer();
+}
+
+void tearDown()
+{
+  delete optimizer;
+  delete storyboard;
+}
+
+void test_validate_entry_time()
+{
+  load(1000, "{\"time\": 0, \"value\": 1, \"duration\": 0}",
+       "{\"time\": 1000, \"value\": 1, \"duration\": 0}");
+  TEST_ASSERT_FALSE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL(StoryboardOptimizer::EError::InvalidEntryTime, optimizer->getReport().error);
+  TEST_ASSERT_EQUAL_UINT32(1, optimizer->getReport().errorTimelineIdx);
+}
+
+void test_validate_entry_duration()
+{
+  load(1000, "{\"time\": 0, \"value\": 1, \"duration\": -5}");
+  TEST_ASSERT_FALSE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL(StoryboardOptimizer::EError::InvalidEntryDuration, optimizer->getReport().error);
+}
+
+void test_validate_output_id()
+{
+  strcpy(json, "{\"duration\": 1000, \"timelines\": [{\"name\": \"t\", \"outputHardwareId\": 1000, \"outputId\": 33, "
+               "\"outputType\": 0, \"entries\": [{\"time\": 0, \"value\": 1, \"duration\": 0}]}]}");
+  StoryboardLoader loader(storyboard, json);
+  loader.load();
+  TEST_ASSERT_FALSE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL(StoryboardOptimizer::EError::InvalidOutputId, optimizer->getReport().error);
+}
+
+void test_validate_duplicate_output()
+{
+  strcpy(json, "{\"duration\": 1000, \"timelines\": ["
+               "{\"name\": \"a\", \"outputHardwareId\": 1000, \"outputId\": 3, \"outputType\": 0, \"entries\": [{\"time\": 0, \"value\": 1, \"duration\": 0}]}, "
+               "{\"name\": \"b\", \"outputHardwareId\": 1000, \"outputId\": 3, \"outputType\": 0, \"entries\": [{\"time\": 0, \"value\": 2, \"duration\": 0}]}]}");
+  StoryboardLoader loader(storyboard, json);
+  loader.load();
+  TEST_ASSERT_FALSE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL(StoryboardOptimizer::EError::DuplicateOutput, optimizer->getReport().error);
+}
+
+void test_validate_entries_count()
+{
+  // 256 entries with different values, so none would be dropped
+  static char entries[256 * 48];
+  int length = 0;
+  for (int i = 0; i < 256; i++)
+  {
+    length += snprintf(&entries[length], sizeof(entries) - length, "%s{\"time\": %d, \"value\": %d, \"duration\": 0}",
+                       i == 0 ? "" : ", ", i, i % 2);
+  }
+  static char bigJson[sizeof(entries) + 256];
+  snprintf(bigJson, sizeof(bigJson), "{\"duration\": 1000, \"timelines\": [{\"name\": \"t\", \"outputHardwareId\": 1000, "
+                                     "\"outputId\": 1, \"outputType\": 0, \"entries\": [%s]}]}",
+           entries);
+  StoryboardLoader loader(storyboard, bigJson);
+  loader.load();
+  TEST_ASSERT_EQUAL_UINT32(256, storyboard->getTimelineByIdx(0)->getEntriesCount());
+  TEST_ASSERT_FALSE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL(StoryboardOptimizer::EError::TooManyEntries, optimizer->getReport().error);
+  TEST_ASSERT_EQUAL_STRING("too many entries in the timeline", StoryboardOptimizer::getErrorDescr(optimizer->getReport().error));
+
+  // 255 are fine
+  entries[strrchr(entries, '{') - entries - 2] = '\0';
+  snprintf(bigJson, sizeof(bigJson), "{\"duration\": 1000, \"timelines\": [{\"name\": \"t\", \"outputHardwareId\": 1000, "
+                                     "\"outputId\": 1, \"outputType\": 0, \"entries\": [%s]}]}",
+           entries);
+  StoryboardLoader loader255(storyboard, bigJson);
+  loader255.load();
+  TEST_ASSERT_EQUAL_UINT32(255, storyboard->getTimelineByIdx(0)->getEntriesCount());
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(255, optimizer->getEntriesCount(0));
+}
+
+void test_sorts_by_time()
+{
+  load(1000, "{\"time\": 500, \"value\": 2, \"duration\": 0}, {\"time\": 0, \"value\": 1, \"duration\": 0}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(2, optimizer->getEntriesCount(0));
+  assertEntry(0, 0, 0, 1, 0);
+  assertEntry(0, 1, 500, 2, 0);
+}
+
+void test_drops_entries_without_effect()
+{
+  load(1000, "{\"time\": 0, \"value\": 5, \"duration\": 100}, {\"time\": 200, \"value\": 5, \"duration\": 0}, "
+             "{\"time\": 300, \"value\": 5, \"duration\": 50}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(1, optimizer->getEntriesCount(0));
+  TEST_ASSERT_EQUAL_UINT32(3, optimizer->getReport().entriesBefore);
+  TEST_ASSERT_EQUAL_UINT32(1, optimizer->getReport().entriesAfter);
+}
+
+void test_keeps_the_first_entry()
+{
+  // The value left by the loop before is not known, so the first entry is needed even if it seems redundant
+  load(1000, "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 500, \"value\": 9, \"duration\": 0}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(2, optimizer->getEntriesCount(0));
+}
+
+void test_merges_fades_with_the_same_slope()
+{
+  load(1000, "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 100, \"value\": 10, \"duration\": 100}, "
+             "{\"time\": 200, \"value\": 30, \"duration\": 200}, {\"time\": 400, \"value\": 0, \"duration\": 100}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(3, optimizer->getEntriesCount(0));
+  assertEntry(0, 1, 100, 30, 300);
+  assertEntry(0, 2, 400, 0, 100);
+}
+
+void test_keeps_fades_with_a_different_slope()
+{
+  load(1000, "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 100, \"value\": 10, \"duration\": 100}, "
+             "{\"time\": 200, \"value\": 30, \"duration\": 100}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(3, optimizer->getEntriesCount(0));
+}
+
+void test_collapses_immediate_entries_at_the_same_time()
+{
+  load(1000, "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 300, \"value\": 1, \"duration\": 0}, "
+             "{\"time\": 300, \"value\": 2, \"duration\": 0}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(2, optimizer->getEntriesCount(0));
+  assertEntry(0, 1, 300, 2, 0);
+}
+
+void test_keeps_a_fade_after_an_immediate_entry_at_the_same_time()
+{
+  // The jump to 1 sets where the fade to 2 starts from, it must not be replaced by the fade
+  load(1000, "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 300, \"value\": 1, \"duration\": 0}, "
+             "{\"time\": 300, \"value\": 2, \"duration\": 100}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_UINT8(3, optimizer->getEntriesCount(0));
+  assertEntry(0, 1, 300, 1, 0);
+  assertEntry(0, 2, 300, 2, 100);
+}
+
+void test_keeps_overlapping_fades()
+{
+  load(1000, "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 100, \"value\": 100, \"duration\": 500}, "
+             "{\"time\": 200, \"value\": 100, \"duration\": 0}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  // The second fade is interrupted at 200, the last entry jumps to 100 and is needed
+  TEST_ASSERT_EQUAL_UINT8(3, optimizer->getEntriesCount(0));
+}
+
+void test_equal_timelines_have_the_same_crc()
+{
+  const char *entries = "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 100, \"value\": 10, \"duration\": 100}";
+  load(1000, entries, entries);
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_EQUAL_HEX32(optimizer->getTimelineCrc(0), optimizer->getTimelineCrc(1));
+  uint32_t storyboardCrc = optimizer->getStoryboardCrc();
+
+  tearDown();
+  setUp();
+  load(1000, entries, "{\"time\": 0, \"value\": 0, \"duration\": 0}, {\"time\": 100, \"value\": 11, \"duration\": 100}");
+  TEST_ASSERT_TRUE(optimizer->process(storyboard));
+  TEST_ASSERT_NOT_EQUAL(optimizer->getTimelineCrc(0), optimizer->getTimelineCrc(1));
+  TEST_ASSERT_NOT_EQUAL(storyboardCrc, optimizer->getStoryboardCrc());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_validate_entry_time);
+  RUN_TEST(test_validate_entry_duration);
+  RUN_TEST(test_validate_output_id);
+  RUN_TEST(test_validate_duplicate_output);
+  RUN_TEST(test_validate_entries_count);
+  RUN_TEST(test_sorts_by_time);
+  RUN_TEST(test_drops_entries_without_effect);
+  RUN_TEST(test_keeps_the_first_entry);
+  RUN_TEST(test_merges_fades_with_the_same_slope);
+  RUN_TEST(test_keeps_fades_with_a_different_slope);
+  RUN_TEST(test_collapses_immediate_entries_at_the_same_time);
+  RUN_TEST(test_keeps_a_fade_after_an_immediate_entry_at_the_same_time);
+  RUN_TEST(test_keeps_overlapping_fades);
+  RUN_TEST(test_equal_timelines_have_the_same_crc);
+  return UNITY_END();
+}
@@ -0,0 +1,116 @@
+#include <unity.h>
+
+#include "../../src/modules/StreamReader.h"
+
+static const char *TestFileName = "test_stream.bls";
+
+static StreamReader::Entry makeEntry(uint32_t i)
+{
+  StreamReader::Entry entry;
+  entry.time = i * 10;
+  entry.value = (int32_t)i - 50;
+  entry.duration = i % 3;
+  entry.hardwareId = 0x80000000 + i;
+  entry.outputId = i % 32;
+  entry.loop = 0;
+  return entry;
+}
+
+static void writeStream(millisec duration, uint32_t entriesCount)
+{
+  FILE *f = fopen(TestFileName, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  TEST_ASSERT_TRUE(StreamReader::writeHeader(f, duration, entriesCount));
+  for (uint32_t i = 0; i < entriesCount; i++)
+  {
+    TEST_ASSERT_TRUE(StreamReader::writeEntry(f, makeEntry(i)));
+  }
+  fclose(f);
+}
+
+static StreamReader *reader;
+
+void setUp()
+{
+  reader = new StreamReader();
+}
+
+void tearDown()
+{
+  reader->close();
+  delete reader;
+  remove(TestFileName);
+}
+
+void test_reads_header()
+{
+  writeStream(5000, 3);
+  TEST_ASSERT_TRUE(reader->open(TestFileName));
+  TEST_ASSERT_EQUAL_INT32(5000, reader->getDuration());
+  TEST_ASSERT_EQUAL_UINT32(3, reader->getEntriesCount());
+  TEST_ASSERT_EQUAL_UINT32(0, reader->getAvailable());
+}
+
+void test_rejects_invalid_files()
+{
+  TEST_ASSERT_FALSE(reader->open("missing.bls"));
+
+  writeStream(0, 3);
+  TEST_ASSERT_FALSE(reader->open(TestFileName));
+
+  FILE *f = fopen(TestFileName, "wb");
+  fputs("XXXX", f);
+  fclose(f);
+  TEST_ASSERT_FALSE(reader->open(TestFileName));
+  TEST_ASSERT_FALSE(reader->isOpen());
+}
+
+void test_reads_entries_in_chunks_and_loops()
+{
+  const uint32_t entriesCount = 50;
+  writeStream(1000, entriesCount);
+  TEST_ASSERT_TRUE(reader->open(TestFileName));
+
+  // Three times the file, so it starts over twice
+  for (uint32_t n = 0; n < entriesCount * 3; n++)
+  {
+    if (reader->getAvailable() == 0)
+    {
+      TEST_ASSERT_TRUE(reader->refill());
+      TEST_ASSERT_TRUE(reader->getAvailable() > 0);
+      TEST_ASSERT_TRUE(reader->getAvailable() <= StreamReader::ChunkEntries);
+    }
+    auto expected = makeEntry(n % entriesCount);
+    auto entry = reader->peek();
+    TEST_ASSERT_EQUAL_INT32(expected.time, entry.time);
+    TEST_ASSERT_EQUAL_INT32(expected.value, entry.value);
+    TEST_ASSERT_EQUAL_INT32(expected.duration, entry.duration);
+    TEST_ASSERT_EQUAL_UINT32(expected.hardwareId, entry.hardwareId);
+    TEST_ASSERT_EQUAL_UINT8(expected.outputId, entry.outputId);
+    TEST_ASSERT_EQUAL_UINT32(n / entriesCount, entry.loop);
+    reader->pop();
+  }
+  TEST_ASSERT_EQUAL_UINT32(entriesCount * 3, reader->getEntriesReadCount());
+}
+
+void test_refill_keeps_the_window_bounded()
+{
+  writeStream(1000, 1000);
+  TEST_ASSERT_TRUE(reader->open(TestFileName));
+  for (int i = 0; i < 100; i++)
+  {
+    TEST_ASSERT_TRUE(reader->refill());
+  }
+  TEST_ASSERT_TRUE(reader->getAvailable() <= StreamReader::WindowSize);
+  TEST_ASSERT_TRUE(reader->getAvailable() > StreamReader::WindowSize - StreamReader::ChunkEntries);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_reads_header);
+  RUN_TEST(test_rejects_invalid_files);
+  RUN_TEST(test_reads_entries_in_chunks_and_loops);
+  RUN_TEST(test_refill_keeps_the_window_bounded);
+  return UNITY_END();
+}
@@ -0,0 +1,174 @@
+#include <unity.h>
+
+#include "../../src/modules/TextDisplay.h"
+
+// The display on the I2C stand-in, see test/host: it counts the bytes written and takes the
+// virtual time of the transfer at the bus frequency
+static I2C *i2c;
+static TextDisplay *display;
+
+// Command write (control byte and the 6 bytes of the column and page ranges), then the data write
+// (control byte and 6 columns per character)
+static uint32_t getSpanBytes(uint32_t charsCount) { return 1 + 6 + 1 + charsCount * TextDisplay::CharWidth; }
+
+// Calls service until the frame is on screen, returns the calls
+static uint32_t drain()
+{
+  uint32_t callsCount = 0;
+  while (display->getIsTransferring())
+  {
+    display->service();
+    callsCount += 1;
+    TEST_ASSERT_TRUE(callsCount < 10000);
+  }
+  return callsCount;
+}
+
+void setUp()
+{
+  HostClock::reset();
+  i2c = new I2C(D5, D7);
+  display = new TextDisplay(*i2c);
+  display->init();
+  i2c->resetCounters();
+}
+
+void tearDown()
+{
+  delete display;
+  delete i2c;
+}
+
+void test_nothing_is_sent_before_the_first_flush()
+{
+  display->printf("Hello");
+  display->service();
+  TEST_ASSERT_EQUAL_UINT32(0, i2c->getBytesCount());
+}
+
+void test_first_flush_redraws_everything()
+{
+  display->flush();
+  drain();
+
+  // Each row in spans of ChunkColumns characters
+  const uint32_t spansPerRow = (TextDisplay::Columns + TextDisplay::ChunkColumns - 1) / TextDisplay::ChunkColumns;
+  TEST_ASSERT_EQUAL_UINT32(TextDisplay::Rows * (spansPerRow * getSpanBytes(0) + TextDisplay::Columns * TextDisplay::CharWidth),
+                           i2c->getBytesCount());
+  TEST_ASSERT_EQUAL_UINT32(TextDisplay::Rows * spansPerRow * 2, i2c->getWritesCount());
+}
+
+void test_partial_redraw_sends_only_the_changed_characters()
+{
+  display->printf("Rings: 1\nDevices: 10\nPackets: 1234");
+  display->flush();
+  drain();
+
+  // One character
+  i2c->resetCounters();
+  display->clear();
+  display->printf("Rings: 1\nDevices: 10\nPackets: 1235");
+  display->flush();
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(getSpanBytes(1), i2c->getBytesCount());
+  TEST_ASSERT_EQUAL_UINT32(2, i2c->getWritesCount());
+
+  // Two characters apart, on different rows
+  i2c->resetCounters();
+  display->clear();
+  display->printf("Rings: 2\nDevices: 10\nPackets: 1236");
+  display->flush();
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(2 * getSpanBytes(1), i2c->getBytesCount());
+
+  // Nothing changed
+  i2c->resetCounters();
+  display->flush();
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(0, i2c->getBytesCount());
+}
+
+void test_every_service_call_sends_at_most_one_chunk()
+{
+  display->flush();
+  uint32_t maxBytes = 0;
+  uint32_t maxWrites = 0;
+  while (display->getIsTransferring())
+  {
+    i2c->resetCounters();
+    display->service();
+    if (i2c->getBytesCount() > maxBytes)
+      maxBytes = i2c->getBytesCount();
+    if (i2c->getWritesCount() > maxWrites)
+      maxWrites = i2c->getWritesCount();
+  }
+  TEST_ASSERT_EQUAL_UINT32(getSpanBytes(TextDisplay::ChunkColumns), maxBytes);
+  TEST_ASSERT_EQUAL_UINT32(2, maxWrites);
+  TEST_ASSERT_EQUAL_UINT32(maxBytes, display->getMaxBytesPerService());
+}
+
+void test_printing_during_a_transfer_keeps_the_frame()
+{
+  i2c->setLogEnabled(true);
+  display->printf("AAAA");
+  display->flush();
+  display->clear();
+  display->printf("BBBB");
+  drain();
+
+  // The data write of the first span has the glyphs of A
+  auto &log = i2c->getLog();
+  TEST_ASSERT_TRUE(log.size() >= 2);
+  TEST_ASSERT_EQUAL_UINT32(0x7E, log[1][1]);
+
+  // Until flushed
+  i2c->setLogEnabled(true);
+  display->flush();
+  drain();
+  TEST_ASSERT_EQUAL_UINT32(2, i2c->getLog().size());
+  TEST_ASSERT_EQUAL_UINT32(0x7F, i2c->getLog()[1][1]);
+}
+
+void test_slow_i2c_stays_within_the_time_budget()
+{
+  // Standard mode and slower, the whole frame takes tens of ms while a call stays within
+  // the budget of a single chunk
+  const int frequencies[] = {400000, 100000, 50000};
+  for (int hz : frequencies)
+  {
+    i2c->frequency(hz);
+    display->invalidate();
+    uint64_t budgetUs = i2c->getTransferUs(1 + 6) + i2c->getTransferUs(1 + TextDisplay::ChunkColumns * TextDisplay::CharWidth);
+
+    uint64_t maxCallUs = 0;
+    uint64_t startUs = HostClock::getNowUs();
+    while (display->getIsTransferring())
+    {
+      uint64_t callStartUs = HostClock::getNowUs();
+      display->service();
+      if (HostClock::getNowUs() - callStartUs > maxCallUs)
+        maxCallUs = HostClock::getNowUs() - callStartUs;
+    }
+    uint64_t frameUs = HostClock::getNowUs() - startUs;
+
+    TEST_ASSERT_TRUE(maxCallUs <= budgetUs);
+    TEST_ASSERT_TRUE(frameUs > 10 * budgetUs);
+
+    char message[128];
+    snprintf(message, sizeof(message), "%u Hz: frame %llu us, max per call %llu us, budget %llu us",
+             hz, (unsigned long long)frameUs, (unsigned long long)maxCallUs, (unsigned long long)budgetUs);
+    TEST_MESSAGE(message);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_nothing_is_sent_before_the_first_flush);
+  RUN_TEST(test_first_flush_redraws_everything);
+  RUN_TEST(test_partial_redraw_sends_only_the_changed_characters);
+  RUN_TEST(test_every_service_call_sends_at_most_one_chunk);
+  RUN_TEST(test_printing_during_a_transfer_keeps_the_frame);
+  RUN_TEST(test_slow_i2c_stays_within_the_time_budget);
+  return UNITY_END();
+}
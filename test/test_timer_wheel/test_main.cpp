@@ -0,0 +1,233 @@
+#include <unity.h>
+
+#include <chrono>
+
+#include "../../src/modules/TimerWheel.h"
+
+static TimerWheel *wheel;
+static uint32_t expiredCount;
+static uint32_t expiredAt;
+
+static void onExpired()
+{
+  expiredCount += 1;
+  expiredAt = wheel->getNow();
+}
+
+void setUp()
+{
+  wheel = new TimerWheel();
+  expiredCount = 0;
+  expiredAt = 0;
+}
+
+void tearDown()
+{
+  delete wheel;
+}
+
+// Starts a timer and checks that it expires exactly after delay, on each level of the wheel
+static void checkExpiresAfter(millisec startAt, millisec delay)
+{
+  wheel->advance(startAt);
+  TimerWheel::Timer timer;
+  wheel->start(timer, delay, Callback<void()>(onExpired));
+  TEST_ASSERT_EQUAL_UINT32(1, wheel->getActiveCount());
+
+  wheel->advance(delay - 1);
+  TEST_ASSERT_EQUAL_UINT32(0, expiredCount);
+  TEST_ASSERT_TRUE(wheel->isActive(timer));
+
+  wheel->advance(1);
+  TEST_ASSERT_EQUAL_UINT32(1, expiredCount);
+  TEST_ASSERT_EQUAL_UINT32(startAt + delay, expiredAt);
+  TEST_ASSERT_FALSE(wheel->isActive(timer));
+  TEST_ASSERT_EQUAL_UINT32(0, wheel->getActiveCount());
+}
+
+void test_expires_on_level0()
+{
+  checkExpiresAfter(0, 10);
+}
+
+void test_expires_on_level1()
+{
+  checkExpiresAfter(37, 1000);
+}
+
+void test_expires_on_level2()
+{
+  checkExpiresAfter(4000, 100000);
+}
+
+void test_expires_after_max_delta()
+{
+  // Longer than the three levels, parked and placed again
+  checkExpiresAfter(5, 300000);
+}
+
+void test_expires_on_slot_boundaries()
+{
+  checkExpiresAfter(63, 1);
+  tearDown();
+  setUp();
+  checkExpiresAfter(4095, 64);
+  tearDown();
+  setUp();
+  checkExpiresAfter(64, 4096);
+}
+
+void test_periodic()
+{
+  TimerWheel::Timer timer;
+  wheel->startPeriodic(timer, 100, Callback<void()>(onExpired));
+  wheel->advance(1000);
+  TEST_ASSERT_EQUAL_UINT32(10, expiredCount);
+  TEST_ASSERT_EQUAL_UINT32(1000, expiredAt);
+  TEST_ASSERT_TRUE(wheel->isActive(timer));
+  wheel->stop(timer);
+  TEST_ASSERT_EQUAL_UINT32(0, wheel->getActiveCount());
+}
+
+void test_stop_and_restart()
+{
+  TimerWheel::Timer timer;
+  wheel->start(timer, 50, Callback<void()>(onExpired));
+  wheel->advance(20);
+  wheel->stop(timer);
+  wheel->advance(100);
+  TEST_ASSERT_EQUAL_UINT32(0, expiredCount);
+
+  // Restarting an active timer moves it, it doesn't add a second one
+  wheel->start(timer, 50, Callback<void()>(onExpired));
+  wheel->advance(20);
+  wheel->start(timer, 50, Callback<void()>(onExpired));
+  TEST_ASSERT_EQUAL_UINT32(1, wheel->getActiveCount());
+  wheel->advance(49);
+  TEST_ASSERT_EQUAL_UINT32(0, expiredCount);
+  wheel->advance(1);
+  TEST_ASSERT_EQUAL_UINT32(1, expiredCount);
+}
+
+void test_polled_timer()
+{
+  TimerWheel::Timer timer;
+  wheel->start(timer, 5);
+  wheel->advance(4);
+  TEST_ASSERT_TRUE(wheel->isActive(timer));
+  wheel->advance(1);
+  TEST_ASSERT_FALSE(wheel->isActive(timer));
+}
+
+struct Probe
+{
+  TimerWheel::Timer timer;
+  uint32_t dueAt;
+  uint32_t firedAt;
+  uint32_t firedCount;
+  bool isStopped;
+
+  void onExpired()
+  {
+    firedAt = wheel->getNow();
+    firedCount += 1;
+  }
+};
+
+void test_many_timers_fire_on_their_tick()
+{
+  // Timers on all the levels and past MaxDelta, started at different times, some stopped.
+  // Each one not stopped must fire once, exactly on its tick; prints the cost of advance by one tick
+  const uint32_t probesCount = 600;
+  static Probe probes[probesCount];
+  const millisec maxDelays[] = {64, 4096, 262144, 400000};
+  uint32_t countsPerLevel[4] = {0, 0, 0, 0};
+  uint32_t seed = 7;
+  uint32_t lastDueAt = 0;
+  for (uint32_t i = 0; i < probesCount; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    uint32_t level = i % 4;
+    millisec minDelay = level == 0 ? 1 : maxDelays[level - 1];
+    millisec delay = minDelay + (seed >> 8) % (maxDelays[level] - minDelay);
+    countsPerLevel[level] += 1;
+
+    // A few started later, with the wheel not on a slot boundary
+    if (i % 50 == 49)
+      wheel->advance(13);
+
+    auto &probe = probes[i];
+    probe.dueAt = wheel->getNow() + delay;
+    probe.firedAt = 0;
+    probe.firedCount = 0;
+    probe.isStopped = false;
+    wheel->start(probe.timer, delay, callback(&probe, &Probe::onExpired));
+    if (probe.dueAt > lastDueAt)
+      lastDueAt = probe.dueAt;
+  }
+  // The short ones started first already fired during the later starts
+  uint32_t activeCount = 0;
+  for (auto &probe : probes)
+    activeCount += probe.dueAt > wheel->getNow();
+  TEST_ASSERT_EQUAL_UINT32(activeCount, wheel->getActiveCount());
+
+  // Every tenth is stopped before firing
+  for (uint32_t i = 0; i < probesCount; i += 10)
+  {
+    if (wheel->isActive(probes[i].timer))
+    {
+      wheel->stop(probes[i].timer);
+      probes[i].isStopped = true;
+    }
+  }
+
+  int64_t maxAdvanceNs = 0;
+  uint32_t advancesCount = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (wheel->getNow() < lastDueAt)
+  {
+    auto advanceStart = std::chrono::steady_clock::now();
+    wheel->advance(1);
+    int64_t advanceNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - advanceStart).count();
+    if (advanceNs > maxAdvanceNs)
+      maxAdvanceNs = advanceNs;
+    advancesCount += 1;
+  }
+  int64_t totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_EQUAL_UINT32(0, wheel->getActiveCount());
+
+  for (uint32_t i = 0; i < probesCount; i++)
+  {
+    if (probes[i].isStopped)
+    {
+      TEST_ASSERT_EQUAL_UINT32(0, probes[i].firedCount);
+    }
+    else
+    {
+      TEST_ASSERT_EQUAL_UINT32(1, probes[i].firedCount);
+      TEST_ASSERT_EQUAL_UINT32(probes[i].dueAt, probes[i].firedAt);
+    }
+  }
+
+  char message[200];
+  snprintf(message, sizeof(message),
+           "%u timers (%u, %u, %u on the levels, %u past them) over %u ticks: advance avg %lld ns max %lld ns",
+           probesCount, countsPerLevel[0], countsPerLevel[1], countsPerLevel[2], countsPerLevel[3], advancesCount,
+           (long long)(totalNs / advancesCount), (long long)maxAdvanceNs);
+  TEST_MESSAGE(message);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_expires_on_level0);
+  RUN_TEST(test_expires_on_level1);
+  RUN_TEST(test_expires_on_level2);
+  RUN_TEST(test_expires_after_max_delta);
+  RUN_TEST(test_expires_on_slot_boundaries);
+  RUN_TEST(test_periodic);
+  RUN_TEST(test_stop_and_restart);
+  RUN_TEST(test_polled_timer);
+  RUN_TEST(test_many_timers_fire_on_their_tick);
+  return UNITY_END();
+}
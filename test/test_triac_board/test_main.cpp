@@ -0,0 +1,295 @@
+#include <unity.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+#include "../../src/boards/triac_board.h"
+
+// The board before it was templated on TriacBoardDefaultConfig, for the benchmark: the settings
+// were macros of config.h and the pins were listed in the constructor
+namespace baseline
+{
+#define NOMINAL_100HZ_TICKS_PER_RISE (TICKS_PER_SECOND / RISE_PER_SECOND)
+#define NOMINAL_100HZ_TICKS_MAX_DELTA ((int)(NOMINAL_100HZ_TICKS_PER_RISE * 0.2))
+#define GATE_TICKS (NOMINAL_100HZ_TICKS_PER_RISE * 1 / 100)
+
+class TriacBoard
+{
+public:
+  TriacBoard() : led_heartbeat(LED2),
+                 outputs({(D2), (D3), (D4), (D5), (D6), (D7), (D8), (D9)}),
+                 main_crossover(D10)
+  {
+    input50HzIsStable = 0;
+    ticksSinceZeroCross = 0;
+    lastZeroCrossDurationInTicks = 0;
+    zeroCrossesCount = 0;
+
+    for (int i = 0; i < ANALOGOUT_COUNT; i++)
+    {
+      states[i].reset();
+    }
+
+    if (!SIMULATE_VAC)
+      main_crossover.rise(callback(this, &TriacBoard::main_crossover_rise));
+  }
+
+  void setOutput(int idx, int value, millisec startTime, millisec duration)
+  {
+    __disable_irq();
+    states[idx].set(value, startTime, duration);
+    __enable_irq();
+  }
+
+  // Out of line like the templated one, that is compiled in triac_board.cpp
+  __attribute__((noinline)) void onTick(millisec time)
+  {
+    ticksSinceZeroCross += 1;
+
+    if (SIMULATE_VAC)
+    {
+      if (ticksSinceZeroCross == NOMINAL_100HZ_TICKS_PER_RISE)
+      {
+        main_crossover_rise();
+      }
+    }
+
+    if (!input50HzIsStable)
+    {
+      for (int out = 0; out < ANALOGOUT_COUNT; out++)
+      {
+        outputs[out] = 0;
+      }
+      return;
+    }
+
+    for (int out = 0; out < ANALOGOUT_COUNT; out++)
+    {
+      states[out].update(time);
+
+      int valueToSet;
+      int low_ticks = lastZeroCrossDurationInTicks * ((100.0 - (states[out].value)) / 100.0);
+
+      if (SIMULATE_VAC)
+      {
+        if (ticksSinceZeroCross > low_ticks)
+          valueToSet = 1;
+        else
+          valueToSet = 0;
+      }
+      else
+      {
+        if ((ticksSinceZeroCross < low_ticks) || (ticksSinceZeroCross > (low_ticks + GATE_TICKS)))
+          valueToSet = 0;
+        else
+          valueToSet = 1;
+      }
+
+      outputs[out] = valueToSet;
+    }
+  }
+
+private:
+  DigitalOut led_heartbeat;
+  DigitalOut outputs[ANALOGOUT_COUNT];
+
+  InterruptIn main_crossover;
+
+  struct OutputState
+  {
+    int value;
+    int from;
+    int to;
+    millisec startTime;
+    millisec duration;
+
+    inline void reset()
+    {
+      value = 0;
+      from = 0;
+      to = 0;
+      startTime = 0;
+      duration = 0;
+    }
+    inline void set(int newTo, millisec newStartTime, millisec newDuration)
+    {
+      from = value;
+      to = newTo;
+      startTime = newStartTime;
+      duration = newDuration;
+    }
+    inline void update(int time)
+    {
+      if (duration <= 0)
+      {
+        value = startTime > time ? from : to;
+      }
+      else
+      {
+        int delta = to - from;
+        float t = (((float)time) - startTime) / duration;
+        t = Utils::max(0, Utils::min(t, 1));
+        value = from + (int)(delta * t);
+      }
+    }
+  };
+  OutputState states[ANALOGOUT_COUNT];
+
+  bool input50HzIsStable;
+  int zeroCrossesCount;
+  int ticksSinceZeroCross;
+  int lastZeroCrossDurationInTicks;
+
+  void main_crossover_rise()
+  {
+    lastZeroCrossDurationInTicks = ticksSinceZeroCross;
+    ticksSinceZeroCross = 0;
+
+    input50HzIsStable = true || Utils::absDiff(lastZeroCrossDurationInTicks, NOMINAL_100HZ_TICKS_PER_RISE) < NOMINAL_100HZ_TICKS_MAX_DELTA;
+
+    zeroCrossesCount += 1;
+    if (zeroCrossesCount == RISE_PER_SECOND)
+    {
+      zeroCrossesCount = 0;
+      led_heartbeat = !led_heartbeat;
+    }
+  }
+};
+} // namespace baseline
+
+static const PinName OutputPins[] = {D2, D3, D4, D5, D6, D7, D8, D9};
+static const int TicksPerMs = TICKS_PER_SECOND / 1000;
+
+// Fades of different lengths and directions on every output, so each tick takes the
+// interpolation path of OutputState::update
+template <class Board>
+static void setFades(Board &board)
+{
+  for (int out = 0; out < ANALOGOUT_COUNT; out++)
+  {
+    board.setOutput(out, out % 2 == 0 ? 100 : 0, 0, 0);
+  }
+  for (int out = 0; out < ANALOGOUT_COUNT; out++)
+  {
+    board.setOutput(out, out % 2 == 0 ? 0 : 100, 10 * out, 200 + 100 * out);
+  }
+}
+
+// The level of every output pin after each tick, starting at tick 0
+template <class Board>
+static std::vector<int> record(Board &board, int ticksCount)
+{
+  std::vector<int> levels;
+  for (int tick = 0; tick < ticksCount; tick++)
+  {
+    board.onTick(tick / TicksPerMs);
+    for (int out = 0; out < ANALOGOUT_COUNT; out++)
+    {
+      levels.push_back(HostPins::read(OutputPins[out]));
+    }
+  }
+  return levels;
+}
+
+template <class Board>
+static int64_t getTicksWallNs(Board &board, int ticksCount)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int tick = 0; tick < ticksCount; tick++)
+  {
+    board.onTick(tick / TicksPerMs);
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void setUp()
+{
+  HostPins::reset();
+}
+
+void tearDown()
+{
+}
+
+void test_outputs_are_on_for_their_percent_of_each_half_wave()
+{
+  TriacBoard board;
+  board.setOutput(0, 100, 0, 0);
+  board.setOutput(1, 0, 0, 0);
+  board.setOutput(2, 50, 0, 0);
+  board.setOutput(3, 25, 0, 0);
+
+  // From the first zero-crossing, then 10 half waves
+  const int ticksPerRise = TICKS_PER_SECOND / RISE_PER_SECOND;
+  record(board, ticksPerRise);
+  std::vector<int> levels = record(board, 10 * ticksPerRise);
+
+  int onTicks[4] = {0};
+  for (size_t i = 0; i < levels.size(); i += ANALOGOUT_COUNT)
+  {
+    for (int out = 0; out < 4; out++)
+      onTicks[out] += levels[i + out];
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(10, abs(onTicks[0] - 10 * ticksPerRise));
+  TEST_ASSERT_EQUAL_INT(0, onTicks[1]);
+  TEST_ASSERT_LESS_OR_EQUAL(10, abs(onTicks[2] - 10 * ticksPerRise / 2));
+  TEST_ASSERT_LESS_OR_EQUAL(10, abs(onTicks[3] - 10 * ticksPerRise / 4));
+}
+
+void test_same_outputs_as_the_baseline()
+{
+  const int ticksCount = 2 * TICKS_PER_SECOND;
+
+  baseline::TriacBoard before;
+  setFades(before);
+  std::vector<int> expected = record(before, ticksCount);
+
+  HostPins::reset();
+  TriacBoard after;
+  setFades(after);
+  std::vector<int> actual = record(after, ticksCount);
+
+  TEST_ASSERT_EQUAL_UINT32(expected.size(), actual.size());
+  TEST_ASSERT_TRUE(expected == actual);
+}
+
+void test_tick_cost()
+{
+  // The pin writes are stores in the host stand-in, so the time is the one of onTick itself
+  const int ticksCount = 20 * TICKS_PER_SECOND;
+  const int runsCount = 5;
+
+  baseline::TriacBoard before;
+  TriacBoard after;
+  setFades(before);
+  setFades(after);
+
+  // Best of the runs, interleaved so both see the same machine load
+  int64_t beforeNs = INT64_MAX;
+  int64_t afterNs = INT64_MAX;
+  for (int run = 0; run < runsCount; run++)
+  {
+    int64_t ns = getTicksWallNs(before, ticksCount);
+    if (ns < beforeNs)
+      beforeNs = ns;
+    ns = getTicksWallNs(after, ticksCount);
+    if (ns < afterNs)
+      afterNs = ns;
+  }
+
+  char message[192];
+  snprintf(message, sizeof(message),
+           "{\"bench\":\"triacTick\",\"outputs\":%d,\"ticks\":%d,\"baselineNsPerTick\":%lld,\"templateNsPerTick\":%lld}",
+           ANALOGOUT_COUNT, ticksCount, (long long)(beforeNs / ticksCount), (long long)(afterNs / ticksCount));
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_outputs_are_on_for_their_percent_of_each_half_wave);
+  RUN_TEST(test_same_outputs_as_the_baseline);
+  RUN_TEST(test_tick_cost);
+  return UNITY_END();
+}
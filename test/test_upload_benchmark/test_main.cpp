@@ -0,0 +1,216 @@
+#include <unity.h>
+
+#include <chrono>
+#include <string>
+
+#include "../../src/modules/MasterBoard.h"
+
+// Uploads and plays synthetic storyboards on a simulated ring, see test/host. Each run prints one
+// JSON line starting with {"bench": so the results can be collected and compared across versions
+static bitLabCore *core;
+static RingNetwork *ring;
+static MasterBoard *master;
+
+static const char *StoryboardPath = "bench_storyboard.json";
+
+struct BenchConfig
+{
+  uint32_t devicesCount;
+  uint32_t timelinesPerDevice;
+  uint32_t entriesPerTimeline;
+};
+
+// All within the 12 KB of the upload image and the 255 timelines of a storyboard
+static const BenchConfig Configs[] = {
+    {1, 1, 16},
+    {1, 32, 8},
+    {5, 8, 16},
+    {10, 1, 64},
+    {10, 4, 20},
+    {7, 32, 3},
+    {2, 1, 255},
+};
+
+static uint32_t getHardwareId(uint32_t deviceIdx) { return 0x1000 + deviceIdx; }
+
+// Fades with alternating slopes, so the optimizer keeps every entry, and different on each device
+static void writeStoryboard(const BenchConfig &config)
+{
+  const millisec step = 10;
+  FILE *file = fopen(StoryboardPath, "w");
+  TEST_ASSERT_NOT_NULL(file);
+  fprintf(file, "{\"duration\": %d, \"timelines\": [", (int)(config.entriesPerTimeline * step + step));
+  for (uint32_t d = 0; d < config.devicesCount; d++)
+  {
+    for (uint32_t t = 0; t < config.timelinesPerDevice; t++)
+    {
+      fprintf(file, "%s{\"outputHardwareId\": %u, \"outputId\": %u, \"entries\": [",
+              d == 0 && t == 0 ? "" : ",", getHardwareId(d), t);
+      for (uint32_t e = 0; e < config.entriesPerTimeline; e++)
+      {
+        fprintf(file, "%s{\"time\": %d, \"value\": %u, \"duration\": %d}",
+                e == 0 ? "" : ",", (int)(e * step), (e % 2) * 1000 + t + 1 + d * 32,
+                (int)(step / 2));
+      }
+      fprintf(file, "]}");
+    }
+  }
+  fprintf(file, "]}");
+  fclose(file);
+}
+
+static void start(uint32_t nodesCount)
+{
+  ring = new RingNetwork(PA_11, PA_12, true);
+  for (uint32_t i = 0; i < nodesCount; i++)
+  {
+    ring->addNode(getHardwareId(i));
+  }
+  core->addModule(ring);
+  core->addModule(master);
+}
+
+static bool runUntilOutput(const char *text, uint64_t maxDurationUs)
+{
+  return core->runUntil([text]() { return HostConsole::get().getOutput().find(text) != std::string::npos; },
+                        maxDurationUs);
+}
+
+// Types the command and waits for its reply, returns true if it's Ok
+static bool command(const char *line)
+{
+  HostConsole::get().takeOutput();
+  HostConsole::get().type(line);
+  HostConsole::get().type("\n");
+  core->runUntil([]() {
+    auto &output = HostConsole::get().getOutput();
+    return output.find("Ok\n") != std::string::npos || output.find("Error\n") != std::string::npos;
+  },
+                 1000000);
+  return HostConsole::get().getOutput().find("Ok\n") != std::string::npos;
+}
+
+static int64_t getElapsedUs(std::chrono::steady_clock::time_point from)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - from).count();
+}
+
+// Enumerates the ring and loads the storyboard of the config
+static void prepare(const BenchConfig &config)
+{
+  writeStoryboard(config);
+  start(config.devicesCount);
+  TEST_ASSERT_TRUE(runUntilOutput("Enumeration completed", 1000000));
+  char line[64];
+  snprintf(line, sizeof(line), "load %s", StoryboardPath);
+  TEST_ASSERT_TRUE(command(line));
+}
+
+void setUp()
+{
+  HostClock::reset();
+  HostPins::reset();
+  HostConsole::get().reset();
+  core = new bitLabCore();
+  master = new MasterBoard();
+  ring = NULL;
+}
+
+void tearDown()
+{
+  delete master;
+  delete ring;
+  delete core;
+  remove(StoryboardPath);
+}
+
+void test_upload_cost()
+{
+  for (auto &config : Configs)
+  {
+    prepare(config);
+
+    ring->resetCounters();
+    uint64_t simStartUs = HostClock::getNowUs();
+    auto wallStart = std::chrono::steady_clock::now();
+    TEST_ASSERT_TRUE(command("upload"));
+    TEST_ASSERT_TRUE(runUntilOutput("{\"upload\":{\"ok\":true", 60000000));
+    int64_t wallUs = getElapsedUs(wallStart);
+    uint64_t simUs = HostClock::getNowUs() - simStartUs;
+
+    // Every node got all of its entries
+    for (uint32_t d = 0; d < config.devicesCount; d++)
+    {
+      auto &node = ring->getNode(d);
+      TEST_ASSERT_EQUAL_UINT32(config.timelinesPerDevice, node.getTimelinesCount());
+      for (uint32_t t = 0; t < config.timelinesPerDevice; t++)
+      {
+        TEST_ASSERT_EQUAL_UINT32(config.entriesPerTimeline, node.getEntries(t).size());
+      }
+      TEST_ASSERT_EQUAL_UINT32(0, node.getInvalidPacketsCount());
+    }
+    char timelines[32];
+    snprintf(timelines, sizeof(timelines), "\"timelines\":%u,", config.devicesCount * config.timelinesPerDevice);
+    TEST_ASSERT_TRUE(HostConsole::get().getOutput().find(timelines) != std::string::npos);
+
+    char message[256];
+    snprintf(message, sizeof(message),
+             "{\"bench\":\"upload\",\"devices\":%u,\"timelinesPerDevice\":%u,\"entriesPerTimeline\":%u,"
+             "\"rotations\":%u,\"packets\":%u,\"bytes\":%u,\"wireBytes\":%llu,\"simUs\":%llu,\"wallUs\":%lld}",
+             config.devicesCount, config.timelinesPerDevice, config.entriesPerTimeline,
+             ring->getRotationsCount(), ring->getSentPacketsCount(), ring->getSentBytesCount(),
+             (unsigned long long)ring->getWireBytesCount(), (unsigned long long)simUs, (long long)wallUs);
+    TEST_MESSAGE(message);
+
+    tearDown();
+    setUp();
+  }
+}
+
+void test_playback_cost()
+{
+  // Only the master plays, the nodes just keep their time
+  const uint32_t ticksCount = 10000;
+  for (auto &config : Configs)
+  {
+    prepare(config);
+    TEST_ASSERT_TRUE(command("upload"));
+    TEST_ASSERT_TRUE(runUntilOutput("{\"upload\":{\"ok\":true", 60000000));
+    TEST_ASSERT_TRUE(command("play"));
+    core->runFor(100000);
+    TEST_ASSERT_TRUE(ring->getNode(0).getIsPlaying());
+
+    // The whole firmware per tick: the tick, its mainLoop iterations and the packets of the ring
+    auto wallStart = std::chrono::steady_clock::now();
+    core->runFor(ticksCount * 1000);
+    int64_t wallUs = getElapsedUs(wallStart);
+
+    // The tick alone
+    const uint32_t tickCallsCount = 1000000;
+    wallStart = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < tickCallsCount; i++)
+    {
+      master->tick(1);
+    }
+    int64_t tickWallUs = getElapsedUs(wallStart);
+
+    char message[256];
+    snprintf(message, sizeof(message),
+             "{\"bench\":\"play\",\"devices\":%u,\"timelinesPerDevice\":%u,\"entriesPerTimeline\":%u,"
+             "\"nsPerTick\":%lld,\"tickNs\":%lld}",
+             config.devicesCount, config.timelinesPerDevice, config.entriesPerTimeline,
+             (long long)(wallUs * 1000 / ticksCount), (long long)(tickWallUs * 1000 / tickCallsCount));
+    TEST_MESSAGE(message);
+
+    tearDown();
+    setUp();
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_upload_cost);
+  RUN_TEST(test_playback_cost);
+  return UNITY_END();
+}